@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include "account.h"
+
+
+struct account_counts {
+    unsigned long      allocs;
+    unsigned long      frees;
+    unsigned long long bytes;   /* Allocated, counting what malloc rounded up */
+};
+
+
+static struct {
+    bool                  running;
+    enum account_phase    phase;
+    double                last;     /* When time was last charged */
+    double                time[ACCOUNT_COUNT];
+    struct account_counts count[ACCOUNT_COUNT];
+    long long             live;     /* Heap bytes in use */
+    long long             peak;
+} account = { 0 };
+
+
+static const char *account_names[] = {
+#define ACCOUNT_NAME(name, str) str,
+    ACCOUNT_PHASES(ACCOUNT_NAME)
+#undef ACCOUNT_NAME
+};
+
+
+#ifdef DICT_ACCOUNT
+
+/* Every allocation in the process, the shared libraries' included, comes here
+   instead of to libc, since the executable's definitions take precedence.
+   These are glibc's own entry points, which cannot recurse back into ours */
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void  __libc_free(void *ptr);
+
+
+static void account_alloc(void *ptr)
+{
+    struct account_counts *c = &account.count[account.phase];
+    long long size, live;
+
+    if (!ptr) {
+        return;
+    }
+    size = malloc_usable_size(ptr);
+    __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&c->bytes, size, __ATOMIC_RELAXED);
+    live = __atomic_add_fetch(&account.live, size, __ATOMIC_RELAXED);
+    if (live > account.peak) {
+        account.peak = live;    /* Racy, but only ever off by one allocation */
+    }
+}
+
+
+static void account_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    __atomic_add_fetch(&account.count[account.phase].frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&account.live, (long long)malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+
+void *calloc(size_t n, size_t size)
+{
+    void *ptr = __libc_calloc(n, size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+    size_t old = (ptr) ? malloc_usable_size(ptr) : 0;
+    void *grown;
+
+    grown = __libc_realloc(ptr, size);
+    if (ptr && (grown || !size)) {
+        __atomic_add_fetch(&account.count[account.phase].frees, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&account.live, (long long)old, __ATOMIC_RELAXED);
+    }
+    if (grown) {
+        account_alloc(grown);
+    }
+    return grown;
+}
+
+
+/* Defined here, even though nothing here calls it, so that what it returns is
+   counted when it reaches free */
+void *reallocarray(void *ptr, size_t n, size_t size)
+{
+    if (size && n > (size_t)-1 / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, n * size);
+}
+
+
+void *memalign(size_t align, size_t size)
+{
+    void *ptr = __libc_memalign(align, size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+    *ptr = memalign(align, size);
+    return (*ptr) ? 0 : ENOMEM;
+}
+
+
+void *valloc(size_t size)
+{
+    void *ptr = __libc_valloc(size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+
+void *pvalloc(size_t size)
+{
+    void *ptr = __libc_pvalloc(size);
+
+    account_alloc(ptr);
+    return ptr;
+}
+
+
+void free(void *ptr)
+{
+    account_free(ptr);
+    __libc_free(ptr);
+}
+
+#endif /* DICT_ACCOUNT */
+
+
+static double account_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/** @brief Charges the time since the last switch to the current phase, then
+ *      makes @p phase current
+ */
+static void account_switch(enum account_phase phase)
+{
+    double now = account_now();
+
+    account.time[account.phase] += now - account.last;
+    account.last = now;
+    account.phase = phase;
+}
+
+
+void account_start(void)
+{
+    memset(account.time, 0, sizeof account.time);
+    memset(account.count, 0, sizeof account.count);
+    account.peak = account.live;
+    account.phase = ACCOUNT_OTHER;
+    account.last = account_now();
+    account.running = true;
+}
+
+
+enum account_phase account_enter(enum account_phase phase)
+{
+    enum account_phase prev = account.phase;
+
+    if (account.running) {
+        account_switch(phase);
+    }
+    return prev;
+}
+
+
+void account_leave(enum account_phase prev)
+{
+    if (account.running) {
+        account_switch(prev);
+    }
+}
+
+
+void account_report(FILE *fp)
+{
+    struct account_counts total = { 0 }, *c;
+    double elapsed = 0;
+    struct rusage ru;
+    int i;
+
+    if (!account.running) {
+        return;
+    }
+    account_switch(account.phase);
+    fprintf(fp, "%-8s %10s", "phase", "ms");
+#ifdef DICT_ACCOUNT
+    fprintf(fp, " %8s %8s %10s", "allocs", "frees", "bytes");
+#endif
+    fputc('\n', fp);
+    for (i = 0; i <= ACCOUNT_COUNT; i++) {
+        c = (i < ACCOUNT_COUNT) ? &account.count[i] : &total;
+        fprintf(fp, "%-8s %10.3f", (i < ACCOUNT_COUNT) ? account_names[i] : "total",
+                (i < ACCOUNT_COUNT) ? account.time[i] * 1e3 : elapsed * 1e3);
+#ifdef DICT_ACCOUNT
+        fprintf(fp, " %8lu %8lu %10llu", c->allocs, c->frees, c->bytes);
+#endif
+        fputc('\n', fp);
+        if (i < ACCOUNT_COUNT) {
+            elapsed += account.time[i];
+            total.allocs += c->allocs;
+            total.frees += c->frees;
+            total.bytes += c->bytes;
+        }
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(fp, "peak RSS %ld kB", ru.ru_maxrss);
+#ifdef DICT_ACCOUNT
+    fprintf(fp, ", peak heap %lld kB\n", (account.peak + 1023) / 1024);
+#else
+    fputs("; build with make dict-account to count allocations\n", fp);
+#endif
+    account.running = false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef DICT_ACCOUNT_H
+#define DICT_ACCOUNT_H
+
+#include <stdio.h>
+
+/** Every phase a query's time and allocations are charged to, with the name
+ *  it is reported under. Whatever runs outside the others is charged to OTHER
+ */
+#define ACCOUNT_PHASES(X)   \
+    X(OTHER,  "other")      \
+    X(CACHE,  "cache")      \
+    X(FETCH,  "fetch")      \
+    X(PARSE,  "parse")      \
+    X(RENDER, "render")
+
+
+enum account_phase {
+#define ACCOUNT_ENUM(name, str) ACCOUNT_##name,
+    ACCOUNT_PHASES(ACCOUNT_ENUM)
+#undef ACCOUNT_ENUM
+    ACCOUNT_COUNT
+};
+
+
+/** @brief Zeroes every counter and starts charging phases. Until this is
+ *      called, account_enter and account_leave do nothing
+ */
+void account_start(void);
+
+
+/** @brief Charges what follows to @p phase, until the matching account_leave
+ *  @returns The phase to pass to account_leave
+ */
+enum account_phase account_enter(enum account_phase phase);
+
+
+/** @brief Goes back to charging @p prev, as returned by account_enter */
+void account_leave(enum account_phase prev);
+
+
+/** @brief Prints the wall time spent in each phase since account_start, and
+ *      the peak resident set size of the process, to @p fp, then stops
+ *      charging phases. Builds with -DDICT_ACCOUNT (make dict-account) also
+ *      count the allocations made and freed in each phase, json-c's and
+ *      libcurl's included, and the peak of the heap in use
+ */
+void account_report(FILE *fp);
+
+
+#endif /* DICT_ACCOUNT_H */
@@ -0,0 +1,419 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <json-c/json.h>
+
+#include "audio.h"
+#include "cache.h"
+#include "key.h"
+#include "log.h"
+#include "net.h"
+
+/** The store, beside the cache directory */
+#define AUDIO_DIR "audio"
+
+/** The most clips remembered per entry, and so fetched at once */
+#define AUDIO_CLIPS 4
+
+/** The longest clip URL kept */
+#define AUDIO_URLLEN 512
+
+/** Default size of the store in kB, if DICT_AUDIO_MAX is not set */
+#define AUDIO_MAX 8192
+
+#define PATHLEN 260
+
+
+struct audio_job {
+    CURL          *hcurl;
+    struct net_buf buf;
+    char           path[PATHLEN];
+};
+
+
+static struct {
+    char url[AUDIO_CLIPS][AUDIO_URLLEN];
+    int  count;
+} clips = { 0 };
+
+
+/** @brief Adds @p url to the clips unless it is already there. The API has
+ *      been known to give protocol-relative URLs, which are taken as https
+ */
+static void audio_add(const char *url)
+{
+    char buf[AUDIO_URLLEN];
+    int i, len;
+
+    len = snprintf(buf, sizeof buf, "%s%s", (strncmp(url, "//", 2)) ? "" : "https:", url);
+    if (len < 0 || (size_t)len >= sizeof buf || clips.count == AUDIO_CLIPS) {
+        return;
+    }
+    for (i = 0; i < clips.count; i++) {
+        if (!strcmp(clips.url[i], buf)) {
+            return;
+        }
+    }
+    memcpy(clips.url[clips.count++], buf, len + 1);
+}
+
+
+void audio_collect(struct json_object *json)
+{
+    struct json_object *phon, *node, *url;
+    size_t i, j;
+
+    clips.count = 0;
+    if (json_object_get_type(json) != json_type_array) {
+        return;
+    }
+    for (i = 0; i < json_object_array_length(json); i++) {
+        node = json_object_array_get_idx(json, i);
+        if (!json_object_object_get_ex(node, "phonetics", &phon)) {
+            continue;
+        }
+        for (j = 0; j < json_object_array_length(phon); j++) {
+            node = json_object_array_get_idx(phon, j);
+            if (json_object_object_get_ex(node, "audio", &url)
+             && json_object_get_string_len(url)) {
+                audio_add(json_object_get_string(url));
+            }
+        }
+    }
+}
+
+
+/** @brief Writes the path that the clip at @p url is stored under to @p path.
+ *      The name is the hash of the URL, keeping the extension of the file it
+ *      names, since some players go by it
+ *  @returns Nonzero on error or truncation
+ */
+static int audio_path(char *path, size_t len, const char *url)
+{
+    char dir[PATHLEN], name[KEY_NAMELEN];
+    const char *ext;
+    size_t extlen;
+    int res;
+
+    if (cache_auxpath(dir, sizeof dir, AUDIO_DIR)) {
+        return 1;
+    }
+    key_name(url, name);
+    ext = strrchr(url, '/');
+    ext = strrchr((ext) ? ext : url, '.');
+    extlen = (ext) ? strcspn(ext, "?#") : 0;
+    if (extlen < 2 || extlen > 5) {
+        ext = "";
+        extlen = 0;
+    }
+    res = snprintf(path, len, "%s/%s%.*s", dir, name, (int)extlen, ext);
+    return res < 0 || (size_t)res >= len;
+}
+
+
+/** @brief Starts the player on @p path
+ *  @returns Its pid, or zero on error
+ */
+static pid_t audio_start(const char *path)
+{
+    static const char *const players[][6] = {
+        { "mpv", "--really-quiet", "--no-video", NULL },
+        { "ffplay", "-nodisp", "-autoexit", "-loglevel", "quiet", NULL },
+        { "mpg123", "-q", NULL },
+        { "play", "-q", NULL }
+    };
+    const size_t N = sizeof players / sizeof *players;
+    const char *argv[8], *env;
+    char cmd[PATHLEN];
+    size_t i, j;
+    pid_t pid;
+    int fd;
+
+    env = getenv("DICT_PLAYER");
+    fflush(NULL);
+    pid = fork();
+    if (pid == -1) {
+        dict_perror("Cannot start audio player");
+        return 0;
+    } else if (pid) {
+        return pid;
+    }
+    fd = open("/dev/null", O_RDWR);
+    if (fd != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+    }
+    if (env && *env) {
+        snprintf(cmd, sizeof cmd, "%s \"$1\"", env);
+        execl("/bin/sh", "sh", "-c", cmd, "sh", path, (char *)NULL);
+    } else {
+        for (i = 0; i < N; i++) {
+            for (j = 0; players[i][j]; j++) {
+                argv[j] = players[i][j];
+            }
+            argv[j++] = path;
+            argv[j] = NULL;
+            execvp(argv[0], (char *const *)argv);
+        }
+    }
+    _exit(127);
+}
+
+
+/** @brief Waits for the player started by audio_start to finish
+ *  @returns Nonzero on error
+ */
+static int audio_wait(pid_t pid)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            dict_perror("Cannot wait for audio player");
+            return 1;
+        }
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        dict_logs(DICT_ERROR, "No audio player found; set DICT_PLAYER to one");
+        return 1;
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        dict_logs(DICT_ERROR, "Audio player failed");
+        return 1;
+    }
+    return 0;
+}
+
+
+static int audio_play(const char *path)
+{
+    pid_t pid;
+
+    pid = audio_start(path);
+    return !pid || audio_wait(pid);
+}
+
+
+/** @brief Retrieves the size the store is held to, in bytes */
+static off_t audio_max(void)
+{
+    const char *env;
+    long max;
+
+    env = getenv("DICT_AUDIO_MAX");
+    max = (env) ? atol(env) : 0;
+    return (off_t)((max > 0) ? max : AUDIO_MAX) * 1024;
+}
+
+
+struct audio_clip {
+    time_t used;
+    off_t  size;
+    char   name[KEY_NAMELEN + 8];
+};
+
+
+static int audio_clipcmp(const void *a, const void *b)
+{
+    const struct audio_clip *x = a, *y = b;
+
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+
+/** @brief Removes the clips played longest ago until the store fits its
+ *      budget. A clip's modification time is when it was last played
+ */
+static void audio_evict(void)
+{
+    char dir[PATHLEN], path[PATHLEN];
+    struct audio_clip *clip = NULL, *grown;
+    size_t n = 0, cap = 0, i;
+    off_t total = 0, max;
+    struct dirent *ent;
+    struct stat sbuf;
+    DIR *dp;
+
+    if (cache_auxpath(dir, sizeof dir, AUDIO_DIR) || !(dp = opendir(dir))) {
+        return;
+    }
+    while ((ent = readdir(dp))) {
+        if (ent->d_name[0] == '.' || strlen(ent->d_name) >= sizeof clip->name
+         || snprintf(path, sizeof path, "%s/%s", dir, ent->d_name) >= (int)sizeof path
+         || stat(path, &sbuf) || !S_ISREG(sbuf.st_mode)) {
+            continue;
+        }
+        if (n == cap) {
+            cap = (cap) ? cap * 2 : 64;
+            grown = realloc(clip, cap * sizeof *clip);
+            if (!grown) {
+                break;
+            }
+            clip = grown;
+        }
+        clip[n].used = sbuf.st_mtime;
+        clip[n].size = sbuf.st_size;
+        strcpy(clip[n].name, ent->d_name);
+        total += clip[n++].size;
+    }
+    closedir(dp);
+    max = audio_max();
+    if (total > max) {
+        qsort(clip, n, sizeof *clip, audio_clipcmp);
+        for (i = 0; i < n && total > max; i++) {
+            if (snprintf(path, sizeof path, "%s/%s", dir, clip[i].name) < (int)sizeof path
+             && !remove(path)) {
+                total -= clip[i].size;
+            }
+        }
+    }
+    free(clip);
+}
+
+
+/** @brief Writes the completed transfer in @p job to the store. Clips are
+ *      written under a temporary name and renamed into place, so that a clip
+ *      is never seen half-written
+ *  @returns Nonzero if nothing was stored
+ */
+static int audio_store(struct audio_job *job, CURLcode result)
+{
+    char tmp[PATHLEN + 8];
+    long status = 0;
+    FILE *fp;
+    bool ok;
+
+    curl_easy_getinfo(job->hcurl, CURLINFO_RESPONSE_CODE, &status);
+    if (result || status != 200 || !job->buf.len) {
+        return 1;
+    }
+    snprintf(tmp, sizeof tmp, "%s.tmp", job->path);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        dict_perror("Cannot store pronunciation");
+        return 1;
+    }
+    ok = fwrite(job->buf.data, 1, job->buf.len, fp) == job->buf.len;
+    if (fclose(fp) || !ok || rename(tmp, job->path)) {
+        dict_perror("Cannot store pronunciation");
+        remove(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Runs every transfer to completion, storing each clip as it arrives
+ *      and starting the player on the first
+ *  @returns The player's pid, or zero if none was started
+ */
+static pid_t audio_run(CURLM *multi)
+{
+    struct audio_job *job;
+    int running, queued;
+    pid_t player = 0;
+    CURLMsg *msg;
+
+    do {
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE) {
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+                curl_multi_remove_handle(multi, msg->easy_handle);
+                if (!audio_store(job, msg->data.result) && !player) {
+                    player = audio_start(job->path);
+                }
+            }
+        }
+        if (running) {
+            curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+    } while (running);
+    return player;
+}
+
+
+/** @brief Downloads every clip at once, playing the first that arrives */
+static int audio_fetch(void)
+{
+    struct audio_job jobs[AUDIO_CLIPS] = { 0 };
+    char dir[PATHLEN];
+    pid_t player = 0;
+    CURLM *multi;
+    int i, res = 1;
+
+    if (cache_auxpath(dir, sizeof dir, AUDIO_DIR)
+     || (mkdir(dir, 0755) && errno != EEXIST)) {
+        dict_perror("Cannot create pronunciation store");
+        return 1;
+    } else if (curlfn_load()) {
+        return 1;
+    }
+    multi = curl_multi_init();
+    if (!multi) {
+        dict_logs(DICT_ERROR, "Could not initialize curl");
+        return 1;
+    }
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    for (i = 0; i < clips.count; i++) {
+        jobs[i].hcurl = curl_easy_init();
+        if (!jobs[i].hcurl) {
+            dict_logs(DICT_ERROR, "Could not initialize curl");
+            goto cleanup;
+        }
+        curl_easy_setopt(jobs[i].hcurl, CURLOPT_PRIVATE, &jobs[i]);
+        curl_easy_setopt(jobs[i].hcurl, CURLOPT_FOLLOWLOCATION, 1L);
+        net_tune(jobs[i].hcurl);
+        if (!audio_path(jobs[i].path, sizeof jobs[i].path, clips.url[i])
+         && !net_prepare_url(jobs[i].hcurl, clips.url[i], &jobs[i].buf)) {
+            curl_multi_add_handle(multi, jobs[i].hcurl);
+        }
+    }
+    player = audio_run(multi);
+    if (player) {
+        res = audio_wait(player);
+    } else {
+        dict_logs(DICT_ERROR, "Could not download the pronunciation");
+    }
+    audio_evict();
+cleanup:
+    for (i = 0; i < clips.count; i++) {
+        if (jobs[i].hcurl) {
+            curl_multi_remove_handle(multi, jobs[i].hcurl);
+            curl_easy_cleanup(jobs[i].hcurl);
+        }
+        net_buf_free(&jobs[i].buf);
+    }
+    curl_multi_cleanup(multi);
+    return res;
+}
+
+
+int audio_say(void)
+{
+    char path[PATHLEN];
+    int i;
+
+    if (!clips.count) {
+        dict_logs(DICT_ERROR, "No pronunciation audio is available");
+        return 1;
+    }
+    for (i = 0; i < clips.count; i++) {
+        if (!audio_path(path, sizeof path, clips.url[i]) && !access(path, R_OK)) {
+            /* Marks it as recently played, for eviction */
+            utimensat(AT_FDCWD, path, NULL, 0);
+            return audio_play(path);
+        }
+    }
+    return audio_fetch();
+}
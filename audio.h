@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef DICT_AUDIO_H
+#define DICT_AUDIO_H
+
+struct json_object;
+
+
+/** @brief Remembers the pronunciation clips linked from the entry @p json,
+ *      forgetting those of any earlier entry. Call this before the entry is
+ *      printed, which drops the pronunciations that have no text. Passing NULL
+ *      only forgets
+ */
+void audio_collect(struct json_object *json);
+
+
+/** @brief Plays a remembered clip. Clips are kept in a store beside the cache,
+ *      named after the hash of their URL, so words sharing a recording share
+ *      the file. If none is stored yet, all of them are downloaded at once and
+ *      the first to arrive is played. The store is held to DICT_AUDIO_MAX kB,
+ *      evicting the clips played longest ago. The player is DICT_PLAYER, run
+ *      through the shell with the clip's path as $1, else the first of a few
+ *      common ones found
+ *  @returns Nonzero on error
+ */
+int audio_say(void);
+
+
+#endif /* DICT_AUDIO_H */
@@ -0,0 +1,329 @@
+/* syscall() is not POSIX, and io_uring has no libc wrappers */
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#       include <linux/io_uring.h>
+#       include <sys/mman.h>
+#       include <sys/syscall.h>
+#       define BATCH_URING 1
+#   endif
+#endif
+
+#include "batch.h"
+
+/** Requests submitted to io_uring at once. Larger batches go in rounds */
+#define BATCH_ENTRIES 64
+
+/** The most threads reading at once without io_uring, the caller's included */
+#define BATCH_THREADS 8
+
+/** Marks a request that has not been carried out yet */
+#define BATCH_PENDING (-ECANCELED)
+
+
+/** @brief Opens and reads one request with ordinary blocking calls */
+static void batch_read_one(struct batch_read *req)
+{
+    ssize_t got;
+
+    req->len = 0;
+    req->fd = open(req->path, O_RDONLY | O_CLOEXEC);
+    if (req->fd < 0) {
+        req->len = -errno;
+        return;
+    }
+    while ((size_t)req->len < req->cap) {
+        got = read(req->fd, req->buf + req->len, req->cap - req->len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        } else if (got < 0) {
+            req->len = -errno;
+            return;
+        } else if (!got) {
+            break;
+        }
+        req->len += got;
+    }
+}
+
+
+struct batch_pool {
+    struct batch_read *reqs;
+    size_t             n;
+    size_t             next;    /* The next request to claim */
+};
+
+
+static void *batch_worker(void *arg)
+{
+    struct batch_pool *pool = arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->n) {
+        batch_read_one(&pool->reqs[i]);
+    }
+    return NULL;
+}
+
+
+/** @brief Shares the requests between up to BATCH_THREADS threads, the caller
+ *      among them. If no thread can be started, the caller does them all
+ */
+static void batch_threads(struct batch_read *reqs, size_t n)
+{
+    struct batch_pool pool = { .reqs = reqs, .n = n };
+    pthread_t tid[BATCH_THREADS - 1];
+    size_t want, started = 0, i;
+
+    want = (n < BATCH_THREADS) ? n : BATCH_THREADS;
+    for (i = 1; i < want; i++) {
+        if (pthread_create(&tid[started], NULL, batch_worker, &pool)) {
+            break;
+        }
+        started++;
+    }
+    batch_worker(&pool);
+    for (i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+}
+
+
+#ifdef BATCH_URING
+
+/** The rings shared with the kernel, mapped from the io_uring descriptor */
+struct batch_ring {
+    int fd;
+
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void    *sq;
+    void    *cq;
+    size_t   sqlen;
+    size_t   cqlen;
+    size_t   sqeslen;
+    unsigned entries;
+};
+
+
+static void batch_ring_free(struct batch_ring *r)
+{
+    if (r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqeslen);
+    }
+    if (r->cq != MAP_FAILED && r->cq != r->sq) {
+        munmap(r->cq, r->cqlen);
+    }
+    if (r->sq != MAP_FAILED) {
+        munmap(r->sq, r->sqlen);
+    }
+    close(r->fd);
+}
+
+
+/** @brief Creates a ring and maps it
+ *  @returns Nonzero if io_uring is unavailable, as it is on old kernels and
+ *      where it has been disabled
+ */
+static int batch_ring_init(struct batch_ring *r)
+{
+    struct io_uring_params p;
+    const int prot = PROT_READ | PROT_WRITE;
+
+    memset(&p, 0, sizeof p);
+    r->sq = r->cq = r->sqes = MAP_FAILED;
+    r->fd = syscall(__NR_io_uring_setup, BATCH_ENTRIES, &p);
+    if (r->fd < 0) {
+        return 1;
+    }
+    r->sqlen = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    r->cqlen = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->sqlen = r->cqlen = (r->sqlen > r->cqlen) ? r->sqlen : r->cqlen;
+    }
+    r->sqeslen = p.sq_entries * sizeof (struct io_uring_sqe);
+    r->sq = mmap(NULL, r->sqlen, prot, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq != MAP_FAILED) {
+        r->cq = (p.features & IORING_FEAT_SINGLE_MMAP)
+              ? r->sq : mmap(NULL, r->cqlen, prot, MAP_SHARED, r->fd, IORING_OFF_CQ_RING);
+    }
+    if (r->cq != MAP_FAILED) {
+        r->sqes = mmap(NULL, r->sqeslen, prot, MAP_SHARED, r->fd, IORING_OFF_SQES);
+    }
+    if (r->sqes == MAP_FAILED) {
+        batch_ring_free(r);
+        return 1;
+    }
+    r->sq_tail = (unsigned *)((char *)r->sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq + p.sq_off.array);
+    r->cq_head = (unsigned *)((char *)r->cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    return 0;
+}
+
+
+/** @brief Fills the next submission entry with the open, or the read, of
+ *      request number @p i
+ */
+static void batch_ring_prep(struct batch_ring *r, unsigned tail, struct batch_read *req, size_t i, bool reading)
+{
+    unsigned slot = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[slot];
+
+    memset(sqe, 0, sizeof *sqe);
+    if (reading) {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = req->fd;
+        sqe->addr = (uintptr_t)req->buf;
+        sqe->len = req->cap;
+    } else {
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)req->path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    sqe->user_data = i;
+    r->sq_array[slot] = slot;
+}
+
+
+/** @brief Records the completion @p cqe in the request it belongs to */
+static void batch_ring_reap(struct batch_read *reqs, const struct io_uring_cqe *cqe, bool reading)
+{
+    struct batch_read *req = &reqs[cqe->user_data];
+
+    if (reading) {
+        req->len = cqe->res;
+    } else if (cqe->res >= 0) {
+        req->fd = cqe->res;
+        req->len = BATCH_PENDING;   /* Opened, not read */
+    } else {
+        req->len = cqe->res;
+    }
+}
+
+
+/** @brief Submits every open, or every read of an opened file, then waits for
+ *      all of them to complete, in rounds of as many as the ring holds
+ *  @returns Nonzero if the ring failed. Requests it did not finish are left
+ *      pending
+ */
+static int batch_ring_round(struct batch_ring *r, struct batch_read *reqs, size_t n, bool reading)
+{
+    unsigned tail, head, inflight, submitted, done;
+    size_t i = 0;
+    long got;
+
+    while (i < n) {
+        tail = *r->sq_tail;
+        for (inflight = 0; i < n && inflight < r->entries; i++) {
+            if (reading && reqs[i].fd < 0) {
+                continue;
+            }
+            batch_ring_prep(r, tail++, &reqs[i], i, reading);
+            inflight++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+        for (submitted = done = 0; done < inflight; ) {
+            got = syscall(__NR_io_uring_enter, r->fd, inflight - submitted,
+                          inflight - done, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (got < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                return 1;
+            } else if (got > 0) {
+                submitted += got;
+            }
+            head = *r->cq_head;
+            while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+                batch_ring_reap(reqs, &r->cqes[head & *r->cq_mask], reading);
+                head++;
+                done++;
+            }
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+    return 0;
+}
+
+
+static bool batch_uring_enabled(void)
+{
+    const char *env = getenv("DICT_IO_URING");
+
+    return !env || strcmp(env, "0");
+}
+
+
+/** @brief Carries out the batch through io_uring. Requests the kernel could
+ *      not carry out, such as where it predates asynchronous opens, are done
+ *      the ordinary way
+ *  @returns Nonzero if io_uring is unavailable, having done nothing
+ */
+static int batch_uring(struct batch_read *reqs, size_t n)
+{
+    struct batch_ring ring;
+    size_t i;
+
+    if (!batch_uring_enabled() || batch_ring_init(&ring)) {
+        return 1;
+    }
+    if (!batch_ring_round(&ring, reqs, n, false)) {
+        batch_ring_round(&ring, reqs, n, true);
+    }
+    batch_ring_free(&ring);
+    for (i = 0; i < n; i++) {
+        if (reqs[i].len == BATCH_PENDING || reqs[i].len == -EINVAL
+         || reqs[i].len == -EOPNOTSUPP) {
+            if (reqs[i].fd >= 0) {
+                close(reqs[i].fd);
+            }
+            batch_read_one(&reqs[i]);
+        }
+    }
+    return 0;
+}
+
+#endif /* BATCH_URING */
+
+
+void batch_read(struct batch_read *reqs, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        reqs[i].fd = -1;
+        reqs[i].len = BATCH_PENDING;
+    }
+    if (n == 1) {
+        batch_read_one(reqs);
+        return;
+    }
+#ifdef BATCH_URING
+    if (!batch_uring(reqs, n)) {
+        return;
+    }
+#endif
+    batch_threads(reqs, n);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef DICT_BATCH_H
+#define DICT_BATCH_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/** One file to read in a batch */
+struct batch_read {
+    const char *path;
+    char       *buf;
+    size_t      cap;    /* Size of buf. At most this much of the file is read */
+    ssize_t     len;    /* Out: the bytes read, or a negated errno */
+    int         fd;     /* Out: still open for the caller to close, or -1 */
+};
+
+
+/** @brief Opens and reads the start of every file in @p reqs at once, so that
+ *      their latencies overlap instead of adding up. Where the kernel has
+ *      io_uring, every open is submitted in one system call and every read in
+ *      another, and they complete in any order; otherwise a few threads share
+ *      the work. DICT_IO_URING=0 forces the threads
+ */
+void batch_read(struct batch_read *reqs, size_t n);
+
+
+#endif /* DICT_BATCH_H */
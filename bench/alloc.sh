@@ -0,0 +1,41 @@
+#!/bin/sh
+# Reports the time, allocations and peak memory of each phase of a lookup: a
+# cache hit, a cache miss fetched from the network, and a miss the API has no
+# entry for. The allocation columns need the accounting build.
+#
+# Usage: bench/alloc.sh [ENDPOINT]
+#
+# Build ./dict-account first (make dict-account). Without ENDPOINT, a local
+# stand-in server is started on port 8080.
+
+DICT=${DICT:-./dict-account}
+ENDPOINT=$1
+
+if [ ! -x "$DICT" ]; then
+    echo "$DICT: not built; run make dict-account"
+    exit 1
+fi
+
+if [ -z "$ENDPOINT" ]; then
+    python3 "$(dirname "$0")/standin.py" 8080 &
+    SERVER=$!
+    trap 'kill $SERVER' EXIT
+    ENDPOINT=http://localhost:8080/api/v2/entries/en/
+    sleep 1
+fi
+
+HOME=$(mktemp -d)
+mkdir -p "$HOME/.local/share/dict/cache"
+export HOME DICT_ENDPOINT="$ENDPOINT" DICT_PREFETCH=0 DICT_WORDS=
+
+# Keeps only the report, dropping any errors logged before it and the color
+# reset they leave at the start of the next line
+report() {
+    echo "== $1"
+    "$DICT" --timing "$2" 2>&1 >/dev/null | sed -n 's/^\x1b\[0m//; /^phase/,$p'
+}
+
+report "miss, fetched" run
+report "hit" run
+report "miss, no entry" zzrun
+rm -rf "$HOME"
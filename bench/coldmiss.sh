@@ -0,0 +1,53 @@
+#!/bin/sh
+# Measures the latency of a cache miss in a fresh process, with and without the
+# connection metadata (Alt-Svc, HSTS, remembered address) persisted by earlier
+# processes.
+#
+# Usage: bench/coldmiss.sh [RUNS] [ENDPOINT]
+#
+# Without ENDPOINT, a local stand-in server is started on port 8080. The
+# stand-in only speaks plain HTTP/1.1, so against it the difference is just
+# name resolution; pass the real API root to measure TLS and HTTP/2 as well.
+
+DICT=${DICT:-./dict}
+RUNS=${1:-20}
+ENDPOINT=$2
+
+if [ -z "$ENDPOINT" ]; then
+    python3 "$(dirname "$0")/standin.py" 8080 &
+    SERVER=$!
+    trap 'kill $SERVER' EXIT
+    ENDPOINT=http://localhost:8080/api/v2/entries/en/
+    sleep 1
+fi
+
+HOME=$(mktemp -d)
+mkdir -p "$HOME/.local/share/dict/cache"
+export HOME DICT_ENDPOINT="$ENDPOINT"
+
+now_ms() {
+    date +%s%N | cut -c1-13
+}
+
+# Times RUNS forced lookups, optionally discarding the metadata before each
+run() {
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        if [ "$1" = cold ]; then
+            rm -f "$HOME/.local/share/dict/altsvc" "$HOME/.local/share/dict/hsts" \
+                  "$HOME/.local/share/dict/resolve"
+        fi
+        start=$(now_ms)
+        "$DICT" -f -s "word$i" >/dev/null
+        echo $(( $(now_ms) - start ))
+        i=$((i + 1))
+    done | sort -n | awk -v label="$1" '
+        { t[NR] = $1; sum += $1 }
+        END { printf "%-6s runs %d  mean %.1f ms  median %d ms  max %d ms\n",
+              label, NR, sum / NR, t[int((NR + 1) / 2)], t[NR] }'
+}
+
+run cold
+"$DICT" -f -s warmup >/dev/null
+run primed
+rm -rf "$HOME"
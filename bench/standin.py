@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Local stand-in for dictionaryapi.dev, for benchmarks that must not depend on
+the real service. Every word gets the same canned entry with its headword
+substituted; words beginning with "zz" get the API's 404 reply.
+
+Usage: standin.py [PORT] [DELAY_MS]
+"""
+import http.server
+import json
+import sys
+import time
+
+ENTRY = [{
+    "word": "run",
+    "phonetic": "/ɹʌn/",
+    "phonetics": [{"text": "/ɹʌn/", "audio": ""}],
+    "meanings": [{
+        "partOfSpeech": "verb",
+        "definitions": [{
+            "definition": "To move swiftly, especially on foot, with both feet "
+                          "briefly off the ground at each stride.",
+            "synonyms": ["sprint", "dash"],
+            "antonyms": ["walk"],
+        }],
+        "synonyms": [],
+        "antonyms": [],
+    }],
+}]
+
+MISSING = {
+    "title": "No Definitions Found",
+    "message": "Sorry pal, we couldn't find definitions for the word you were looking for.",
+    "resolution": "You can try the search again at later time or head to the web instead.",
+}
+
+
+class StandIn(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    delay = 0.0
+
+    def do_GET(self):
+        word = self.path.rsplit("/", 1)[-1]
+        time.sleep(self.delay)
+        if word.startswith("zz"):
+            status, body = 404, MISSING
+        else:
+            status, body = 200, [dict(ENTRY[0], word=word)]
+        data = json.dumps(body).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, *args):
+        pass
+
+
+if __name__ == "__main__":
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 8080
+    StandIn.delay = float(sys.argv[2]) / 1000 if len(sys.argv) > 2 else 0.0
+    http.server.ThreadingHTTPServer(("127.0.0.1", port), StandIn).serve_forever()
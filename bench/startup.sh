@@ -0,0 +1,40 @@
+#!/bin/sh
+# Measures exec-to-exit time of a hot cache hit, which never touches the
+# network, for each dict binary given.
+#
+# Usage: bench/startup.sh [RUNS] [DICT...]
+#
+# By default this compares ./dict, which loads libcurl on demand, against
+# ./dict-eager (make dict-eager), which links it at startup.
+
+RUNS=${1:-500}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- ./dict ./dict-eager
+
+HOME=$(mktemp -d)
+export HOME
+mkdir -p "$HOME/.local/share/dict/cache"
+cat > "$HOME/.local/share/dict/cache/run" <<'JSON'
+[{"word":"run","phonetic":"/ɹʌn/","phonetics":[{"text":"/ɹʌn/"}],"meanings":[{"partOfSpeech":"verb","definitions":[{"definition":"To move swiftly on foot.","synonyms":["sprint"],"antonyms":["walk"]}],"synonyms":[],"antonyms":[]}]}]
+JSON
+
+now_us() {
+    date +%s%N | cut -c1-16
+}
+
+for dict in "$@"; do
+    if [ ! -x "$dict" ]; then
+        echo "$dict: not built, skipping"
+        continue
+    fi
+    "$dict" run >/dev/null
+    i=0
+    start=$(now_us)
+    while [ $i -lt "$RUNS" ]; do
+        "$dict" run >/dev/null
+        i=$((i + 1))
+    done
+    end=$(now_us)
+    echo "$dict: $RUNS hot hits, $(( (end - start) / RUNS )) us each"
+done
+rm -rf "$HOME"
@@ -0,0 +1,386 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+
+#include "bundle.h"
+#include "cache.h"
+#include "key.h"
+#include "log.h"
+
+/** Identifies a bundle and its format. Bump the digit when the layout changes */
+#define BUNDLE_MAGIC "DICTBDL1"
+
+/** Size of the fixed header. Every integer in a bundle is little endian, so
+ *  that one machine can export for any other
+ */
+#define BUNDLE_HEADLEN 32
+
+/** Size of an index record before its word */
+#define BUNDLE_RECLEN 18
+
+
+/*  Layout:
+ *
+ *  header  magic[8] count:u32 indexlen:u32 indexcrc:u32 rawlen:u32
+ *          zlen:u32 rawcrc:u32
+ *  index   count records of fetched:u64 offset:u32 len:u32 wordlen:u16 word
+ *  data    zlen bytes of zlib stream, inflating to rawlen bytes of replies
+ */
+
+
+/** Growable byte buffer for building a bundle */
+struct bundle_buf {
+    unsigned char *data;
+    size_t         len;
+    size_t         cap;
+};
+
+
+struct bundle_export {
+    struct bundle_buf index;
+    struct bundle_buf raw;
+    uint32_t          count;
+};
+
+
+static int bundle_put(struct bundle_buf *buf, const void *src, size_t len)
+{
+    unsigned char *data;
+    size_t cap;
+
+    if (buf->len + len > buf->cap) {
+        cap = (buf->cap) ? buf->cap : 65536;
+        while (cap < buf->len + len) {
+            cap *= 2;
+        }
+        data = realloc(buf->data, cap);
+        if (!data) {
+            dict_perror("Cannot grow bundle");
+            return 1;
+        }
+        buf->data = data;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, src, len);
+    buf->len += len;
+    return 0;
+}
+
+
+static void bundle_le(unsigned char *dst, uint64_t val, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        dst[i] = (unsigned char)(val >> (8 * i));
+    }
+}
+
+
+static uint64_t bundle_get(const unsigned char *src, int bytes)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--) {
+        val = (val << 8) | src[i];
+    }
+    return val;
+}
+
+
+static int bundle_add(const char *word,
+                      const char *reply,
+                      size_t      len,
+                      time_t      fetched,
+                      void       *ctx)
+{
+    struct bundle_export *ex = ctx;
+    unsigned char rec[BUNDLE_RECLEN];
+    size_t wlen = strlen(word);
+
+    if (ex->raw.len + len > UINT32_MAX) {
+        dict_logs(DICT_ERROR, "Cache is too large to bundle");
+        return 1;
+    }
+    bundle_le(rec, (uint64_t)fetched, 8);
+    bundle_le(rec + 8, ex->raw.len, 4);
+    bundle_le(rec + 12, len, 4);
+    bundle_le(rec + 16, wlen, 2);
+    ex->count++;
+    return bundle_put(&ex->index, rec, sizeof rec)
+        || bundle_put(&ex->index, word, wlen)
+        || bundle_put(&ex->raw, reply, len);
+}
+
+
+/** @brief Writes the header, index and compressed replies to @p path, through
+ *      a temporary file so that a failed export never leaves half a bundle
+ */
+static int bundle_write(const char *path, const struct bundle_export *ex)
+{
+    unsigned char head[BUNDLE_HEADLEN], *z;
+    char tmp[4096];
+    uLongf zlen;
+    FILE *fp;
+    int res = 1;
+
+    zlen = compressBound(ex->raw.len);
+    z = malloc(zlen);
+    if (!z) {
+        dict_perror("Cannot compress bundle");
+        return 1;
+    }
+    if (compress2(z, &zlen, ex->raw.data, ex->raw.len, Z_BEST_COMPRESSION) != Z_OK) {
+        dict_logs(DICT_ERROR, "Cannot compress bundle");
+        free(z);
+        return 1;
+    }
+    memcpy(head, BUNDLE_MAGIC, 8);
+    bundle_le(head + 8, ex->count, 4);
+    bundle_le(head + 12, ex->index.len, 4);
+    bundle_le(head + 16, crc32(0, ex->index.data, ex->index.len), 4);
+    bundle_le(head + 20, ex->raw.len, 4);
+    bundle_le(head + 24, zlen, 4);
+    bundle_le(head + 28, crc32(0, ex->raw.data, ex->raw.len), 4);
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        dict_perror("Cannot create bundle");
+    } else {
+        res = fwrite(head, 1, sizeof head, fp) != sizeof head
+           || fwrite(ex->index.data, 1, ex->index.len, fp) != ex->index.len
+           || fwrite(z, 1, zlen, fp) != zlen;
+        res = fclose(fp) || res || rename(tmp, path);
+        if (res) {
+            dict_perror("Cannot write bundle");
+            remove(tmp);
+        }
+    }
+    free(z);
+    return res;
+}
+
+
+int bundle_export(const char *path)
+{
+    struct bundle_export ex = { 0 };
+    int res;
+
+    res = cache_init() || cache_walk(bundle_add, &ex);
+    if (!res && !ex.count) {
+        dict_logs(DICT_ERROR, "The cache is empty; nothing to export");
+        res = 1;
+    }
+    if (!res) {
+        res = bundle_write(path, &ex);
+    }
+    if (!res) {
+        dict_logf(DICT_INFO, "Exported %u words to %s", ex.count, path);
+    }
+    free(ex.index.data);
+    free(ex.raw.data);
+    return res;
+}
+
+
+/** @brief Reads the whole file at @p path into memory */
+static unsigned char *bundle_slurp(const char *path, size_t *len)
+{
+    unsigned char *data = NULL;
+    long size;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        dict_perror("Cannot open bundle");
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+        dict_perror("Cannot read bundle");
+    } else if (!(data = malloc(size ? size : 1))) {
+        dict_perror("Cannot read bundle");
+    } else if (fread(data, 1, size, fp) != (size_t)size) {
+        dict_perror("Cannot read bundle");
+        free(data);
+        data = NULL;
+    }
+    *len = (size_t)size;
+    fclose(fp);
+    return data;
+}
+
+
+/** @brief Checks the header and index of the bundle in @p file, and inflates
+ *      its replies into a new buffer
+ *  @returns The replies, or NULL if the bundle is damaged
+ */
+static unsigned char *bundle_open(const unsigned char *file,
+                                  size_t               len,
+                                  uint32_t            *count,
+                                  const unsigned char **index)
+{
+    uint32_t ilen, rawlen, zlen;
+    unsigned char *raw;
+    uLongf outlen;
+
+    if (len < BUNDLE_HEADLEN || memcmp(file, BUNDLE_MAGIC, 8)) {
+        dict_logs(DICT_ERROR, "Not a dict bundle, or from a newer version");
+        return NULL;
+    }
+    *count = bundle_get(file + 8, 4);
+    ilen = bundle_get(file + 12, 4);
+    rawlen = bundle_get(file + 20, 4);
+    zlen = bundle_get(file + 24, 4);
+    *index = file + BUNDLE_HEADLEN;
+    if ((uint64_t)BUNDLE_HEADLEN + ilen + zlen != len
+     || crc32(0, *index, ilen) != bundle_get(file + 16, 4)) {
+        dict_logs(DICT_ERROR, "Bundle is truncated or corrupt");
+        return NULL;
+    }
+    raw = malloc(rawlen ? rawlen : 1);
+    if (!raw) {
+        dict_perror("Cannot inflate bundle");
+        return NULL;
+    }
+    outlen = rawlen;
+    if (uncompress(raw, &outlen, *index + ilen, zlen) != Z_OK || outlen != rawlen
+     || crc32(0, raw, rawlen) != bundle_get(file + 28, 4)) {
+        dict_logs(DICT_ERROR, "Bundle is truncated or corrupt");
+        free(raw);
+        return NULL;
+    }
+    return raw;
+}
+
+
+/** @brief Checks that every record in the index lies within the bundle and
+ *      names a canonical word, before anything is merged
+ */
+static int bundle_check(const unsigned char *index,
+                        size_t               ilen,
+                        uint32_t             count,
+                        size_t               rawlen)
+{
+    const unsigned char *rec = index, *end = index + ilen;
+    char word[KEY_MAXLEN], key[KEY_MAXLEN];
+    uint64_t off, len, wlen;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (end - rec < BUNDLE_RECLEN) {
+            break;
+        }
+        off = bundle_get(rec + 8, 4);
+        len = bundle_get(rec + 12, 4);
+        wlen = bundle_get(rec + 16, 2);
+        if (off + len > rawlen || wlen >= KEY_MAXLEN
+         || (size_t)(end - rec - BUNDLE_RECLEN) < wlen) {
+            break;
+        }
+        memcpy(word, rec + BUNDLE_RECLEN, wlen);
+        word[wlen] = '\0';
+        if (key_canon(word, key) || strcmp(word, key)) {
+            break;
+        }
+        rec += BUNDLE_RECLEN + wlen;
+    }
+    if (i < count || rec != end) {
+        dict_logs(DICT_ERROR, "Bundle index is corrupt");
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Reads the word of the index record at @p rec into @p word
+ *  @returns The length of the word
+ */
+static uint32_t bundle_word(const unsigned char *rec, char word[KEY_MAXLEN])
+{
+    uint32_t wlen = bundle_get(rec + 16, 2);
+
+    memcpy(word, rec + BUNDLE_RECLEN, wlen);
+    word[wlen] = '\0';
+    return wlen;
+}
+
+
+/** @brief Counts the words merged from the index at @p index, as flagged in
+ *      @p merged, that are still in the user's cache
+ */
+static unsigned bundle_kept(const unsigned char *index, uint32_t count, const bool *merged)
+{
+    const unsigned char *rec;
+    char word[KEY_MAXLEN];
+    time_t atime, fetched;
+    unsigned res = 0;
+    uint32_t i, wlen;
+
+    for (rec = index, i = 0; i < count; i++, rec += BUNDLE_RECLEN + wlen) {
+        wlen = bundle_word(rec, word);
+        res += merged[i] && !cache_stat(word, &atime, &fetched);
+    }
+    return res;
+}
+
+
+int bundle_import(const char *path)
+{
+    const unsigned char *index, *rec;
+    unsigned char *file, *raw = NULL;
+    unsigned added = 0, kept = 0, failed = 0;
+    char word[KEY_MAXLEN], *reply;
+    uint32_t count = 0, i, wlen;
+    bool *merged = NULL;
+    size_t flen, evicted;
+    int res = 1;
+
+    file = bundle_slurp(path, &flen);
+    if (file) {
+        raw = bundle_open(file, flen, &count, &index);
+    }
+    if (raw && !(merged = calloc(count + 1, sizeof *merged))) {
+        dict_perror("Cannot import bundle");
+    } else if (raw && !bundle_check(index, bundle_get(file + 12, 4), count, bundle_get(file + 20, 4))
+            && !cache_init()) {
+        cache_index_load();
+        /* Entries keep their fetch times as access times, which are older than
+           anything read here, so eviction would pick the bundle's own entries
+           first. It waits until every one is in */
+        cache_hold(true);
+        for (rec = index, i = 0; i < count; i++, rec += BUNDLE_RECLEN + wlen) {
+            wlen = bundle_word(rec, word);
+            reply = strndup((const char *)raw + bundle_get(rec + 8, 4), bundle_get(rec + 12, 4));
+            switch ((reply) ? cache_merge(word, reply, bundle_get(rec, 8)) : -1) {
+            case 0:
+                merged[i] = true;
+                break;
+            case 1:
+                kept++;
+                break;
+            default:
+                failed++;
+            }
+            free(reply);
+        }
+        evicted = cache_hold(false);
+        added = bundle_kept(index, count, merged);
+        if (evicted) {
+            dict_logf(DICT_WARN, "The cache holds at most %d entries, so %zu were evicted; "
+                      "set DICT_CACHE_MAX to keep more", cache_max(), evicted);
+        }
+        dict_logf(DICT_INFO, "Imported %u words; %u were already up to date, %u failed",
+                  added, kept, failed);
+        res = failed != 0;
+    }
+    free(merged);
+    free(raw);
+    free(file);
+    return res;
+}
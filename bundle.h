@@ -0,0 +1,23 @@
+#pragma once
+
+#ifndef DICT_BUNDLE_H
+#define DICT_BUNDLE_H
+
+
+/** @brief Writes every entry in the cache to a single bundle at @p path. A
+ *      bundle holds a checksummed index of words and fetch times, followed by
+ *      the replies as one compressed, checksummed stream
+ *  @returns Nonzero on error
+ */
+int bundle_export(const char *path);
+
+
+/** @brief Merges the bundle at @p path into the cache. Where both hold a word,
+ *      the more recently fetched entry wins. The bundle is verified in full
+ *      before anything is written
+ *  @returns Nonzero on error
+ */
+int bundle_import(const char *path);
+
+
+#endif /* DICT_BUNDLE_H */
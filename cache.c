@@ -12,17 +12,30 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include <fnmatch.h>
 #include <ftw.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include "cache.h"
+#include "batch.h"
+#include "core.h"
+#include "freeze.h"
+#include "hot.h"
+#include "key.h"
 #include "log.h"
+#include "meta.h"
+#include "trace.h"
 
 /** The maximum number of chars used for stack buffers containing paths  */
 #define PATHLEN 260
@@ -33,24 +46,73 @@
  */
 #define LISTLEN 16
 
-/** The maximum number of allowed entries in the disk cache. Each word appears
- *  to be about 1 kB
+/** Each entry begins with this header, naming the word it holds, followed by
+ *  the reply verbatim. The file itself is named after the word's hash
+ */
+#define CACHE_HEADER "word: "
+
+/** Optional header lines after the first, holding the reply's validators. The
+ *  header ends at a blank line
+ */
+#define CACHE_ETAG     "etag: "
+#define CACHE_MODIFIED "last-modified: "
+
+
+/** The default maximum number of allowed entries in the disk cache. Each word
+ *  appears to be about 1 kB. Override this with DICT_CACHE_MAX
  */
 #define CACHE_MAX 200
 
+/** The read-only cache shared by every user, consulted after their own. An
+ *  administrator fills it by copying entries or a user's cache into it.
+ *  Override this with DICT_SYSTEM_CACHE; an empty value disables it
+ */
+#ifndef CACHE_SYSTEM_DIR
+#   define CACHE_SYSTEM_DIR "/var/cache/dict"
+#endif
+
 
 static struct {
     char dir[PATHLEN];
+    char sysdir[PATHLEN];   /* Empty if there is no system tier */
+    bool promote;           /* Copy system tier hits into the user tier */
+    bool hold;              /* Eviction is suspended, see cache_hold */
 
     int    count;
     time_t lru;
 } cache = { 0 };
 
 
-/** @brief Retrieves the maximum number of files allowed in the cache */
-static int cache_max(void)
+/** In-memory mirror of the cache directory. Long-running modes load this once
+ *  so that lookups, writes and eviction never have to walk the directory
+ */
+static struct {
+    struct cache_ent {
+        char  *name;    /* NULL if never used, idx_tomb if deleted */
+        time_t atime;
+        off_t  size;
+    } *tab;
+
+    size_t cap;     /* Always a power of two */
+    size_t count;   /* Live entries */
+    size_t used;    /* Live entries and tombstones */
+    bool   loaded;
+} idx = { 0 };
+
+static char idx_tomb[1];
+
+
+int cache_max(void)
 {
-    return CACHE_MAX;
+    static int max = 0;
+    const char *env;
+
+    if (!max) {
+        env = getenv("DICT_CACHE_MAX");
+        max = (env) ? atoi(env) : 0;
+        max = (max > 0) ? max : CACHE_MAX;
+    }
+    return max;
 }
 
 
@@ -81,11 +143,37 @@ static int cache_snprintf(char *dst, size_t len, const char *restrict fmt, ...)
 }
 
 
+/** @brief Finds the system tier, and whether its hits are promoted. Set
+ *      DICT_CACHE_PROMOTE=1 to copy them into the user tier, so that they
+ *      survive the system tier being cleared and count towards eviction
+ */
+static void cache_init_system(void)
+{
+    const char *env;
+
+    env = getenv("DICT_SYSTEM_CACHE");
+    env = (env) ? env : CACHE_SYSTEM_DIR;
+    if (*env && cache_snprintf(cache.sysdir, sizeof cache.sysdir, "%s", env)) {
+        cache.sysdir[0] = '\0';
+    }
+    env = getenv("DICT_CACHE_PROMOTE");
+    cache.promote = env && *env && strcmp(env, "0");
+}
+
+
 int cache_init(void)
 {
+    static bool once = false;
     const char *home;
     int res = 1;
 
+    if (cache_ready()) {
+        return 0;
+    }
+    if (!once) {
+        cache_init_system();
+        once = true;
+    }
     home = getenv("HOME");
     if (home) {
         res = cache_snprintf(cache.dir, sizeof cache.dir, "%s/.local/share/dict/cache", home);
@@ -101,14 +189,277 @@ int cache_init(void)
 }
 
 
-/** Updates the file's last-accessed time to right now */
-static int cache_touch(FILE *fp)
+/** @brief Finds the slot for @p word. If it is absent, this is the slot it
+ *      should be inserted into
+ */
+static struct cache_ent *idx_slot(const char *word)
+{
+    struct cache_ent *ent, *tomb = NULL;
+    size_t i, mask = idx.cap - 1;
+
+    for (i = key_hash(word) & mask; ; i = (i + 1) & mask) {
+        ent = &idx.tab[i];
+        if (!ent->name) {
+            return (tomb) ? tomb : ent;
+        } else if (ent->name == idx_tomb) {
+            tomb = (tomb) ? tomb : ent;
+        } else if (!strcmp(ent->name, word)) {
+            return ent;
+        }
+    }
+}
+
+
+static struct cache_ent *idx_find(const char *word)
+{
+    struct cache_ent *ent;
+
+    ent = idx_slot(word);
+    return (ent->name && ent->name != idx_tomb) ? ent : NULL;
+}
+
+
+/** @brief Doubles the table when it is half full, discarding tombstones */
+static int idx_grow(void)
+{
+    struct cache_ent *old = idx.tab, *ent;
+    size_t oldcap = idx.cap, i;
+
+    if (2 * (idx.used + 1) <= idx.cap) {
+        return 0;
+    }
+    idx.cap = (oldcap) ? 2 * oldcap : 256;
+    idx.tab = calloc(idx.cap, sizeof *idx.tab);
+    if (!idx.tab) {
+        dict_perror("Cannot grow cache index");
+        idx.tab = old;
+        idx.cap = oldcap;
+        return 1;
+    }
+    for (i = 0; i < oldcap; i++) {
+        if (old[i].name && old[i].name != idx_tomb) {
+            ent = idx_slot(old[i].name);
+            *ent = old[i];
+        }
+    }
+    idx.used = idx.count;
+    free(old);
+    return 0;
+}
+
+
+/** @brief Inserts or updates @p word in the index */
+static int idx_put(const char *word, time_t atime, off_t size)
+{
+    struct cache_ent *ent;
+
+    if (idx_grow()) {
+        return 1;
+    }
+    ent = idx_slot(word);
+    if (!ent->name || ent->name == idx_tomb) {
+        if (!ent->name) {
+            idx.used++;
+        }
+        ent->name = strdup(word);
+        if (!ent->name) {
+            ent->name = idx_tomb;
+            return 1;
+        }
+        idx.count++;
+    }
+    ent->atime = atime;
+    ent->size = size;
+    return 0;
+}
+
+
+static void idx_del(struct cache_ent *ent)
+{
+    free(ent->name);
+    ent->name = idx_tomb;
+    idx.count--;
+}
+
+
+/** @brief FTW callback that records each cache file in the index */
+static int cache_ftw_index(const char        *path,
+                           const struct stat *sbuf,
+                           int                type)
+{
+    const char *name;
+
+    if (type == FTW_F) {
+        name = strrchr(path, '/');
+        name = (name) ? name + 1 : path;
+        return idx_put(name, sbuf->st_atime, sbuf->st_size);
+    }
+    return 0;
+}
+
+
+int cache_index_load(void)
+{
+    if (!cache_ready()) {
+        return 1;
+    }
+    if (idx.loaded) {
+        return 0;
+    }
+    if (idx_grow() || ftw(cache.dir, cache_ftw_index, 1) == -1) {
+        if (errno != ENOENT) {
+            dict_perror("Cannot index cache directory");
+            return 1;
+        }
+    }
+    idx.loaded = true;
+    return 0;
+}
+
+
+int cache_auxpath(char *buf, size_t len, const char *name)
+{
+    const char *slash;
+
+    if (!cache_ready()) {
+        return 1;
+    }
+    slash = strrchr(cache.dir, '/');
+    return cache_snprintf(buf, len, "%.*s/%s", (int)(slash - cache.dir), cache.dir, name);
+}
+
+
+int cache_dirpath(char *buf, size_t len)
+{
+    return !cache_ready() || cache_snprintf(buf, len, "%s", cache.dir);
+}
+
+
+/** @brief Writes the path of the entry for @p word to @p path, and the name it
+ *      is indexed under to @p name
+ */
+static int cache_path(char *path, char name[KEY_NAMELEN], const char *word)
+{
+    key_name(word, name);
+    return cache_snprintf(path, PATHLEN, "%s/%s", cache.dir, name);
+}
+
+
+/** @brief Writes the path an entry for @p word had before entries were named
+ *      by hash. Words that could never have been stored that way are refused
+ */
+static int cache_legacy_path(char *path, const char *word)
+{
+    if (strchr(word, '/') || !strcmp(word, ".") || !strcmp(word, "..")
+     || strlen(word) + strlen(cache.dir) + 2 > PATHLEN) {
+        return 1;
+    }
+    return cache_snprintf(path, PATHLEN, "%s/%s", cache.dir, word);
+}
+
+
+/** @brief Checks whether the system tier has an entry named @p name */
+static bool cache_system_contains(const char *name)
+{
+    char path[PATHLEN];
+
+    return cache.sysdir[0]
+        && !cache_snprintf(path, sizeof path, "%s/%s", cache.sysdir, name)
+        && !access(path, F_OK);
+}
+
+
+const char *cache_system_holds(const char *word)
+{
+    char name[KEY_NAMELEN];
+
+    key_name(word, name);
+    return (cache_system_contains(name)) ? cache.sysdir : NULL;
+}
+
+
+/** @brief Checks whether the user's own cache holds @p word, under its hashed
+ *      name or its old one
+ */
+static bool cache_user_contains(const char *word)
+{
+    char path[PATHLEN], name[KEY_NAMELEN];
+
+    if (!cache_ready() || cache_path(path, name, word)) {
+        return false;
+    } else if (idx.loaded) {
+        return idx_find(name) || idx_find(word);
+    }
+    return !access(path, F_OK) || (!cache_legacy_path(path, word) && !access(path, F_OK));
+}
+
+
+bool cache_contains(const char *word)
+{
+    char name[KEY_NAMELEN];
+
+    key_name(word, name);
+    return core_contains(word) || freeze_contains(word)
+        || cache_user_contains(word) || cache_system_contains(name);
+}
+
+
+int cache_stat(const char *word, time_t *atime, time_t *fetched)
+{
+    char path[PATHLEN], name[KEY_NAMELEN];
+    struct stat sbuf;
+
+    if (!cache_ready() || cache_path(path, name, word) || stat(path, &sbuf)) {
+        return 1;
+    }
+    *atime = sbuf.st_atime;
+    *fetched = sbuf.st_mtime;
+    return 0;
+}
+
+
+static int cmptime(const void *a, const void *b)
+{
+    const time_t *x = a, *y = b;
+
+    return (*x > *y) - (*x < *y);
+}
+
+
+time_t cache_horizon(unsigned n)
+{
+    time_t *atimes, res = 0;
+    size_t i, k = 0, risk;
+
+    if (cache_index_load() || idx.count + n <= (size_t)cache_max()) {
+        return 0;
+    }
+    risk = idx.count + n - cache_max();
+    atimes = malloc(idx.count * sizeof *atimes);
+    if (!atimes) {
+        return 0;
+    }
+    for (i = 0; i < idx.cap; i++) {
+        if (idx.tab[i].name && idx.tab[i].name != idx_tomb) {
+            atimes[k++] = idx.tab[i].atime;
+        }
+    }
+    qsort(atimes, k, sizeof *atimes, cmptime);
+    if (k) {
+        res = atimes[((risk < k) ? risk : k) - 1];
+    }
+    free(atimes);
+    return res;
+}
+
+
+/** Updates the last-accessed time of the file open on @p fd to right now */
+static int cache_touch(int fd, const char *name)
 {
     struct timespec ts[2];
     struct stat sbuf;
-    int fd, res = 1;
+    int res = 1;
 
-    fd = fileno(fp);
     if (fd != -1) {
         res = fstat(fd, &sbuf)
            || clock_gettime(CLOCK_REALTIME, &ts[0]);
@@ -116,6 +467,9 @@ static int cache_touch(FILE *fp)
             ts[1] = sbuf.st_mtim;
             res = futimens(fd, ts);
         }
+        if (!res && idx.loaded) {
+            idx_put(name, ts[0].tv_sec, sbuf.st_size);
+        }
         if (res) {
             dict_perror("Cannot update cache time");
         }
@@ -127,9 +481,13 @@ static int cache_touch(FILE *fp)
 
 
 /** Opens the file at @p path and reads as much of its data as possible into
- *  @p buf
+ *  @p buf. Its access time is updated, and its index entry @p name with it,
+ *  unless @p name is NULL
  */
-static int cache_open_read(char *buf, size_t *len, const char *path)
+static int cache_open_read(char       *buf,
+                           size_t     *len,
+                           const char *path,
+                           const char *name)
 {
     int res = 0;
     FILE *fp;
@@ -141,8 +499,8 @@ static int cache_open_read(char *buf, size_t *len, const char *path)
             dict_perror("Cannot read cache");
             *len = 0;
             res = 1;
-        } else {
-            cache_touch(fp);
+        } else if (name) {
+            cache_touch(fileno(fp), name);
         }
         fclose(fp);
     } else {
@@ -156,28 +514,379 @@ static int cache_open_read(char *buf, size_t *len, const char *path)
 }
 
 
-int cache_lookup(const char *word, char *buf, size_t *len)
+/** @brief Checks that the entry read into @p buf holds @p word, as another word
+ *      could share its hash, then moves the reply to the start of @p buf
+ *  @returns Nonzero if the entry is for some other word
+ */
+static int cache_strip_header(const char *word, char *buf, size_t *len)
+{
+    const size_t hlen = sizeof CACHE_HEADER - 1, wlen = strlen(word);
+    const char *body;
+
+    if (*len < hlen + wlen + 2 || memcmp(buf, CACHE_HEADER, hlen)
+     || memcmp(buf + hlen, word, wlen) || buf[hlen + wlen] != '\n') {
+        return 1;
+    }
+    /* Skip the rest of the header, up to the blank line */
+    for (body = buf + hlen + wlen; body + 1 < buf + *len; body++) {
+        if (body[0] == '\n' && body[1] == '\n') {
+            break;
+        }
+    }
+    if (body + 1 >= buf + *len) {
+        return 1;
+    }
+    body += 2;
+    *len -= body - buf;
+    memmove(buf, body, *len);
+    return 0;
+}
+
+
+int cache_entry_parse(const char *name, char *buf, size_t *len, char word[KEY_MAXLEN])
+{
+    const size_t hlen = sizeof CACHE_HEADER - 1;
+    char expect[KEY_NAMELEN];
+    const char *eol;
+
+    if (*len < hlen || memcmp(buf, CACHE_HEADER, hlen)) {
+        /* Named after the word itself by an older version, or not an entry */
+        return (strlen(name) == KEY_NAMELEN - 1
+             && strspn(name, "0123456789abcdef") == KEY_NAMELEN - 1)
+            || key_canon(name, word);
+    }
+    eol = memchr(buf + hlen, '\n', *len - hlen);
+    if (!eol || eol - buf - hlen >= KEY_MAXLEN) {
+        return 1;
+    }
+    memcpy(word, buf + hlen, eol - buf - hlen);
+    word[eol - buf - hlen] = '\0';
+    key_name(word, expect);
+    return strcmp(expect, name) || cache_strip_header(word, buf, len);
+}
+
+
+/** @brief Reads an entry left by a version that named files after the raw
+ *      word, and moves it to its hashed name
+ */
+static int cache_lookup_legacy(const char *word, char *buf, size_t *len)
+{
+    struct cache_ent *ent;
+    char path[PATHLEN], *reply;
+    int res;
+
+    if ((idx.loaded && !idx_find(word)) || cache_legacy_path(path, word)) {
+        *len = 0;
+        return 0;
+    }
+    res = cache_open_read(buf, len, path, word);
+    if (res || !*len) {
+        return res;
+    }
+    reply = strndup(buf, *len);
+    if (reply && !cache_write(word, reply, NULL)) {
+        remove(path);
+        if (idx.loaded && (ent = idx_find(word))) {
+            idx_del(ent);
+        }
+    }
+    free(reply);
+    return 0;
+}
+
+
+/** @brief Reads the entry for @p word from the read-only system tier,
+ *      promoting it to the user tier if so configured
+ */
+static int cache_lookup_system(const char *word, char *buf, size_t *len)
+{
+    char path[PATHLEN], name[KEY_NAMELEN], *reply;
+    struct stat sbuf;
+    int res;
+
+    key_name(word, name);
+    if (!cache.sysdir[0]) {
+        *len = 0;
+        return 0;
+    } else if (cache_snprintf(path, sizeof path, "%s/%s", cache.sysdir, name)) {
+        return 1;
+    }
+    /* Never touched; the access times there are not ours to update */
+    res = cache_open_read(buf, len, path, NULL);
+    if (res || !*len) {
+        return res;
+    } else if (cache_strip_header(word, buf, len)) {
+        *len = 0;
+        return 0;
+    }
+    TRACE(DISK_HIT, word, *len, 2);
+    if (cache.promote && cache_ready() && !stat(path, &sbuf)) {
+        reply = strndup(buf, *len);
+        if (reply) {
+            cache_merge(word, reply, sbuf.st_mtime);
+        }
+        free(reply);
+    }
+    return 0;
+}
+
+
+/** @brief Searches the tiers after the user's hashed entries: entries under
+ *      their legacy names, then the system tier
+ */
+static int cache_lookup_older(const char *word, char *buf, size_t *len)
+{
+    size_t cap = *len;
+    int res;
+
+    res = cache_lookup_legacy(word, buf, len);
+    if (res || *len) {
+        TRACE(DISK_HIT, word, *len, 1);
+        return res;
+    }
+    *len = cap;
+    return cache_lookup_system(word, buf, len);
+}
+
+
+/** @brief Searches each tier on disk in turn */
+static int cache_lookup_disk(const char *word, char *buf, size_t *len)
+{
+    char path[PATHLEN], name[KEY_NAMELEN];
+    size_t cap = *len;
+    int res = 0;
+
+    if (!cache_ready()) {
+        return cache_lookup_system(word, buf, len);
+    }
+    if (cache_path(path, name, word)) {
+        return 1;
+    }
+    if (idx.loaded && !idx_find(name)) {
+        *len = 0;
+    } else {
+        res = cache_open_read(buf, len, path, name);
+        if (!res && *len && cache_strip_header(word, buf, len)) {
+            *len = 0;   /* Hash collision; this is not our entry */
+        } else if (res || *len) {
+            TRACE(DISK_HIT, word, *len, 0);
+            return res;
+        }
+    }
+    *len = cap;
+    return cache_lookup_older(word, buf, len);
+}
+
+
+/** @brief Feeds a hit from disk to the faster tiers, or traces a miss */
+static void cache_lookup_done(const char *word, const char *buf, size_t len, int res)
+{
+    if (!res && len) {
+        hot_put(word, buf, len);
+        meta_hit(word);
+    } else if (!res) {
+        TRACE(DISK_MISS, word, 0, 0);
+    }
+}
+
+
+/** @brief Refreshes the access time of the user's entry for @p word, for a hit
+ *      in the hot cache, which never reads it
+ */
+static void cache_touch_word(const char *word)
+{
+    char path[PATHLEN], name[KEY_NAMELEN];
+    int fd;
+
+    if (!cache_ready() || cache_path(path, name, word)) {
+        return;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd != -1) {
+        cache_touch(fd, name);
+        close(fd);
+    }
+}
+
+
+/** @brief Looks @p word up in the hot cache, counting a hit as a read of its
+ *      entry on disk
+ *  @returns true on a hit
+ */
+static bool cache_lookup_hot(const char *word, char *buf, size_t *len)
+{
+    bool stale = false;
+
+    if (!hot_get(word, buf, len, &stale)) {
+        return false;
+    } else if (stale) {
+        cache_touch_word(word);
+    }
+    meta_hit(word);
+    return true;
+}
+
+
+int cache_lookup(const char *word, char *buf, size_t *len)
+{
+    int res;
+
+    if (core_get(word, buf, len) || freeze_get(word, buf, len) || cache_lookup_hot(word, buf, len)) {
+        return 0;
+    }
+    res = cache_lookup_disk(word, buf, len);
+    cache_lookup_done(word, buf, *len, res);
+    return res;
+}
+
+
+/** A probe of the user's hashed entries, read as part of a batch */
+struct cache_batch {
+    char   path[PATHLEN];
+    char   name[KEY_NAMELEN];
+    size_t probe;   /* Index of the probe it answers */
+};
+
+
+/** @brief Collects the read of @p rd for @p p, touching the entry if it holds
+ *      the word asked for
+ *  @returns Nonzero if it does
+ */
+static int cache_batch_hit(struct cache_probe *p, struct batch_read *rd, const char *name)
 {
-    char path[PATHLEN];
+    int hit = 0;
+
+    if (rd->len < 0 && rd->len != -ENOENT) {
+        errno = -rd->len;
+        dict_perror("Failed to read cache entry");
+        p->res = 1;
+    } else if (rd->len > 0) {
+        p->len = rd->len;
+        hit = !cache_strip_header(p->word, p->buf, &p->len);
+    }
+    if (hit) {
+        cache_touch(rd->fd, name);
+        TRACE(DISK_HIT, p->word, p->len, 0);
+    } else {
+        p->len = rd->cap;   /* Hash collision, or no entry */
+    }
+    if (rd->fd >= 0) {
+        close(rd->fd);
+    }
+    return hit;
+}
+
+
+int cache_lookup_batch(struct cache_probe *probe, size_t n)
+{
+    enum { PROBE_MISS, PROBE_HOT, PROBE_DISK } *state;  /* HOT: from memory */
+    struct cache_batch *cb;
+    struct batch_read *rd;
+    size_t i, j, nread = 0, cap;
     int res = 0;
 
-    if (!cache_ready()) {
-        return 0;
+    state = calloc(n + 1, sizeof *state);
+    cb = malloc((n + 1) * sizeof *cb);
+    rd = malloc((n + 1) * sizeof *rd);
+    if (!state || !cb || !rd) {
+        free(state);
+        free(cb);
+        free(rd);
+        for (i = 0; i < n; i++) {
+            probe[i].res = cache_lookup(probe[i].word, probe[i].buf, &probe[i].len);
+            res |= probe[i].res;
+        }
+        return res;
     }
-    if (cache_snprintf(path, sizeof path, "%s/%s", cache.dir, word)) {
-        return 1;
+    for (i = 0; i < n; i++) {
+        probe[i].res = 0;
+        cap = probe[i].len;
+        if (core_get(probe[i].word, probe[i].buf, &probe[i].len)
+         || freeze_get(probe[i].word, probe[i].buf, &probe[i].len)
+         || cache_lookup_hot(probe[i].word, probe[i].buf, &probe[i].len)) {
+            state[i] = PROBE_HOT;
+            continue;
+        }
+        probe[i].len = cap;
+        if (!cache_ready() || cache_path(cb[nread].path, cb[nread].name, probe[i].word)
+         || (idx.loaded && !idx_find(cb[nread].name))) {
+            continue;
+        }
+        cb[nread].probe = i;
+        rd[nread].path = cb[nread].path;
+        rd[nread].buf = probe[i].buf;
+        rd[nread].cap = cap;
+        nread++;
+    }
+    batch_read(rd, nread);
+    for (i = 0; i < nread; i++) {
+        j = cb[i].probe;
+        state[j] = cache_batch_hit(&probe[j], &rd[i], cb[i].name) ? PROBE_DISK : PROBE_MISS;
+    }
+    /* Whatever is not among the user's own entries is rarely anywhere else, so
+       those places are searched one word at a time */
+    for (i = 0; i < n; i++) {
+        if (state[i] == PROBE_MISS && !probe[i].res) {
+            probe[i].res = (cache_ready())
+                         ? cache_lookup_older(probe[i].word, probe[i].buf, &probe[i].len)
+                         : cache_lookup_system(probe[i].word, probe[i].buf, &probe[i].len);
+        } else if (state[i] == PROBE_MISS) {
+            probe[i].len = 0;
+        }
+        if (state[i] != PROBE_HOT) {
+            cache_lookup_done(probe[i].word, probe[i].buf, probe[i].len, probe[i].res);
+        }
+        res |= probe[i].res;
     }
-    res = cache_open_read(buf, len, path);
+    free(state);
+    free(cb);
+    free(rd);
     return res;
 }
 
 
+/** @brief Recovers the key hash of the entry named @p name. Entries written
+ *      before names were hashed are named after the word itself
+ */
+static uint64_t cache_name_hash(const char *name)
+{
+    if (strlen(name) == KEY_NAMELEN - 1 && strspn(name, "0123456789abcdef") == KEY_NAMELEN - 1) {
+        return strtoull(name, NULL, 16);
+    }
+    return key_hash(name);
+}
+
+
 static time_t mintime(time_t x, time_t y)
 {
     return (x < y) ? x : y;
 }
 
 
+/** @brief Reads the word the entry at @p path holds from its header
+ *  @returns Nonzero if the entry has no header, which is true of entries
+ *      written before the header existed
+ */
+static int cache_entry_word(const char *path, char word[KEY_MAXLEN])
+{
+    const size_t hlen = sizeof CACHE_HEADER - 1;
+    char line[KEY_MAXLEN + sizeof CACHE_HEADER];
+    int res = 1;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (fp) {
+        if (fgets(line, sizeof line, fp) && !strncmp(line, CACHE_HEADER, hlen)) {
+            line[strcspn(line, "\n")] = '\0';
+            strcpy(word, line + hlen);
+            res = 0;
+        }
+        fclose(fp);
+    }
+    return res;
+}
+
+
 /** @brief FTW callback that counts the number of cache files and saves the
  *      earliest timestamp for later eviction
  */
@@ -195,6 +904,21 @@ static int cache_ftw_count(const char        *path,
 }
 
 
+/** @brief Removes the entry at @p path, which is being evicted, from the hot
+ *      cache too. Entries are named by hash, so the word is read from its
+ *      header; an entry without one is named by its word
+ */
+static void cache_evict_hot(const char *path)
+{
+    char word[KEY_MAXLEN];
+
+    if (cache_entry_word(path, word)) {
+        snprintf(word, sizeof word, "%s", strrchr(path, '/') + 1);
+    }
+    hot_drop(word);
+}
+
+
 /** @brief FTW callback that removes the file with the previously written
  *      earliest timestamp
  */
@@ -204,6 +928,9 @@ static int cache_ftw_remove(const char        *path,
 {
     if (type == FTW_F) {
         if (sbuf->st_atime == cache.lru) {
+            TRACE(DISK_EVICT, strrchr(path, '/') + 1, sbuf->st_atime, 0);
+            meta_drop(cache_name_hash(strrchr(path, '/') + 1));
+            cache_evict_hot(path);
             remove(path);
             return 1;
         }
@@ -212,11 +939,46 @@ static int cache_ftw_remove(const char        *path,
 }
 
 
+/** @brief Removes the least recently accessed entry known to the index */
+static int cache_evict_indexed(void)
+{
+    struct cache_ent *lru = NULL, *ent;
+    char path[PATHLEN];
+    size_t i;
+
+    if (idx.count <= (size_t)cache_max()) {
+        return 0;
+    }
+    for (i = 0; i < idx.cap; i++) {
+        ent = &idx.tab[i];
+        if (ent->name && ent->name != idx_tomb) {
+            if (!lru || ent->atime < lru->atime) {
+                lru = ent;
+            }
+        }
+    }
+    if (cache_snprintf(path, sizeof path, "%s/%s", cache.dir, lru->name)) {
+        return 1;
+    }
+    TRACE(DISK_EVICT, lru->name, lru->atime, 0);
+    meta_drop(cache_name_hash(lru->name));
+    cache_evict_hot(path);
+    remove(path);
+    idx_del(lru);
+    return 0;
+}
+
+
 /** @brief Walks the cache directory and removes the earliest file, if and only
  *      if the cache is full
  */
 static int cache_evict(void)
 {
+    if (cache.hold) {
+        return 0;
+    } else if (idx.loaded) {
+        return cache_evict_indexed();
+    }
     cache.count = 0;
     cache.lru = LONG_MAX;
     ftw(cache.dir, cache_ftw_count, 1);
@@ -229,12 +991,51 @@ static int cache_evict(void)
 }
 
 
-/** @brief Writes the reply to the opened cache file @p fp */
-static int cache_flush(const char *reply, const char *path, FILE *fp)
+size_t cache_hold(bool hold)
+{
+    size_t evicted = 0;
+
+    cache.hold = hold;
+    if (hold || !cache_ready() || cache_index_load()) {
+        return 0;
+    }
+    while (idx.count > (size_t)cache_max() && !cache_evict_indexed()) {
+        evicted++;
+    }
+    return evicted;
+}
+
+
+/** @brief Computes the size of the entry cache_flush writes */
+static size_t cache_entry_size(const char                    *word,
+                               const char                    *reply,
+                               const struct cache_validators *val)
+{
+    size_t size = sizeof CACHE_HEADER + strlen(word) + 1 + strlen(reply);
+
+    if (val && val->etag[0]) {
+        size += sizeof CACHE_ETAG + strlen(val->etag);
+    }
+    if (val && val->modified[0]) {
+        size += sizeof CACHE_MODIFIED + strlen(val->modified);
+    }
+    return size;
+}
+
+
+/** @brief Writes the header and reply to the opened cache file @p fp */
+static int cache_flush(const char                    *word,
+                       const char                    *reply,
+                       const struct cache_validators *val,
+                       const char                    *path,
+                       FILE                          *fp)
 {
     int res;
 
-    res = fputs(reply, fp) == EOF;
+    res = fprintf(fp, CACHE_HEADER "%s\n", word) < 0
+       || (val && val->etag[0] && fprintf(fp, CACHE_ETAG "%s\n", val->etag) < 0)
+       || (val && val->modified[0] && fprintf(fp, CACHE_MODIFIED "%s\n", val->modified) < 0)
+       || fputc('\n', fp) == EOF || fputs(reply, fp) == EOF;
     fclose(fp);
     if (res) {
         dict_perror("Failed to flush reply to disk");
@@ -246,22 +1047,33 @@ static int cache_flush(const char *reply, const char *path, FILE *fp)
 }
 
 
-int cache_write(const char *word, const char *reply)
+int cache_write(const char *word, const char *reply, const struct cache_validators *val)
 {
-    char path[PATHLEN];
+    char path[PATHLEN], name[KEY_NAMELEN];
+    struct cache_ent *ent;
     int res = 1;
     FILE *fp;
 
     if (!cache_ready()) {
         return 0;
     }
-    if (cache_snprintf(path, sizeof path, "%s/%s", cache.dir, word)) {
+    if (cache_path(path, name, word)) {
         return 1;
     }
     fp = fopen(path, "wb");
     if (fp) {
+        if (idx.loaded) {
+            idx_put(name, time(NULL), strlen(reply));
+        }
         cache_evict();
-        res = cache_flush(reply, path, fp);
+        res = cache_flush(word, reply, val, path, fp);
+        if (res && idx.loaded && (ent = idx_find(name))) {
+            idx_del(ent);
+        } else if (!res) {
+            TRACE(DISK_WRITE, word, strlen(reply), 0);
+            hot_put(word, reply, strlen(reply));
+            meta_put(word, time(NULL), time(NULL), cache_entry_size(word, reply, val));
+        }
     } else {
         dict_perror("Cannot open cache file for writing");
     }
@@ -269,11 +1081,209 @@ int cache_write(const char *word, const char *reply)
 }
 
 
-static struct {
+/** @brief Copies the value of the header line @p line to @p dst if it is
+ *      named @p field
+ */
+static void cache_header_field(const char *line, const char *field, char dst[CACHE_VALIDLEN])
+{
+    size_t len = strlen(field);
+
+    if (!strncmp(line, field, len) && strlen(line + len) < CACHE_VALIDLEN) {
+        strcpy(dst, line + len);
+    }
+}
+
+
+int cache_get_validators(const char *word, struct cache_validators *val)
+{
+    const size_t hlen = sizeof CACHE_HEADER - 1;
+    char path[PATHLEN], name[KEY_NAMELEN];
+    char line[KEY_MAXLEN + sizeof CACHE_MODIFIED + CACHE_VALIDLEN];
+    int res = 1;
     FILE *fp;
 
+    memset(val, 0, sizeof *val);
+    if (!cache_ready() || cache_path(path, name, word) || !(fp = fopen(path, "rb"))) {
+        return 1;
+    }
+    if (fgets(line, sizeof line, fp) && !strncmp(line, CACHE_HEADER, hlen)) {
+        line[strcspn(line, "\n")] = '\0';
+        res = strcmp(line + hlen, word) != 0;
+    }
+    while (!res && fgets(line, sizeof line, fp) && line[0] != '\n') {
+        line[strcspn(line, "\n")] = '\0';
+        cache_header_field(line, CACHE_ETAG, val->etag);
+        cache_header_field(line, CACHE_MODIFIED, val->modified);
+    }
+    fclose(fp);
+    return res;
+}
+
+
+int cache_refresh(const char                    *word,
+                  const char                    *reply,
+                  const struct cache_validators *val)
+{
+    char path[PATHLEN], name[KEY_NAMELEN];
+    struct timespec ts[2];
+    struct stat sbuf;
+    size_t size;
+
+    if (!cache_ready() || cache_path(path, name, word) || stat(path, &sbuf)) {
+        return 1;
+    } else if (reply && cache_write(word, reply, val)) {
+        return 1;
+    }
+    ts[0] = sbuf.st_atim;
+    ts[1].tv_sec = 0;
+    ts[1].tv_nsec = UTIME_NOW;
+    if (utimensat(AT_FDCWD, path, ts, 0)) {
+        dict_perror("Cannot set cache entry time");
+        return 1;
+    }
+    if (reply && idx.loaded) {
+        idx_put(name, sbuf.st_atime, strlen(reply));
+    }
+    size = (reply) ? cache_entry_size(word, reply, val) : (size_t)sbuf.st_size;
+    meta_put(word, sbuf.st_atime, time(NULL), size);
+    return 0;
+}
+
+
+/** @brief Creates the cache directory and any of its parents that are missing */
+static int cache_mkdir(void)
+{
+    char path[PATHLEN];
+    char *slash;
+
+    strcpy(path, cache.dir);
+    for (slash = strchr(path + 1, '/'); ; slash = strchr(slash + 1, '/')) {
+        if (slash) {
+            *slash = '\0';
+        }
+        if (mkdir(path, 0755) && errno != EEXIST) {
+            dict_perror("Cannot create cache directory");
+            return 1;
+        }
+        if (!slash) {
+            return 0;
+        }
+        *slash = '/';
+    }
+}
+
+
+int cache_merge(const char *word, const char *reply, time_t fetched)
+{
+    char path[PATHLEN], name[KEY_NAMELEN], held[KEY_MAXLEN];
+    struct timespec ts[2] = { { .tv_sec = fetched }, { .tv_sec = fetched } };
+    struct stat sbuf;
+
+    if (!cache_ready() || cache_mkdir() || cache_path(path, name, word)) {
+        return -1;
+    }
+    if (!stat(path, &sbuf) && sbuf.st_mtime >= fetched
+     && !cache_entry_word(path, held) && !strcmp(held, word)) {
+        return 1;
+    }
+    if (cache_write(word, reply, NULL)) {
+        return -1;
+    }
+    /* The fetch time travels with the entry, and it has not been read here */
+    if (utimensat(AT_FDCWD, path, ts, 0)) {
+        dict_perror("Cannot set cache entry time");
+        return 0;
+    } else if (idx.loaded) {
+        idx_put(name, fetched, strlen(reply));
+    }
+    meta_put(word, fetched, fetched, cache_entry_size(word, reply, NULL));
+    return 0;
+}
+
+
+/** State for cache_walk, which FTW callbacks cannot be passed */
+static struct {
+    cache_walk_fn *fn;
+    void          *ctx;
+    char          *buf;
+    size_t         cap;
+} walkctx = { 0 };
+
+
+/** @brief FTW callback that reads each entry and hands it to the walker */
+static int cache_ftw_walk(const char        *path,
+                          const struct stat *sbuf,
+                          int                type)
+{
+    const size_t hlen = sizeof CACHE_HEADER - 1;
+    char word[KEY_MAXLEN], base[PATHLEN], *buf, *eol;
+    size_t len = sbuf->st_size;
+    int res;
+
+    if (type != FTW_F) {
+        return 0;
+    }
+    if (len + 1 > walkctx.cap) {
+        buf = realloc(walkctx.buf, len + 1);
+        if (!buf) {
+            dict_perror("Cannot read cache");
+            return 1;
+        }
+        walkctx.buf = buf;
+        walkctx.cap = len + 1;
+    }
+    if (cache_open_read(walkctx.buf, &len, path, NULL) || !len) {
+        return 0;
+    }
+    eol = memchr(walkctx.buf, '\n', (len < KEY_MAXLEN + hlen) ? len : KEY_MAXLEN + hlen);
+    if (eol && !strncmp(walkctx.buf, CACHE_HEADER, hlen)) {
+        snprintf(word, sizeof word, "%.*s", (int)(eol - walkctx.buf - hlen), walkctx.buf + hlen);
+        if (cache_strip_header(word, walkctx.buf, &len)) {
+            return 0;
+        }
+    } else {
+        /* Named after the word itself */
+        cache_snprintf(base, sizeof base, "%s", path);
+        if (key_canon(basename(base), word)) {
+            return 0;
+        }
+    }
+    walkctx.buf[len] = '\0';
+    res = walkctx.fn(word, walkctx.buf, len, sbuf->st_mtime, walkctx.ctx);
+    return res;
+}
+
+
+int cache_walk(cache_walk_fn *fn, void *ctx)
+{
+    int res;
+
+    if (!cache_ready()) {
+        return 1;
+    }
+    walkctx.fn = fn;
+    walkctx.ctx = ctx;
+    res = ftw(cache.dir, cache_ftw_walk, 1);
+    if (res == -1 && errno == ENOENT) {
+        res = 0;    /* Nothing cached yet */
+    } else if (res == -1) {
+        dict_perror("Cannot walk cache directory");
+    }
+    free(walkctx.buf);
+    memset(&walkctx, 0, sizeof walkctx);
+    return res != 0;
+}
+
+
+static struct {
+    FILE       *fp;
+    const char *glob;   /* Only list words matching this, if set */
+    bool        quiet;  /* Only count the system tier, do not list it */
+    size_t      frozen; /* Words in the frozen image and not the user's cache */
+
     size_t   size;
     unsigned count;
+    unsigned shown;     /* Cells printed on the grid so far */
 } listctx = { 0 };
 
 
@@ -304,37 +1314,136 @@ static int cache_ellipsize(char *buf, size_t buflen, const char *name)
 }
 
 
-/** @brief FTW callback that computes directory size on disk and prints each
- *      filename
- */
-static int cache_ftw_list(const char        *path,
-                          const struct stat *sbuf,
-                          int                type)
+/** @brief Prints @p word as the next cell of the grid */
+static void cache_list_cell(const char *word)
 {
     const unsigned listlen = 80 / LISTLEN;
-    char buf[PATHLEN], name[LISTLEN + 1];
-
-    (void)sbuf;
+    char name[LISTLEN + 1];
 
     static_assert(LISTLEN >= 3);      /* Cannot accomodate unsafe ellipsizing */
     static_assert(80 % LISTLEN == 0); /* Word length not divisible by 80 */
 
+    if (listctx.shown && !(listctx.shown % listlen)) {
+        fputc('\n', listctx.fp);
+    }
+    cache_ellipsize(name, sizeof name, word);
+    fputs(name, listctx.fp);
+    listctx.shown++;
+}
+
+
+/** @brief FTW callback that computes the size on disk of the system tier and
+ *      prints each of its words, save those the user's own cache also holds,
+ *      which were listed with it
+ */
+static int cache_ftw_list(const char        *path,
+                          const struct stat *sbuf,
+                          int                type)
+{
+    char buf[PATHLEN], word[KEY_MAXLEN];
+
     if (cache_snprintf(buf, sizeof buf, "%s", path)) {
         return 1;
     }
     if (type == FTW_F) {
-        if (listctx.count && !(listctx.count % listlen)) {
-            fputc('\n', listctx.fp);
+        if (cache_entry_word(path, word)) {
+            strcpy(word, basename(buf));    /* Named after the word itself */
         }
-        cache_ellipsize(name, sizeof name, basename(buf));
-        fputs(name, listctx.fp);
         listctx.size += sbuf->st_size;
+        if (cache_user_contains(word)) {
+            return 0;
+        }
         listctx.count++;
+        if (!listctx.quiet && (!listctx.glob || !fnmatch(listctx.glob, word, 0))) {
+            cache_list_cell(word);
+        }
+    }
+    return 0;
+}
+
+
+/** @brief Lists @p word from the frozen image, if it matches and the user's
+ *      own cache, which was listed already, does not also hold it
+ */
+static void cache_list_frozen(const char *word, void *ctx)
+{
+    (void)ctx;
+    if ((!listctx.glob || !fnmatch(listctx.glob, word, 0)) && !cache_user_contains(word)) {
+        cache_list_cell(word);
+    }
+}
+
+
+/** @brief Counts @p word of the user's cache if the frozen image also holds it */
+static void cache_list_shadowed(const char *word, void *ctx)
+{
+    if (freeze_contains(word)) {
+        ++*(size_t *)ctx;
+    }
+}
+
+
+/** @brief Lists the words in the frozen image, searching only those that
+ *      begin with whatever of the glob is not a pattern
+ *  @returns The path of the image, or NULL if there is none
+ */
+static const char *cache_list_image(void)
+{
+    const char *glob = (listctx.glob) ? listctx.glob : "", *path;
+    char prefix[KEY_MAXLEN];
+    size_t both = 0;
+
+    path = freeze_path(&listctx.frozen);
+    /* Only the words not also in the user's cache, which were counted there.
+       That cache is the smaller, so its words are looked up in the image */
+    if (path && !cache_words(cache_list_shadowed, &both) && both <= listctx.frozen) {
+        listctx.frozen -= both;
+    }
+    if (path && !listctx.quiet) {
+        snprintf(prefix, sizeof prefix, "%.*s", (int)strcspn(glob, "*?[\\"), glob);
+        freeze_prefix(prefix, cache_list_frozen, NULL);
+    }
+    return path;
+}
+
+
+/** @brief FTW callback that adds each entry of the user's cache to the index */
+static int cache_ftw_meta(const char        *path,
+                          const struct stat *sbuf,
+                          int                type)
+{
+    char buf[PATHLEN], word[KEY_MAXLEN];
+
+    if (type == FTW_F && !cache_snprintf(buf, sizeof buf, "%s", path)) {
+        if (cache_entry_word(path, word)) {
+            strcpy(word, basename(buf));
+        }
+        meta_add(word, sbuf->st_atime, sbuf->st_mtime, sbuf->st_size);
     }
     return 0;
 }
 
 
+static void cache_meta_fill(void)
+{
+    ftw(cache.dir, cache_ftw_meta, 1);
+}
+
+
+int cache_words(meta_each_fn *fn, void *ctx)
+{
+    return meta_each(cache_meta_fill, fn, ctx);
+}
+
+
+long cache_query(const struct meta_query *q, struct meta_rec **rows)
+{
+    size_t total, bytes;
+
+    return meta_query(q, cache_meta_fill, rows, &total, &bytes);
+}
+
+
 /** @brief Formats bytes in engineering notation */
 static void format_bytes(size_t *bytes, const char **prefix)
 {
@@ -352,34 +1461,111 @@ static void format_bytes(size_t *bytes, const char **prefix)
 }
 
 
-void cache_list(FILE *fp)
+/** @brief Prints @p rec on a line of its own, followed by the value it was
+ *      sorted by
+ */
+static void cache_list_row(const struct meta_rec *rec, enum meta_sort sort)
 {
+    char value[32];
     const char *si;
+    size_t size;
+    time_t when;
+
+    switch (sort) {
+    case META_SORT_ACCESS:
+    case META_SORT_FETCHED:
+        when = (sort == META_SORT_ACCESS) ? rec->atime : rec->fetched;
+        strftime(value, sizeof value, "%Y-%m-%d %H:%M", localtime(&when));
+        break;
+    case META_SORT_SIZE:
+        size = rec->size;
+        format_bytes(&size, &si);
+        snprintf(value, sizeof value, "%zu %sB", size, si);
+        break;
+    default:
+        snprintf(value, sizeof value, "%u", (unsigned)rec->hits);
+        break;
+    }
+    fprintf(listctx.fp, " %-*s %s\n", (int)(2 * LISTLEN - 2), rec->word, value);
+}
+
+
+void cache_list(FILE *fp, const struct meta_query *q)
+{
+    struct meta_rec *rows;
+    const char *si, *image;
+    size_t total, bytes;
+    long n, i;
 
     if (!cache_ready()) {
         dict_logs(DICT_ERROR, "Cannot list cache dir: Not initialized");
         return;
     }
-    /* fputs("The disk cache contains definitions for the following words:", fp); */
+    n = meta_query(q, cache_meta_fill, &rows, &total, &bytes);
+    if (n < 0) {
+        dict_logs(DICT_ERROR, "Cannot read the cache index");
+        return;
+    }
     listctx.fp = fp;
-    ftw(cache.dir, cache_ftw_list, 1);
+    listctx.glob = q->glob;
+    for (i = 0; i < n; i++) {
+        if (q->sort == META_SORT_NAME) {
+            cache_list_cell(rows[i].word);
+        } else {
+            cache_list_row(&rows[i], q->sort);
+        }
+    }
+    free(rows);
+    /* Neither the system tier nor the image has an index, so they are listed
+       after, and only in full */
+    listctx.quiet = q->sort != META_SORT_NAME || q->offset || q->limit;
+    if (cache.sysdir[0]) {
+        ftw(cache.sysdir, cache_ftw_list, 1);
+    }
+    image = cache_list_image();
+    listctx.size += bytes;
     format_bytes(&listctx.size, &si);
-    fprintf(fp, "\n\nThe cache contains %u words, and is using %zu %sB of disk space. Use -f, --force\nto refresh a cached entry.\n", listctx.count, listctx.size, si);
+    fputs((q->sort == META_SORT_NAME) ? "\n\n" : "\n", fp);
+    fprintf(fp, "The cache contains %zu words, and is using %zu %sB of disk space. Use -f, --force\nto refresh a cached entry.\n",
+            total + listctx.count + listctx.frozen, listctx.size, si);
+    if (listctx.count) {
+        fprintf(fp, "Your cache holds %zu of them, and the read-only system cache at %s holds %u more.\n",
+                total, cache.sysdir, listctx.count);
+    }
+    if (image) {
+        fprintf(fp, "The frozen image at %s holds %zu more, and is consulted first.\n",
+                image, listctx.frozen);
+    }
     memset(&listctx, 0, sizeof listctx);
 }
 
 
 int cache_remove(const char *word)
 {
-    char path[PATHLEN];
+    char path[PATHLEN], name[KEY_NAMELEN], held[KEY_MAXLEN];
+    struct cache_ent *ent;
+    bool legacy = false;
 
     if (!cache_ready()) {
         dict_logf(DICT_ERROR, "Cannot delete %s: Cache was not initialized", word);
         return -1;
     }
-    if (cache_snprintf(path, sizeof path, "%s/%s", cache.dir, word)) {
+    TRACE(DISK_REMOVE, word, 0, 0);
+    hot_drop(word);
+    meta_drop(key_hash(word));
+    if (cache_path(path, name, word)) {
         return -1;
     }
+    if (cache_entry_word(path, held) || strcmp(held, word)) {
+        /* Not ours, so it can only be under its old name, if anywhere */
+        if (cache_legacy_path(path, word)) {
+            return 1;
+        }
+        legacy = true;
+    }
+    if (idx.loaded && (ent = idx_find((legacy) ? word : name))) {
+        idx_del(ent);
+    }
     errno = 0;
     if (remove(path) && errno != ENOENT) {
         dict_perror("Failed to delete cache entry");
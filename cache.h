@@ -3,7 +3,25 @@
 #ifndef DICT_CACHE_H
 #define DICT_CACHE_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "key.h"
+#include "meta.h"
+
+/** The longest validator kept, including the nul term. Longer ones are dropped */
+#define CACHE_VALIDLEN 128
+
+
+/** What the server said identifies a reply, so that it can later be asked
+ *  whether the reply has changed. Each is empty if the server did not say
+ */
+struct cache_validators {
+    char etag[CACHE_VALIDLEN];
+    char modified[CACHE_VALIDLEN];  /* Last-Modified, verbatim */
+};
 
 
 /** @brief Initializes any resources required by the caching system
@@ -12,10 +30,85 @@
 int cache_init(void);
 
 
+/** @brief Reads the cache directory into memory once, so that successive
+ *      lookups, writes and evictions do not need to walk it again. This is
+ *      only worthwhile for processes that perform more than one query
+ *  @returns Nonzero on error. The cache remains usable without the index
+ */
+int cache_index_load(void);
+
+
+/** @brief Retrieves the most entries the user's cache holds before the least
+ *      recently read are evicted. This is CACHE_MAX, unless DICT_CACHE_MAX
+ *      says otherwise
+ */
+int cache_max(void);
+
+
+/** @brief Writes the path of the auxiliary state file @p name to @p buf.
+ *      These live beside the cache directory, not inside it, so that they are
+ *      never mistaken for entries
+ *  @returns Nonzero on error or truncation
+ */
+int cache_auxpath(char *buf, size_t len, const char *name);
+
+
+/** @brief Writes the path of the directory holding the user's cache to @p buf
+ *  @returns Nonzero on error or truncation, or if there is no cache
+ */
+int cache_dirpath(char *buf, size_t len);
+
+
+/** @brief Checks that the entry file @p name, whose @p len bytes were read into
+ *      @p buf, is an entry, named as the word in its header says it should be,
+ *      then strips the header. Files without a header are taken for entries
+ *      named after their word by older versions
+ *  @param[out] word
+ *      The key the entry holds
+ *  @returns Nonzero if @p buf is not an entry, or is misnamed
+ */
+int cache_entry_parse(const char *name, char *buf, size_t *len, char word[KEY_MAXLEN]);
+
+
+/** @brief Checks whether @p word has an entry in either tier, without reading
+ *      it or updating its access time. This is cheap once cache_index_load has
+ *      been called
+ */
+bool cache_contains(const char *word);
+
+
+/** @brief Checks whether the read-only system tier has an entry for @p word,
+ *      which nothing dict does can remove
+ *  @returns The directory of the system tier if so, else NULL
+ */
+const char *cache_system_holds(const char *word);
+
+
+/** @brief Retrieves when the entry for @p word in the user's cache was last
+ *      read and when it was fetched, without updating either
+ *  @returns Nonzero if there is no such entry
+ */
+int cache_stat(const char *word, time_t *atime, time_t *fetched);
+
+
+/** @brief Finds which entries the next @p n writes to the cache would evict.
+ *      This loads the index if it has not been loaded already
+ *  @returns The access time at or before which an entry is among them, or zero
+ *      if the cache has room for @p n more entries
+ */
+time_t cache_horizon(unsigned n);
+
+
 /** @brief Searches the word cache for @p word. If found writes the cached reply
- *      to @p buf
+ *      to @p buf. Entries stored under the raw word by older versions are found
+ *      too, and renamed as they are. The user's cache is searched first, then
+ *      the read-only system cache, whose hits are copied into the user's cache
+ *      if DICT_CACHE_PROMOTE is set. If the shared hot cache is enabled, it is
+ *      consulted before any of them, and filled from them. A frozen image, if
+ *      there is one, is consulted before everything else but the vocabulary
+ *      compiled into dict-core
  *  @param word
- *      Word the search for
+ *      Canonical key of the word to search for, from key_canon
  *  @param[out] buf
  *      Buffer to write the reply to, if it exists
  *  @param[in,out] len
@@ -30,22 +123,116 @@ int cache_init(void);
 int cache_lookup(const char *word, char *buf, size_t *len);
 
 
-/** @brief Writes @p word and its associated @p reply to the cache
+/** One lookup in a batch passed to cache_lookup_batch */
+struct cache_probe {
+    const char *word;   /* Canonical key, from key_canon */
+    char       *buf;    /* Where the reply is written */
+    size_t      len;    /* The size of buf, then the length of the reply, or
+                           zero if the word was not found */
+    int         res;    /* Nonzero on error */
+};
+
+
+/** @brief Looks up every word in @p probe as cache_lookup would, but reads the
+ *      user's entries for all of them at once, so that a batch of lookups
+ *      waits on storage about once instead of once per word
+ *  @returns Nonzero if any lookup failed
+ */
+int cache_lookup_batch(struct cache_probe *probe, size_t n);
+
+
+/** @brief Writes @p word and its associated @p reply to the cache. The entry is
+ *      named after the hash of @p word, which is kept in a header inside it
  *  @param word
- *      Word
+ *      Canonical key of the word, from key_canon
  *  @param reply
  *      Verbatim reply from dictionaryapi.dev
+ *  @param val
+ *      The validators the reply came with, kept in the header, or NULL
  *  @returns Nonzero on error. This function does not report which entry was
  *      evicted, if any
  */
-int cache_write(const char *word, const char *reply);
+int cache_write(const char *word, const char *reply, const struct cache_validators *val);
+
+
+/** @brief Suspends eviction while @p hold is set, so that a batch of writes
+ *      larger than the cache cannot evict its own entries as it goes.
+ *      Releasing it evicts the least recently read entries, once, until the
+ *      cache fits again
+ *  @returns The number of entries evicted on release
+ */
+size_t cache_hold(bool hold);
+
+
+/** @brief Reads the validators stored with the entry for @p word in the user's
+ *      cache. Entries written before validators were kept have none
+ *  @returns Nonzero if there is no such entry
+ */
+int cache_get_validators(const char *word, struct cache_validators *val);
+
+
+/** @brief Records that the entry for @p word was just confirmed with the server,
+ *      replacing its reply with @p reply and its validators with @p val if
+ *      the reply changed. Its fetch time becomes now, but this does not count
+ *      as reading it, so its place in the eviction order is kept
+ *  @param reply
+ *      The new reply, or NULL if the server said it is unchanged
+ *  @returns Nonzero on error, or if there is no such entry
+ */
+int cache_refresh(const char                    *word,
+                  const char                    *reply,
+                  const struct cache_validators *val);
+
+
+/** @brief Stores @p reply for @p word as fetched at time @p fetched, unless
+ *      the local entry was fetched at the same time or later. The cache
+ *      directory is created if need be
+ *  @returns Negative on error, zero if the entry was stored, and positive if
+ *      the local entry was kept
+ */
+int cache_merge(const char *word, const char *reply, time_t fetched);
+
+
+/** @brief Callback for cache_walk. @p reply is nul-terminated
+ *  @returns Nonzero to stop the walk
+ */
+typedef int cache_walk_fn(const char *word,
+                          const char *reply,
+                          size_t      len,
+                          time_t      fetched,
+                          void       *ctx);
+
+
+/** @brief Reads every entry in the cache and passes it to @p fn, without
+ *      updating access times
+ *  @returns Nonzero on error, or if @p fn stopped the walk
+ */
+int cache_walk(cache_walk_fn *fn, void *ctx);
+
+
+/** @brief Passes every word in the user's cache to @p fn, from its index,
+ *      which is built on first use
+ *  @returns Nonzero on error
+ */
+int cache_words(meta_each_fn *fn, void *ctx);
+
+
+/** @brief Selects rows from the index of the user's cache, which is built on
+ *      first use, as meta_query does
+ *  @returns The number of rows, which the caller must free, or -1 on error
+ */
+long cache_query(const struct meta_query *q, struct meta_rec **rows);
 
 
-/** @brief Walks the cache directory and lists each word inside in order
+/** @brief Lists the words in the cache as @p q selects them, from the index
+ *      of the user's cache, which is built on first use. Sorted by name they
+ *      are laid out in a grid; sorted by anything else, one per line with the
+ *      value sorted by. The read-only system cache follows the full listing by
+ *      name
  *  @param fp
  *      FILE * to output to
  */
-void cache_list(FILE *fp);
+void cache_list(FILE *fp, const struct meta_query *q);
 
 
 /** @brief Removes @p word from the cache, if it exists
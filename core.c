@@ -0,0 +1,65 @@
+#include <string.h>
+
+#include "core.h"
+#include "key.h"
+#include "trace.h"
+
+
+#ifdef DICT_CORE
+
+/** @brief Probes the table for @p word
+ *  @returns Its entry, or NULL if it is not in the vocabulary
+ */
+static const struct core_entry *core_find(const char *word)
+{
+    const struct core_entry *ent;
+    uint64_t hash = key_hash(word);
+    uint32_t i;
+
+    for (i = hash & core_mask; core_table[i]; i = (i + 1) & core_mask) {
+        ent = &core_entries[core_table[i] - 1];
+        if (ent->hash == hash && !strcmp(ent->word, word)) {
+            return ent;
+        }
+    }
+    return NULL;
+}
+
+
+bool core_get(const char *word, char *buf, size_t *len)
+{
+    const struct core_entry *ent = core_find(word);
+
+    if (!ent || ent->len > *len) {
+        return false;
+    }
+    memcpy(buf, ent->reply, ent->len);
+    *len = ent->len;
+    TRACE(CORE_HIT, word, *len, 0);
+    return true;
+}
+
+
+bool core_contains(const char *word)
+{
+    return core_find(word) != NULL;
+}
+
+#else
+
+bool core_get(const char *word, char *buf, size_t *len)
+{
+    (void)word;
+    (void)buf;
+    (void)len;
+    return false;
+}
+
+
+bool core_contains(const char *word)
+{
+    (void)word;
+    return false;
+}
+
+#endif /* DICT_CORE */
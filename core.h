@@ -0,0 +1,51 @@
+#pragma once
+
+#ifndef DICT_CORE_H
+#define DICT_CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** One entry of the core vocabulary. Builds with -DDICT_CORE (make dict-core)
+ *  link coredata.c, which gencore generates, holding these and a hash table
+ *  over them
+ */
+struct core_entry {
+    uint64_t    hash;   /* key_hash of the word */
+    const char *word;   /* Canonical key */
+    const char *reply;
+    uint32_t    len;
+};
+
+
+extern const struct core_entry core_entries[];
+
+/** Open addressing over core_entries by hash, probed linearly. Each slot holds
+ *  an index into core_entries plus one, or zero if it is empty
+ */
+extern const uint32_t core_table[];
+
+/** The number of slots in core_table, less one. It is a power of two */
+extern const uint32_t core_mask;
+
+
+/** @brief Looks @p word up in the vocabulary compiled into the binary, with no
+ *      file I/O at all. Builds without -DDICT_CORE have none, and always miss
+ *  @param[out] buf
+ *      Buffer to copy the reply to
+ *  @param[in,out] len
+ *      On input, the size of @p buf. On output, the length of the reply
+ *  @returns true on a hit
+ */
+bool core_get(const char *word, char *buf, size_t *len);
+
+
+/** @brief Checks whether the vocabulary compiled into the binary holds @p word,
+ *      without copying it
+ */
+bool core_contains(const char *word);
+
+
+#endif /* DICT_CORE_H */
@@ -0,0 +1,63 @@
+#define CURLFN_NOMACROS
+#include "curlfn.h"
+#include "log.h"
+
+#ifndef DICT_CURL_EAGER
+#   include <dlfcn.h>
+#endif
+
+/** Sonames to try, most specific first */
+#define CURLFN_SONAMES { "libcurl.so.4", "libcurl-gnutls.so.4", "libcurl.so" }
+
+
+#ifdef DICT_CURL_EAGER
+
+/* Linked the ordinary way, for comparison */
+struct curlfn curlfn = {
+#define CURLFN_INIT(fn) fn,
+    CURLFN_FUNCS(CURLFN_INIT)
+#undef CURLFN_INIT
+};
+
+
+int curlfn_load(void)
+{
+    return 0;
+}
+
+#else
+
+struct curlfn curlfn = { 0 };
+
+
+int curlfn_load(void)
+{
+    static const char *sonames[] = CURLFN_SONAMES;
+    const unsigned N = sizeof sonames / sizeof *sonames;
+    static void *lib = NULL;
+    unsigned i;
+
+    if (lib) {
+        return 0;
+    }
+    for (i = 0; !lib && i < N; i++) {
+        lib = dlopen(sonames[i], RTLD_NOW | RTLD_LOCAL);
+    }
+    if (!lib) {
+        dict_logf(DICT_ERROR, "Cannot load libcurl: %s", dlerror());
+        return 1;
+    }
+#define CURLFN_SYM(fn)                                              \
+    curlfn.fn = (__typeof__(fn) *)dlsym(lib, #fn);                  \
+    if (!curlfn.fn) {                                               \
+        dict_logs(DICT_ERROR, "libcurl is too old: missing " #fn);  \
+        dlclose(lib);                                               \
+        lib = NULL;                                                 \
+        return 1;                                                   \
+    }
+    CURLFN_FUNCS(CURLFN_SYM)
+#undef CURLFN_SYM
+    return 0;
+}
+
+#endif /* DICT_CURL_EAGER */
@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef DICT_CURLFN_H
+#define DICT_CURLFN_H
+
+/* The type-checking wrappers are macros, which would get in the way of ours */
+#define CURL_DISABLE_TYPECHECK
+#include <curl/curl.h>
+
+
+/** Every libcurl function dict uses. libcurl is loaded on demand, so these are
+ *  called through pointers that curlfn_load fills in
+ */
+#define CURLFN_FUNCS(X)         \
+    X(curl_easy_cleanup)        \
+    X(curl_easy_getinfo)        \
+    X(curl_easy_init)           \
+    X(curl_easy_setopt)         \
+    X(curl_easy_strerror)       \
+    X(curl_free)                \
+    X(curl_multi_add_handle)    \
+    X(curl_multi_cleanup)       \
+    X(curl_multi_info_read)     \
+    X(curl_multi_init)          \
+    X(curl_multi_perform)       \
+    X(curl_multi_poll)          \
+    X(curl_multi_remove_handle) \
+    X(curl_multi_setopt)        \
+    X(curl_slist_append)        \
+    X(curl_slist_free_all)      \
+    X(curl_url)                 \
+    X(curl_url_cleanup)         \
+    X(curl_url_get)             \
+    X(curl_url_set)
+
+
+struct curlfn {
+#define CURLFN_MEMBER(fn) __typeof__(fn) *fn;
+    CURLFN_FUNCS(CURLFN_MEMBER)
+#undef CURLFN_MEMBER
+};
+
+extern struct curlfn curlfn;
+
+
+/** @brief Loads libcurl, if it has not been already. Call this before anything
+ *      else touches curl; until then, the process has not paid for linking it
+ *      or its TLS stack
+ *  @returns Nonzero if libcurl is unavailable
+ */
+int curlfn_load(void);
+
+
+#ifndef CURLFN_NOMACROS
+/* curl.h passes these three through macros of its own */
+#   undef curl_easy_getinfo
+#   undef curl_easy_setopt
+#   undef curl_multi_setopt
+#   define curl_easy_cleanup        (curlfn.curl_easy_cleanup)
+#   define curl_easy_getinfo        (curlfn.curl_easy_getinfo)
+#   define curl_easy_init           (curlfn.curl_easy_init)
+#   define curl_easy_setopt         (curlfn.curl_easy_setopt)
+#   define curl_easy_strerror       (curlfn.curl_easy_strerror)
+#   define curl_free                (curlfn.curl_free)
+#   define curl_multi_add_handle    (curlfn.curl_multi_add_handle)
+#   define curl_multi_cleanup       (curlfn.curl_multi_cleanup)
+#   define curl_multi_info_read     (curlfn.curl_multi_info_read)
+#   define curl_multi_init          (curlfn.curl_multi_init)
+#   define curl_multi_perform       (curlfn.curl_multi_perform)
+#   define curl_multi_poll          (curlfn.curl_multi_poll)
+#   define curl_multi_remove_handle (curlfn.curl_multi_remove_handle)
+#   define curl_multi_setopt        (curlfn.curl_multi_setopt)
+#   define curl_slist_append        (curlfn.curl_slist_append)
+#   define curl_slist_free_all      (curlfn.curl_slist_free_all)
+#   define curl_url                 (curlfn.curl_url)
+#   define curl_url_cleanup         (curlfn.curl_url_cleanup)
+#   define curl_url_get             (curlfn.curl_url_get)
+#   define curl_url_set             (curlfn.curl_url_set)
+#endif
+
+
+#endif /* DICT_CURLFN_H */
@@ -1,76 +1,291 @@
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <curl/curl.h>
+
+#include <json-c/json.h>
 
 #include "opt.h"
+#include "account.h"
+#include "audio.h"
+#include "hedge.h"
+#include "rate.h"
 #include "json.h"
 #include "cache.h"
+#include "core.h"
 #include "log.h"
+#include "lru.h"
+#include "history.h"
+#include "lemma.h"
+#include "key.h"
+#include "meta.h"
+#include "repl.h"
+#include "spell.h"
+#include "warm.h"
+#include "bundle.h"
+#include "freeze.h"
+#include "fsck.h"
+#include "trace.h"
+
 
+static char downloadbuf[65536];
 
-static size_t dict_write_cb(char *ptr, size_t size, size_t nmemb, void *usrdata)
+
+/** Replies read ahead for the words of a multi-word lookup. Each is used once,
+ *  by the first lookup of its word
+ */
+static struct {
+    struct cache_probe probe[OPT_MAXWORDS];
+    size_t             n;
+} batch = { 0 };
+
+
+/** @brief Parses and prints the reply between @p begin and @p end, keeping the
+ *      parsed tree in the LRU if it held a definition
+ *  @returns Nonzero if no definition is available
+ */
+static int dict_show(const char *word, const char *begin, const char *end)
 {
-    char **dptr = usrdata;
+    struct json_object *json;
+    enum account_phase prev;
+    int res;
+
+    prev = account_enter(ACCOUNT_PARSE);
+    json = dict_parse_JSON(begin, end);
+    audio_collect(json);
+    account_enter(ACCOUNT_RENDER);
+    res = dict_print_parsed(json);
+    account_enter(ACCOUNT_PARSE);
+    if (!res) {
+        lru_put(word, json);
+    }
+    json_object_put(json);
+    account_leave(prev);
+    return res;
+}
 
-    (void)size;
 
-    memcpy(*dptr, ptr, nmemb);
-    *dptr += nmemb;
-    return nmemb;
+/** @brief Takes the reply read ahead for @p word, if there is one
+ *  @returns Its probe, or NULL
+ */
+static struct cache_probe *dict_batch_take(const char *word)
+{
+    struct cache_probe *p;
+    size_t i;
+
+    for (i = 0; i < batch.n; i++) {
+        p = &batch.probe[i];
+        if (p->word && !strcmp(p->word, word)) {
+            p->word = NULL;
+            return p;
+        }
+    }
+    return NULL;
 }
 
 
-static char downloadbuf[65536];
+/** @brief Prints the entry for @p word from the LRU or the cache
+ *  @returns true if one was found
+ */
+static bool dict_show_cached(const char *word)
+{
+    size_t len = sizeof downloadbuf;
+    struct json_object *json;
+    struct cache_probe *ahead;
+    enum account_phase prev;
+    char *buf = downloadbuf;
+    int res;
+
+    json = lru_get(word);
+    if (json) {
+        audio_collect(json);
+        prev = account_enter(ACCOUNT_RENDER);
+        dict_print_parsed(json);
+        account_leave(prev);
+        return true;
+    }
+    prev = account_enter(ACCOUNT_CACHE);
+    if ((ahead = dict_batch_take(word))) {
+        buf = ahead->buf;
+        len = ahead->len;
+        res = ahead->res;
+    } else {
+        res = cache_lookup(word, downloadbuf, &len);
+    }
+    account_leave(prev);
+    if (res || !len) {
+        return false;
+    } else if (dict_show(word, buf, buf + len)) {
+        dict_logf(DICT_WARN, "The cached entry for %s is damaged; dict --fsck sets such entries aside", word);
+        return false;
+    }
+    return true;
+}
 
 
-static int dict_get_def(CURL *hcurl, struct options *opt)
-{
-    char *dptr = downloadbuf;
-    char url[128];
-    CURLcode result;
-
-    snprintf(url, sizeof url, "https://api.dictionaryapi.dev/api/v2/entries/en/%s", opt->word);
-    curl_easy_setopt(hcurl, CURLOPT_URL, url);
-    curl_easy_setopt(hcurl, CURLOPT_WRITEFUNCTION, dict_write_cb);
-    curl_easy_setopt(hcurl, CURLOPT_WRITEDATA, &dptr);
-    result = curl_easy_perform(hcurl);
-    if (!result) {
-        *dptr = '\0';
-        if (dict_print_JSON(downloadbuf, dptr)) {
-            dict_logf(DICT_ERROR, "Could not look up word \"%s\"", opt->word);
-            dict_logs(DICT_ERROR, "No lexical information available");
-        } else if (!opt->skip && cache_write(opt->word, downloadbuf)) {
-            dict_logf(DICT_ERROR, "Failed to write %s to cache", opt->word);
+/** @brief Looks for an entry already held locally for a base form of @p word,
+ *      so that "studied" can be answered from a cached "study"
+ *  @returns The base form that was printed, or NULL
+ */
+static const char *dict_show_lemma(const char *word)
+{
+    static char forms[LEMMA_MAXFORMS][LEMMA_MAXLEN];
+    int n, i;
+
+    n = lemma_forms(word, forms);
+    for (i = 0; i < n; i++) {
+        TRACE(LEMMA, forms[i], 0, 0);
+        if (dict_show_cached(forms[i])) {
+            return forms[i];
         }
+    }
+    return NULL;
+}
+
+
+/** @brief Answers from what is held locally once the deadline has passed: the
+ *      entry for the word itself, which -f, --force was going to refresh, else
+ *      a base form of it
+ */
+static void dict_timed_out(struct options *opt)
+{
+    unsigned ms = (opt->deadline) ? opt->deadline : HEDGE_DEADLINE;
+    const char *lemma;
+
+    if (dict_show_cached(opt->word)) {
+        printf("(timed out after %u ms; showing the cached reply)\n", ms);
+    } else if ((lemma = dict_show_lemma(opt->word))) {
+        printf("(timed out after %u ms; showing the cached reply for \"%s\")\n",
+               ms, lemma);
     } else {
-        dict_logf(DICT_ERROR, "curl: 0x%04x: %s", result, curl_easy_strerror(result));
+        dict_logf(DICT_ERROR, "Timed out after %u ms looking up \"%s\"", ms, opt->word);
     }
-    return result;
 }
 
 
-static int dict_prep_curl(struct options *opt)
+/** @brief Prints the corrections in @p guess, if there are any */
+static void dict_print_guesses(const struct spell_guess *guess, int n)
 {
-    int res = 1;
-    CURL *hcurl;
+    int i;
 
-    hcurl = curl_easy_init();
-    if (hcurl) {
-        res = dict_get_def(hcurl, opt);
-        curl_easy_cleanup(hcurl);
+    if (!n) {
+        return;
+    }
+    fputs("Did you mean: ", stdout);
+    for (i = 0; i < n; i++) {
+        printf("%s%s", (i) ? ", " : "", guess[i].word);
+    }
+    puts("?");
+}
+
+
+/** @brief Suggests corrections for @p word, which the API had no entry for */
+static void dict_suggest(const char *word)
+{
+    struct spell_guess guess[SPELL_GUESSES];
+    int n;
+
+    spell_check(word, guess, &n);
+    dict_print_guesses(guess, n);
+}
+
+
+/** @brief Checks @p opt->word against the word list before anything is sent.
+ *      A word one edit from exactly one cached word is answered from that
+ *      entry, since it is most likely a slip on a word asked for before; any
+ *      other word missing from the list is not looked up, and the closest
+ *      listed words are suggested instead
+ *  @returns true if the word was dealt with, and the network is not needed
+ */
+static bool dict_spell(struct options *opt)
+{
+    struct spell_guess guess[SPELL_GUESSES];
+    int n;
+
+    if (spell_check(opt->word, guess, &n) != SPELL_UNKNOWN) {
+        return false;
+    } else if (n && guess[0].cached && guess[0].dist == 1
+            && (n == 1 || !guess[1].cached || guess[1].dist > 1)
+            && dict_show_cached(guess[0].word)) {
+        printf("(cached reply for \"%s\"; use -f, --force to look up \"%s\" itself)\n",
+               guess[0].word, opt->word);
+    } else if (n) {
+        dict_logf(DICT_ERROR, "\"%s\" is not in the word list; use -f, --force to look it up anyway", opt->word);
+        dict_print_guesses(guess, n);
     } else {
-        dict_logs(DICT_ERROR, "Could not initialize curl");
+        dict_logf(DICT_ERROR, "\"%s\" does not look like an English word; use -f, --force to look it up anyway", opt->word);
     }
-    return res;
+    return true;
+}
+
+
+static int dict_get_def(struct options *opt)
+{
+    struct hedge_reply rep;
+    enum account_phase prev;
+    double wait;
+    int res = 0;
+
+    rate_init();
+    wait = rate_holdoff();
+    if (wait > 0) {
+        dict_logf(DICT_ERROR, "dictionaryapi.dev asked for a break; try again in %.0f s", wait + 0.5);
+        return 1;
+    }
+    TRACE(FETCH, opt->word, 0, 0);
+    hedge_deadline(opt->deadline);
+    prev = account_enter(ACCOUNT_FETCH);
+    hedge_fetch(opt->word, &rep);
+    account_leave(prev);
+    rate_feedback((rep.result) ? 0 : rep.status, rep.retry_after);
+    if (rep.result == CURLE_OPERATION_TIMEDOUT) {
+        dict_timed_out(opt);
+    } else if (rep.result) {
+        dict_logf(DICT_ERROR, "curl: 0x%04x: %s", rep.result, curl_easy_strerror(rep.result));
+    } else if (rate_throttled(rep.status)) {
+        dict_logf(DICT_ERROR, "Rate limited by dictionaryapi.dev (HTTP %ld)", rep.status);
+    } else if (dict_show(opt->word, rep.body->data, rep.body->data + rep.body->len)) {
+        dict_logf(DICT_ERROR, "Could not look up word \"%s\"", opt->word);
+        dict_logs(DICT_ERROR, "No lexical information available");
+        dict_suggest(opt->word);
+    } else if (!opt->skip) {
+        prev = account_enter(ACCOUNT_CACHE);
+        res = cache_write(opt->word, rep.body->data, &rep.body->val);
+        account_leave(prev);
+    }
+    if (res) {
+        dict_logf(DICT_ERROR, "Failed to write %s to cache", opt->word);
+    }
+    return rep.result || rate_throttled(rep.status);
+}
+
+
+/** @brief Fetches the definition from the network. libcurl is only loaded
+ *      once this is reached, so cache hits never pay for it. The handles behind
+ *      this are kept for the life of the process, so interactive sessions reuse
+ *      their connections between queries
+ */
+static int dict_prep_curl(struct options *opt)
+{
+    enum account_phase prev;
+    int res;
+
+    prev = account_enter(ACCOUNT_FETCH);
+    res = curlfn_load();
+    account_leave(prev);
+    if (res) {
+        return 1;
+    }
+    return dict_get_def(opt);
 }
 
 
 static void dict_print_usage(void)
 {
     static const char *usage =
-    "Usage: dict [OPTION] [WORD]\n"
-    "Fetch the dictionary entry for WORD from dictionaryapi.dev\n\n"
+    "Usage: dict [OPTION] [WORD...]\n"
+    "Fetch the dictionary entry for each WORD from dictionaryapi.dev\n\n"
     "Options:\n";
 
     fputs(usage, stdout);
@@ -81,9 +296,9 @@ static void dict_print_usage(void)
 
 static void dict_list(struct options *opt)
 {
-    (void)opt;  /* I may wish to inspect other options later */
+    opt->list.glob = opt->word;
     cache_init();
-    cache_list(stdout);
+    cache_list(stdout, &opt->list);
 }
 
 
@@ -92,54 +307,179 @@ static void dict_list(struct options *opt)
  */
 static void dict_try_cache(struct options *opt)
 {
-    size_t len = sizeof downloadbuf;
-    bool hit = false;
-
-    if (!cache_lookup(opt->word, downloadbuf, &len) && len) {
-        dict_print_JSON(downloadbuf, downloadbuf + len);
-        hit = true;
-    } else {
+    const char *lemma;
+    size_t count;
+
+    if (dict_show_cached(opt->word)) {
+        /* The image is consulted first, so refreshing would change nothing */
+        if (!core_contains(opt->word) && freeze_contains(opt->word)) {
+            printf("(reply from the frozen image at %s)\n", freeze_path(&count));
+        } else {
+            puts("(cached reply; use -f, --force to refresh)");
+        }
+    } else if ((lemma = dict_show_lemma(opt->word))) {
+        printf("(cached reply for \"%s\"; use -f, --force to look up \"%s\" itself)\n",
+               lemma, opt->word);
+    } else if (!dict_spell(opt)) {
         dict_prep_curl(opt);
     }
-    if (hit) {
-        puts("(cached reply; use -f, --force to refresh)");
-    }
+}
+
+
+/** @brief Warns that the frozen image holds @p word, and is searched before the
+ *      cache that -r and -f change, so @p consequence
+ */
+static void dict_warn_frozen(const char *word, const char *consequence)
+{
+    size_t count;
+
+    dict_logf(DICT_WARN, "Word %s is in the frozen image at %s, which is searched first, so %s",
+              word, freeze_path(&count), consequence);
 }
 
 
 static void dict_lookup(struct options *opt)
 {
+    static char key[KEY_MAXLEN];
+    const char *sysdir;
+
+    if (key_canon(opt->word, key)) {
+        return;
+    }
+    opt->word = key;
     cache_init();
+    audio_collect(NULL);
     if (opt->remove) {
-        if (cache_remove(opt->word) > 0) {
+        lru_remove(opt->word);
+        if (core_contains(opt->word)) {
+            cache_remove(opt->word);
+            dict_logf(DICT_WARN, "Word %s is built into dict, so it is still answered without the cache", opt->word);
+        } else if (freeze_contains(opt->word)) {
+            cache_remove(opt->word);
+            dict_warn_frozen(opt->word, "it is still answered from there");
+        } else if ((sysdir = cache_system_holds(opt->word))) {
+            cache_remove(opt->word);
+            dict_logf(DICT_WARN, "Word %s is in the read-only system cache at %s, so it is still answered from there",
+                      opt->word, sysdir);
+        } else if (cache_remove(opt->word) > 0) {
             dict_logf(DICT_ERROR, "Word %s not found in cache", opt->word);
         }
     } else if (opt->force) {
+        history_record(opt->word);
         dict_prep_curl(opt);
+        if (!core_contains(opt->word) && freeze_contains(opt->word)) {
+            dict_warn_frozen(opt->word, "later lookups will still be answered from there");
+        }
     } else {
+        history_record(opt->word);
         dict_try_cache(opt);
     }
+    if (opt->say && !opt->remove) {
+        audio_say();
+    }
 }
 
 
-int main(int argc, char *argv[])
+/** @brief Reads the cached replies for every key in @p keys at once, for the
+ *      lookups that follow
+ */
+static void dict_batch_load(const char keys[][KEY_MAXLEN], size_t n)
+{
+    enum account_phase prev;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        batch.probe[i].buf = malloc(sizeof downloadbuf);
+        if (!batch.probe[i].buf) {
+            break;
+        }
+        batch.probe[i].word = keys[i];
+        batch.probe[i].len = sizeof downloadbuf;
+    }
+    batch.n = i;
+    prev = account_enter(ACCOUNT_CACHE);
+    cache_lookup_batch(batch.probe, batch.n);
+    account_leave(prev);
+}
+
+
+static void dict_batch_free(void)
+{
+    size_t i;
+
+    for (i = 0; i < batch.n; i++) {
+        free(batch.probe[i].buf);
+    }
+    memset(&batch, 0, sizeof batch);
+}
+
+
+/** @brief Looks up each word given in turn. When there are several, the cache
+ *      is searched for all of them at once first
+ */
+static void dict_lookup_all(struct options *opt)
+{
+    static char keys[OPT_MAXWORDS][KEY_MAXLEN];
+    size_t i, n = 0;
+
+    for (i = 0; i < opt->nwords; i++) {
+        if (!key_canon(opt->words[i], keys[n])) {
+            n++;
+        }
+    }
+    if (n > 1 && !opt->force && !opt->remove) {
+        cache_init();
+        dict_batch_load(keys, n);
+    }
+    for (i = 0; i < n; i++) {
+        opt->word = keys[i];
+        dict_lookup(opt);
+    }
+    dict_batch_free();
+}
+
+
+/** @brief Carries out the action requested by @p opt, whether it came from the
+ *      command line or the interactive prompt
+ */
+static int dict_dispatch(struct options *opt)
 {
-    struct options opt = { 0 };
     int res = 0;
 
-    dict_opt_parse(argc, argv, &opt);
+    if (opt->timing) {
+        account_start();
+    }
+    dict_print_config(opt->brief, opt->page);
     if (0) {
         /* I know this looks dumb but I'm doing it to facilitate moving things
         around */
 
-    } else if (opt.help) {
+    } else if (opt->help) {
         dict_print_usage();
 
-    } else if (opt.list_history) {
-        dict_list(&opt);
+    } else if (opt->list_history) {
+        dict_list(opt);
+
+    } else if (opt->warm) {
+        res = dict_warm(opt->warm);
+
+    } else if (opt->revalidate) {
+        res = dict_revalidate(opt->stale);
+
+    } else if (opt->fsck) {
+        res = dict_fsck();
 
-    } else if (opt.word) {
-        dict_lookup(&opt);
+    } else if (opt->export) {
+        res = bundle_export(opt->export);
+
+    } else if (opt->import) {
+        res = bundle_import(opt->import);
+
+    } else if (opt->freeze) {
+        res = freeze_build(opt->freeze);
+
+    } else if (opt->word) {
+        dict_lookup_all(opt);
 
     } else {
 
@@ -147,5 +487,47 @@ int main(int argc, char *argv[])
         dict_print_usage();
         res = 1;
     }
+    meta_flush();
+    if (opt->trace) {
+        trace_dump();
+    }
+    if (opt->timing) {
+        account_report(stderr);
+    }
+    return res;
+}
+
+
+/** @brief Loads everything a long session benefits from up front, then hands
+ *      each line from the prompt to dict_dispatch
+ */
+static int dict_interactive(void)
+{
+    int res;
+
+    if (!cache_init()) {
+        cache_index_load();
+    }
+    lru_enable();
+    res = dict_repl(dict_dispatch);
+    lru_clear();
+    return res;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct options opt = { 0 };
+    int res;
+
+    trace_init();
+    dict_opt_parse(argc, argv, &opt);
+    if (opt.interactive) {
+        res = dict_interactive();
+    } else {
+        res = dict_dispatch(&opt);
+    }
+    hedge_cleanup();
+    history_prefetch();
     return res;
 }
@@ -0,0 +1,637 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "freeze.h"
+#include "cache.h"
+#include "key.h"
+#include "log.h"
+#include "trace.h"
+
+#define FREEZE_MAGIC 0x315a524654434944ULL
+
+/** The image consulted when DICT_FROZEN is not set. An administrator installs
+ *  one with dict --freeze
+ */
+#ifndef FREEZE_IMAGE
+#   define FREEZE_IMAGE "/var/cache/dict.img"
+#endif
+
+/** Replies are laid out in units of this size, and no reply that fits within
+ *  one crosses into the next
+ */
+#define FREEZE_PAGE 4096
+
+/** Keys per bucket of the perfect hash, on average. More makes the table of
+ *  displacements smaller and the build slower
+ */
+#define FREEZE_LAMBDA 4
+
+/** Displacements tried for one bucket before the build gives up */
+#define FREEZE_TRIES (1u << 24)
+
+
+/** Header of the image. It is followed by the displacement of each bucket,
+ *  then the slots, then the slot of each key in sorted order, then the text
+ *  of the keys in sorted order, each nul-terminated. The replies begin at
+ *  @c blobs, which is on a page boundary, each preceded by its key
+ */
+struct freeze_head {
+    uint64_t magic;
+    uint64_t size;      /* Of the whole image */
+    uint64_t blobs;
+    uint32_t count;
+    uint32_t buckets;   /* Always even, so that the slots stay aligned */
+    uint32_t textlen;
+    uint32_t pad;
+};
+
+
+/** Where the perfect hash puts a key. Every key has exactly one */
+struct freeze_slot {
+    uint64_t hash;  /* key_hash of the key */
+    uint64_t blob;  /* Offset of the key and reply in the image */
+    uint32_t len;   /* Of the reply */
+    uint32_t key;   /* Offset of the key in the text */
+};
+
+
+/** An entry read from the cache while building */
+struct freeze_ent {
+    char    *word;
+    char    *reply;
+    size_t   len;
+    time_t   fetched;
+    uint64_t hash;
+    uint32_t slot;
+};
+
+
+/** A key as it is sorted into buckets, largest first */
+struct freeze_key {
+    uint64_t hash;
+    uint32_t bucket;
+    uint32_t size;  /* Of its bucket */
+    uint32_t ent;
+};
+
+
+struct freeze_build {
+    struct freeze_ent *ent;
+    size_t             n;
+    size_t             cap;
+};
+
+
+static struct {
+    int                       tried;
+    void                     *map;
+    size_t                    len;
+    const struct freeze_head *head;
+    const int32_t            *disp;
+    const struct freeze_slot *slot;
+    const uint32_t           *sorted;
+    const char               *text;
+    char                      path[260];
+} frozen = { 0 };
+
+
+static uint64_t freeze_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ x >> 31;
+}
+
+
+static uint32_t freeze_bucket(uint64_t hash, uint32_t buckets)
+{
+    return (uint32_t)(hash >> 32) % buckets;
+}
+
+
+/** @brief Finds the slot a key hashing to @p hash takes in a bucket displaced
+ *      by @p disp. Positive displacements are tried in turn while building;
+ *      buckets of one key store its slot directly, as -(slot + 1)
+ */
+static uint32_t freeze_slot(uint64_t hash, int32_t disp, uint32_t count)
+{
+    if (disp < 0) {
+        return (uint32_t)(-(disp + 1));
+    }
+    return freeze_mix(hash ^ (uint64_t)disp * 0x9e3779b97f4a7c15ULL) % count;
+}
+
+
+static int freeze_add(const char *word,
+                      const char *reply,
+                      size_t      len,
+                      time_t      fetched,
+                      void       *ctx)
+{
+    struct freeze_build *b = ctx;
+    struct freeze_ent *grown, *ent;
+    size_t want;
+
+    if (len > UINT32_MAX || b->n >= UINT32_MAX / 2) {
+        dict_logs(DICT_ERROR, "Cache is too large to freeze");
+        return 1;
+    }
+    if (b->n == b->cap) {
+        want = (b->cap) ? b->cap * 2 : 256;
+        grown = realloc(b->ent, want * sizeof *grown);
+        if (!grown) {
+            dict_perror("Cannot freeze cache");
+            return 1;
+        }
+        b->ent = grown;
+        b->cap = want;
+    }
+    ent = &b->ent[b->n];
+    memset(ent, 0, sizeof *ent);
+    ent->word = strdup(word);
+    ent->reply = malloc(len ? len : 1);
+    if (!ent->word || !ent->reply) {
+        dict_perror("Cannot freeze cache");
+        free(ent->word);
+        free(ent->reply);
+        return 1;
+    }
+    memcpy(ent->reply, reply, len);
+    ent->len = len;
+    ent->fetched = fetched;
+    ent->hash = key_hash(word);
+    b->n++;
+    return 0;
+}
+
+
+static int freeze_cmpent(const void *a, const void *b)
+{
+    const struct freeze_ent *x = a, *y = b;
+
+    return strcmp(x->word, y->word);
+}
+
+
+static int freeze_cmpkey(const void *a, const void *b)
+{
+    const struct freeze_key *x = a, *y = b;
+
+    if (x->size != y->size) {
+        return (x->size > y->size) ? -1 : 1;
+    } else if (x->bucket != y->bucket) {
+        return (x->bucket < y->bucket) ? -1 : 1;
+    }
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+
+/** @brief Sorts the entries by key, keeping only the most recently fetched of
+ *      any that share one, as an entry and its older, unhashed copy can
+ */
+static void freeze_sort(struct freeze_build *b)
+{
+    struct freeze_ent *prev, *cur;
+    size_t i, n = 0;
+
+    qsort(b->ent, b->n, sizeof *b->ent, freeze_cmpent);
+    for (i = 0; i < b->n; i++) {
+        cur = &b->ent[i];
+        prev = (n) ? &b->ent[n - 1] : NULL;
+        if (prev && !strcmp(prev->word, cur->word)) {
+            if (cur->fetched > prev->fetched) {
+                free(prev->reply);
+                prev->reply = cur->reply;
+                prev->len = cur->len;
+                prev->fetched = cur->fetched;
+            } else {
+                free(cur->reply);
+            }
+            free(cur->word);
+        } else {
+            b->ent[n++] = *cur;
+        }
+    }
+    b->n = n;
+}
+
+
+/** @brief Tries displacement @p d for the @p size keys of one bucket
+ *  @returns Nonzero, having claimed their slots in @p taken, if every key
+ *      lands in a free slot of its own
+ */
+static int freeze_place(const struct freeze_key *key, uint32_t size, int32_t d,
+                        uint32_t count, unsigned char *taken)
+{
+    uint32_t i, j, slot;
+
+    for (i = 0; i < size; i++) {
+        slot = freeze_slot(key[i].hash, d, count);
+        if (taken[slot]) {
+            break;
+        }
+        taken[slot] = 1;
+    }
+    if (i == size) {
+        return 1;
+    }
+    for (j = 0; j < i; j++) {
+        taken[freeze_slot(key[j].hash, d, count)] = 0;
+    }
+    return 0;
+}
+
+
+/** @brief Builds a minimal perfect hash over the entries, by hash and
+ *      displace: the largest buckets are placed first, each by searching for a
+ *      displacement that sends all its keys to free slots, and buckets of one
+ *      key then take whatever slots are left
+ *  @returns The displacement of each bucket, which the caller must free, or
+ *      NULL on error
+ */
+static int32_t *freeze_hash(struct freeze_build *b, uint32_t buckets)
+{
+    struct freeze_key *key = NULL;
+    unsigned char *taken = NULL;
+    uint32_t *size = NULL, i, j, n = b->n, free_slot = 0;
+    int32_t *disp = NULL, d;
+
+    key = malloc(n * sizeof *key);
+    taken = calloc(n, 1);
+    size = calloc(buckets, sizeof *size);
+    disp = calloc(buckets, sizeof *disp);
+    if (!key || !taken || !size || !disp) {
+        dict_perror("Cannot freeze cache");
+        goto fail;
+    }
+    for (i = 0; i < n; i++) {
+        key[i].hash = b->ent[i].hash;
+        key[i].bucket = freeze_bucket(key[i].hash, buckets);
+        key[i].ent = i;
+        size[key[i].bucket]++;
+    }
+    for (i = 0; i < n; i++) {
+        key[i].size = size[key[i].bucket];
+    }
+    qsort(key, n, sizeof *key, freeze_cmpkey);
+    for (i = 0; i < n; i += key[i].size) {
+        for (j = i + 1; j < i + key[i].size; j++) {
+            if (key[j].hash == key[j - 1].hash) {
+                dict_logf(DICT_ERROR, "\"%s\" and \"%s\" hash alike; cannot freeze",
+                          b->ent[key[j - 1].ent].word, b->ent[key[j].ent].word);
+                goto fail;
+            }
+        }
+        if (key[i].size == 1) {
+            while (taken[free_slot]) {
+                free_slot++;
+            }
+            taken[free_slot] = 1;
+            disp[key[i].bucket] = -(int32_t)free_slot - 1;
+        } else {
+            for (d = 1; (uint32_t)d < FREEZE_TRIES; d++) {
+                if (freeze_place(&key[i], key[i].size, d, n, taken)) {
+                    break;
+                }
+            }
+            if ((uint32_t)d == FREEZE_TRIES) {
+                dict_logs(DICT_ERROR, "Cannot find a perfect hash for the cache");
+                goto fail;
+            }
+            disp[key[i].bucket] = d;
+        }
+        for (j = i; j < i + key[i].size; j++) {
+            b->ent[key[j].ent].slot = freeze_slot(key[j].hash, disp[key[j].bucket], n);
+        }
+    }
+    free(key);
+    free(taken);
+    free(size);
+    return disp;
+fail:
+    free(key);
+    free(taken);
+    free(size);
+    free(disp);
+    return NULL;
+}
+
+
+/** @brief Finds where the next blob of @p len bytes goes, after @p off. It
+ *      starts a new page rather than straddle two, unless it is larger than a
+ *      page, when it starts one regardless
+ */
+static uint64_t freeze_align(uint64_t off, size_t len)
+{
+    uint64_t used = off % FREEZE_PAGE;
+
+    if (used && (len > FREEZE_PAGE || used + len > FREEZE_PAGE)) {
+        off += FREEZE_PAGE - used;
+    }
+    return off;
+}
+
+
+static int freeze_pad(FILE *fp, uint64_t from, uint64_t to)
+{
+    static const char zero[FREEZE_PAGE];
+
+    return to > from && fwrite(zero, 1, to - from, fp) != to - from;
+}
+
+
+/** @brief Writes the image to @p path, through a temporary file so that other
+ *      processes see either the old image or the new one
+ */
+static int freeze_write(const char *path, struct freeze_build *b, const int32_t *disp,
+                        uint32_t buckets)
+{
+    struct freeze_head head = { 0 };
+    struct freeze_slot *slot;
+    uint32_t *sorted, textlen = 0;
+    uint64_t off;
+    char tmp[4096];
+    int res = 1;
+    size_t i;
+    FILE *fp;
+
+    slot = calloc(b->n, sizeof *slot);
+    sorted = malloc(b->n * sizeof *sorted);
+    if (!slot || !sorted) {
+        dict_perror("Cannot freeze cache");
+        goto cleanup;
+    }
+    for (i = 0; i < b->n; i++) {
+        sorted[i] = b->ent[i].slot;
+        slot[b->ent[i].slot].key = textlen;
+        textlen += strlen(b->ent[i].word) + 1;
+    }
+    head.magic = FREEZE_MAGIC;
+    head.count = b->n;
+    head.buckets = buckets;
+    head.textlen = textlen;
+    off = sizeof head + (uint64_t)buckets * sizeof *disp
+        + (uint64_t)b->n * (sizeof *slot + sizeof *sorted) + textlen;
+    head.blobs = off = freeze_align(off, FREEZE_PAGE);
+    for (i = 0; i < b->n; i++) {
+        off = freeze_align(off, strlen(b->ent[i].word) + 1 + b->ent[i].len);
+        slot[b->ent[i].slot].hash = b->ent[i].hash;
+        slot[b->ent[i].slot].blob = off;
+        slot[b->ent[i].slot].len = b->ent[i].len;
+        off += strlen(b->ent[i].word) + 1 + b->ent[i].len;
+    }
+    head.size = off;
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        dict_perror("Cannot create frozen image");
+        goto cleanup;
+    }
+    res = fwrite(&head, sizeof head, 1, fp) != 1
+       || fwrite(disp, sizeof *disp, buckets, fp) != buckets
+       || fwrite(slot, sizeof *slot, b->n, fp) != b->n
+       || fwrite(sorted, sizeof *sorted, b->n, fp) != b->n;
+    for (i = 0; i < b->n && !res; i++) {
+        res = fwrite(b->ent[i].word, 1, strlen(b->ent[i].word) + 1, fp)
+           != strlen(b->ent[i].word) + 1;
+    }
+    off = sizeof head + (uint64_t)buckets * sizeof *disp
+        + (uint64_t)b->n * (sizeof *slot + sizeof *sorted) + textlen;
+    for (i = 0; i < b->n && !res; i++) {
+        res = freeze_pad(fp, off, slot[b->ent[i].slot].blob);
+        off = slot[b->ent[i].slot].blob;
+        res = res || fwrite(b->ent[i].word, 1, strlen(b->ent[i].word) + 1, fp)
+                  != strlen(b->ent[i].word) + 1
+                  || fwrite(b->ent[i].reply, 1, b->ent[i].len, fp) != b->ent[i].len;
+        off += strlen(b->ent[i].word) + 1 + b->ent[i].len;
+    }
+    res = fclose(fp) || res || rename(tmp, path);
+    if (res) {
+        dict_perror("Cannot write frozen image");
+        remove(tmp);
+    }
+cleanup:
+    free(slot);
+    free(sorted);
+    return res;
+}
+
+
+int freeze_build(const char *path)
+{
+    struct freeze_build b = { 0 };
+    uint32_t buckets;
+    int32_t *disp = NULL;
+    int res;
+    size_t i;
+
+    res = cache_init() || cache_walk(freeze_add, &b);
+    if (!res) {
+        freeze_sort(&b);
+        if (!b.n) {
+            dict_logs(DICT_ERROR, "The cache is empty; nothing to freeze");
+            res = 1;
+        }
+    }
+    if (!res) {
+        buckets = (b.n / FREEZE_LAMBDA + 2) & ~1u;
+        disp = freeze_hash(&b, buckets);
+        res = !disp || freeze_write(path, &b, disp, buckets);
+    }
+    if (!res) {
+        dict_logf(DICT_INFO, "Froze %zu words into %s", b.n, path);
+    }
+    for (i = 0; i < b.n; i++) {
+        free(b.ent[i].word);
+        free(b.ent[i].reply);
+    }
+    free(b.ent);
+    free(disp);
+    return res;
+}
+
+
+/** @brief Checks that the sections named by @p head lie within the @p len
+ *      bytes mapped
+ */
+static int freeze_valid(const struct freeze_head *head, size_t len)
+{
+    uint64_t tables;
+    const char *text;
+
+    if (len < sizeof *head || head->magic != FREEZE_MAGIC || head->size != len
+     || !head->count || !head->buckets || head->buckets & 1) {
+        return 0;
+    }
+    tables = sizeof *head + (uint64_t)head->buckets * sizeof (int32_t)
+           + (uint64_t)head->count * (sizeof (struct freeze_slot) + sizeof (uint32_t))
+           + head->textlen;
+    if (tables > head->blobs || head->blobs > len || !head->textlen) {
+        return 0;
+    }
+    text = (const char *)head + tables - head->textlen;
+    return !text[head->textlen - 1];
+}
+
+
+/** @brief Maps the frozen image. This is only tried once per process
+ *  @returns Nonzero if there is none
+ */
+static int freeze_open(void)
+{
+    const char *env = getenv("DICT_FROZEN");
+    const struct freeze_head *head;
+    struct stat sbuf;
+    int fd;
+
+    if (frozen.tried) {
+        return !frozen.map;
+    }
+    frozen.tried = 1;
+    env = (env) ? env : FREEZE_IMAGE;
+    if (!*env || snprintf(frozen.path, sizeof frozen.path, "%s", env) >= (int)sizeof frozen.path) {
+        return 1;
+    }
+    fd = open(frozen.path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    } else if (fstat(fd, &sbuf) || (size_t)sbuf.st_size < sizeof *head) {
+        close(fd);
+        return 1;
+    }
+    frozen.len = sbuf.st_size;
+    frozen.map = mmap(NULL, frozen.len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (frozen.map == MAP_FAILED) {
+        frozen.map = NULL;
+        return 1;
+    }
+    head = frozen.map;
+    if (!freeze_valid(head, frozen.len)) {
+        dict_logf(DICT_WARN, "Ignoring damaged frozen image %s", frozen.path);
+        munmap(frozen.map, frozen.len);
+        frozen.map = NULL;
+        return 1;
+    }
+    /* Each lookup touches one page of replies; reading ahead only wastes I/O */
+    posix_madvise(frozen.map, frozen.len, POSIX_MADV_RANDOM);
+    frozen.head = head;
+    frozen.disp = (const int32_t *)(head + 1);
+    frozen.slot = (const struct freeze_slot *)(frozen.disp + head->buckets);
+    frozen.sorted = (const uint32_t *)(frozen.slot + head->count);
+    frozen.text = (const char *)(frozen.sorted + head->count);
+    return 0;
+}
+
+
+/** @brief Finds the slot of @p word, and its reply
+ *  @returns The slot, or NULL if the image does not hold @p word
+ */
+static const struct freeze_slot *freeze_find(const char *word, const char **reply)
+{
+    const struct freeze_slot *slot;
+    const char *blob;
+    size_t wlen;
+    uint64_t hash;
+    uint32_t i;
+    int32_t disp;
+
+    if (freeze_open()) {
+        return NULL;
+    }
+    hash = key_hash(word);
+    disp = frozen.disp[freeze_bucket(hash, frozen.head->buckets)];
+    if (!disp) {
+        return NULL;    /* An empty bucket */
+    }
+    i = freeze_slot(hash, disp, frozen.head->count);
+    if (i >= frozen.head->count) {
+        return NULL;
+    }
+    slot = &frozen.slot[i];
+    wlen = strlen(word) + 1;
+    if (slot->hash != hash || slot->blob > frozen.len || frozen.len - slot->blob < wlen + slot->len) {
+        return NULL;
+    }
+    blob = (const char *)frozen.map + slot->blob;
+    if (memcmp(blob, word, wlen)) {
+        return NULL;
+    }
+    *reply = blob + wlen;
+    return slot;
+}
+
+
+bool freeze_get(const char *word, char *buf, size_t *len)
+{
+    const struct freeze_slot *slot;
+    const char *reply;
+
+    slot = freeze_find(word, &reply);
+    if (!slot || slot->len > *len) {
+        return false;
+    }
+    memcpy(buf, reply, slot->len);
+    *len = slot->len;
+    TRACE(FREEZE_HIT, word, *len, 0);
+    return true;
+}
+
+
+bool freeze_contains(const char *word)
+{
+    const char *reply;
+
+    return freeze_find(word, &reply) != NULL;
+}
+
+
+static const char *freeze_key(uint32_t i)
+{
+    uint32_t slot = frozen.sorted[i];
+
+    return (slot < frozen.head->count && frozen.slot[slot].key < frozen.head->textlen)
+         ? frozen.text + frozen.slot[slot].key : "";
+}
+
+
+size_t freeze_prefix(const char *prefix, meta_each_fn *fn, void *ctx)
+{
+    size_t lo = 0, hi, mid, plen = strlen(prefix), n = 0;
+
+    if (freeze_open()) {
+        return 0;
+    }
+    hi = frozen.head->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (strcmp(freeze_key(mid), prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < frozen.head->count && !strncmp(freeze_key(lo), prefix, plen); lo++, n++) {
+        fn(freeze_key(lo), ctx);
+    }
+    return n;
+}
+
+
+const char *freeze_path(size_t *count)
+{
+    if (freeze_open()) {
+        return NULL;
+    }
+    *count = frozen.head->count;
+    return frozen.path;
+}
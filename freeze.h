@@ -0,0 +1,51 @@
+#pragma once
+
+#ifndef DICT_FREEZE_H
+#define DICT_FREEZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "meta.h"
+
+
+/** @brief Compiles every entry in the user's cache into a single immutable
+ *      image at @p path. The image holds a minimal perfect hash over the keys,
+ *      the replies laid out so that none crosses a page it could fit within,
+ *      and the keys in sorted order
+ *  @returns Nonzero on error
+ */
+int freeze_build(const char *path);
+
+
+/** @brief Looks @p word up in the frozen image, which is mapped on first use.
+ *      The image is found at DICT_FROZEN, or FREEZE_IMAGE if that is not set;
+ *      an empty value disables it, and a missing image is silently ignored
+ *  @param[out] buf
+ *      Buffer to copy the reply to
+ *  @param[in,out] len
+ *      On input, the size of @p buf. On output, the length of the reply
+ *  @returns true on a hit
+ */
+bool freeze_get(const char *word, char *buf, size_t *len);
+
+
+/** @brief Checks whether the frozen image holds @p word, without copying it */
+bool freeze_contains(const char *word);
+
+
+/** @brief Passes every key in the frozen image beginning with @p prefix to
+ *      @p fn, in sorted order
+ *  @returns The number of keys passed
+ */
+size_t freeze_prefix(const char *prefix, meta_each_fn *fn, void *ctx);
+
+
+/** @brief Retrieves the path of the frozen image in use, and the number of
+ *      words it holds in @p count
+ *  @returns The path, or NULL if no image is mapped
+ */
+const char *freeze_path(size_t *count);
+
+
+#endif /* DICT_FREEZE_H */
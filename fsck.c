@@ -0,0 +1,405 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <json-c/json.h>
+
+#include "fsck.h"
+#include "cache.h"
+#include "hot.h"
+#include "json.h"
+#include "key.h"
+#include "log.h"
+#include "meta.h"
+
+/** The most threads checking entries at once, the caller's included. Reads
+ *  overlap even where there are fewer processors, so there are never fewer
+ *  than FSCK_MINTHREADS
+ */
+#define FSCK_THREADS    16
+#define FSCK_MINTHREADS 4
+
+/** The most copies of one name kept in quarantine */
+#define FSCK_SUFFIXES   999
+
+
+/** Every verdict on an entry, with how it is reported */
+#define FSCK_VERDICTS(X)                                \
+    X(SOUND,      "sound")                              \
+    X(SKIPPED,    "skipped as not files")               \
+    X(UNREADABLE, "unreadable")                         \
+    X(MISNAMED,   "misnamed or without a header")       \
+    X(EMPTY,      "empty")                              \
+    X(MALFORMED,  "not valid JSON")                     \
+    X(FOREIGN,    "valid JSON, but not an entry")
+
+
+enum fsck_verdict {
+#define FSCK_ENUM(name, str) FSCK_##name,
+    FSCK_VERDICTS(FSCK_ENUM)
+#undef FSCK_ENUM
+    FSCK_COUNT
+};
+
+
+static const char *fsck_names[] = {
+#define FSCK_NAME(name, str) str,
+    FSCK_VERDICTS(FSCK_NAME)
+#undef FSCK_NAME
+};
+
+
+struct fsck_ent {
+    char             *name;
+    char              word[KEY_MAXLEN];
+    struct timespec   atime;
+    time_t            fetched;
+    off_t             size;
+    enum fsck_verdict verdict;
+};
+
+
+static struct {
+    char             dir[260];
+    struct fsck_ent *ent;
+    size_t           n;
+    size_t           cap;
+    size_t           next;  /* The next entry to claim */
+} fsck = { 0 };
+
+
+static double fsck_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/** @brief Lists the names of the files in the cache directory
+ *  @returns Nonzero on error
+ */
+static int fsck_list(void)
+{
+    struct fsck_ent *grown;
+    struct dirent *de;
+    size_t want;
+    DIR *dir;
+
+    dir = opendir(fsck.dir);
+    if (!dir) {
+        if (errno != ENOENT) {
+            dict_perror("Cannot open cache directory");
+        }
+        return errno != ENOENT;
+    }
+    while ((de = readdir(dir))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
+            continue;
+        }
+        if (fsck.n == fsck.cap) {
+            want = (fsck.cap) ? fsck.cap * 2 : 256;
+            grown = realloc(fsck.ent, want * sizeof *grown);
+            if (!grown) {
+                break;
+            }
+            fsck.ent = grown;
+            fsck.cap = want;
+        }
+        memset(&fsck.ent[fsck.n], 0, sizeof *fsck.ent);
+        if (!(fsck.ent[fsck.n].name = strdup(de->d_name))) {
+            break;
+        }
+        fsck.n++;
+    }
+    if (de) {
+        dict_perror("Cannot list cache directory");
+    }
+    closedir(dir);
+    return de != NULL;
+}
+
+
+/** @brief Reads the whole of the file open on @p fd into @p *buf, growing it
+ *      as need be, and nul-terminates it
+ *  @returns Nonzero on error
+ */
+static int fsck_read(int fd, size_t size, char **buf, size_t *cap)
+{
+    size_t len = 0;
+    ssize_t got;
+    char *grown;
+
+    if (size + 1 > *cap) {
+        grown = realloc(*buf, size + 1);
+        if (!grown) {
+            return 1;
+        }
+        *buf = grown;
+        *cap = size + 1;
+    }
+    while (len < size) {
+        got = read(fd, *buf + len, size - len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        } else if (got <= 0) {
+            return 1;   /* Shrunk while being read counts as unreadable */
+        }
+        len += got;
+    }
+    (*buf)[len] = '\0';
+    return 0;
+}
+
+
+/** @brief Judges the reply held in the @p len bytes at @p buf */
+static enum fsck_verdict fsck_judge(const char *buf, size_t len)
+{
+    struct json_object *json;
+    enum fsck_verdict res;
+
+    if (!len) {
+        return FSCK_EMPTY;  /* A header and nothing else */
+    }
+    json = dict_parse_JSON(buf, buf + len);
+    if (!json) {
+        res = FSCK_MALFORMED;
+    } else if (!json_object_is_type(json, json_type_array) || !json_object_array_length(json)) {
+        res = FSCK_FOREIGN;
+    } else {
+        res = FSCK_SOUND;
+    }
+    json_object_put(json);
+    return res;
+}
+
+
+/** @brief Reads and judges one entry. Reading it does not count as reading it
+ *      for eviction, so its access time is put back
+ */
+static void fsck_check(struct fsck_ent *ent, char **buf, size_t *cap)
+{
+    struct timespec ts[2];
+    struct stat sbuf, after;
+    char path[512];
+    size_t len;
+    int fd;
+
+    snprintf(path, sizeof path, "%s/%s", fsck.dir, ent->name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sbuf)) {
+        ent->verdict = FSCK_UNREADABLE;
+    } else if (!S_ISREG(sbuf.st_mode)) {
+        ent->verdict = FSCK_SKIPPED;
+    } else if (!sbuf.st_size) {
+        ent->verdict = FSCK_EMPTY;
+    } else if (fsck_read(fd, sbuf.st_size, buf, cap)) {
+        ent->verdict = FSCK_UNREADABLE;
+    } else {
+        ent->atime = sbuf.st_atim;
+        ent->fetched = sbuf.st_mtime;
+        ent->size = sbuf.st_size;
+        len = sbuf.st_size;
+        ent->verdict = (cache_entry_parse(ent->name, *buf, &len, ent->word))
+                     ? FSCK_MISNAMED : fsck_judge(*buf, len);
+        if (!fstat(fd, &after) && after.st_atime != sbuf.st_atime) {
+            ts[0] = sbuf.st_atim;
+            ts[1].tv_sec = 0;
+            ts[1].tv_nsec = UTIME_OMIT;
+            futimens(fd, ts);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+
+static void *fsck_worker(void *arg)
+{
+    size_t i, cap = 0;
+    char *buf = NULL;
+
+    (void)arg;
+    while ((i = __atomic_fetch_add(&fsck.next, 1, __ATOMIC_RELAXED)) < fsck.n) {
+        fsck_check(&fsck.ent[i], &buf, &cap);
+    }
+    free(buf);
+    return NULL;
+}
+
+
+/** @brief Shares the entries between two threads per processor, within the
+ *      bounds above, the caller among them
+ *  @returns The number of threads that took part
+ */
+static unsigned fsck_run(void)
+{
+    pthread_t tid[FSCK_THREADS - 1];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned want, started = 0, i;
+    struct json_object *warmup;
+
+    want = (cpus > 0 && cpus < FSCK_THREADS / 2) ? 2 * (unsigned)cpus : FSCK_THREADS;
+    want = (want < FSCK_MINTHREADS) ? FSCK_MINTHREADS : want;
+    want = (fsck.n < want) ? (unsigned)fsck.n : want;
+    /* json-c seeds its hash tables on first use; do that before any thread can
+       race to */
+    warmup = json_tokener_parse("[{}]");
+    json_object_put(warmup);
+    for (i = 1; i < want; i++) {
+        if (pthread_create(&tid[started], NULL, fsck_worker, NULL)) {
+            break;
+        }
+        started++;
+    }
+    fsck_worker(NULL);
+    for (i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    return started + 1;
+}
+
+
+/** @brief Moves @p from into @p qdir under the name @p name, or, if an earlier
+ *      check already put a file there, under that name with the first free
+ *      numeric suffix. Nothing already quarantined is overwritten
+ *  @returns Nonzero on error
+ */
+static int fsck_move(const char *from, const char *qdir, const char *name)
+{
+    char to[512];
+    unsigned n;
+    int err;
+
+    snprintf(to, sizeof to, "%s/%s", qdir, name);
+    for (n = 1; link(from, to); n++) {
+        if (errno != EEXIST || n > FSCK_SUFFIXES) {
+            return 1;
+        }
+        snprintf(to, sizeof to, "%s/%s.%u", qdir, name, n);
+    }
+    if (unlink(from)) {
+        err = errno;
+        unlink(to);
+        errno = err;
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Moves the damaged entries to the quarantine directory
+ *  @returns The number that could not be moved
+ */
+static size_t fsck_quarantine(const char *qdir)
+{
+    struct fsck_ent *ent;
+    char from[512];
+    size_t i, stuck = 0;
+
+    for (i = 0; i < fsck.n; i++) {
+        ent = &fsck.ent[i];
+        if (ent->verdict == FSCK_SOUND || ent->verdict == FSCK_SKIPPED) {
+            continue;
+        }
+        if (ent->word[0]) {
+            hot_drop(ent->word);
+        }
+        snprintf(from, sizeof from, "%s/%s", fsck.dir, ent->name);
+        if (fsck_move(from, qdir, ent->name)) {
+            dict_logf(DICT_WARN, "Cannot move %s aside: %s", from, strerror(errno));
+            stuck++;
+        }
+    }
+    return stuck;
+}
+
+
+/** @brief Fills the index with the sound entries, as they were read */
+static void fsck_fill(void)
+{
+    const struct fsck_ent *ent;
+    size_t i;
+
+    for (i = 0; i < fsck.n; i++) {
+        ent = &fsck.ent[i];
+        if (ent->verdict == FSCK_SOUND) {
+            meta_add(ent->word, ent->atime.tv_sec, ent->fetched, ent->size);
+        }
+    }
+}
+
+
+static void fsck_report(double elapsed, unsigned threads, const size_t count[FSCK_COUNT])
+{
+    double bytes = 0;
+    size_t i, checked;
+
+    for (i = 0; i < fsck.n; i++) {
+        bytes += fsck.ent[i].size;
+    }
+    checked = fsck.n - count[FSCK_SKIPPED];
+    elapsed = (elapsed > 1e-6) ? elapsed : 1e-6;
+    dict_logf(DICT_INFO, "Checked %zu entries, %.1f MB, in %.0f ms on %u thread%s: %.0f entries/s, %.1f MB/s",
+              checked, bytes / 1e6, elapsed * 1e3, threads, (threads == 1) ? "" : "s",
+              checked / elapsed, bytes / 1e6 / elapsed);
+    for (i = 0; i < FSCK_COUNT; i++) {
+        if (count[i] && i != FSCK_SOUND) {
+            dict_logf(DICT_INFO, "  %zu %s", count[i], fsck_names[i]);
+        }
+    }
+}
+
+
+int dict_fsck(void)
+{
+    size_t count[FSCK_COUNT] = { 0 }, bad, stuck = 0, i;
+    unsigned threads = 0;
+    char qdir[260];
+    double start, elapsed;
+    int res;
+
+    res = cache_init() || cache_dirpath(fsck.dir, sizeof fsck.dir)
+       || cache_auxpath(qdir, sizeof qdir, FSCK_QUARANTINE);
+    start = fsck_now();
+    res = res || fsck_list();
+    if (!res && fsck.n) {
+        threads = fsck_run();
+    }
+    elapsed = fsck_now() - start;
+    for (i = 0; i < fsck.n; i++) {
+        count[fsck.ent[i].verdict]++;
+    }
+    bad = fsck.n - count[FSCK_SOUND] - count[FSCK_SKIPPED];
+    if (res) {
+        goto cleanup;
+    } else if (bad && mkdir(qdir, 0755) && errno != EEXIST) {
+        dict_perror("Cannot create quarantine directory");
+        stuck = bad;
+    } else if (bad) {
+        stuck = fsck_quarantine(qdir);
+    }
+    res = meta_reindex(fsck_fill) || stuck;
+    fsck_report(elapsed, threads, count);
+    if (bad > stuck) {
+        dict_logf(DICT_INFO, "Moved %zu damaged entries to %s", bad - stuck, qdir);
+    }
+cleanup:
+    for (i = 0; i < fsck.n; i++) {
+        free(fsck.ent[i].name);
+    }
+    free(fsck.ent);
+    memset(&fsck, 0, sizeof fsck);
+    return res;
+}
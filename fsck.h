@@ -0,0 +1,21 @@
+#pragma once
+
+#ifndef DICT_FSCK_H
+#define DICT_FSCK_H
+
+/** Where damaged entries are moved, beside the cache directory */
+#define FSCK_QUARANTINE "quarantine"
+
+
+/** @brief Checks every entry in the user's cache on a pool of threads. Entries
+ *      that cannot be read, are misnamed, or do not hold a reply the parser
+ *      accepts are moved aside to FSCK_QUARANTINE. The index is then rebuilt
+ *      from the sound entries' sizes and times, all gathered in the same pass,
+ *      and the rate the cache was checked at is reported
+ *  @returns Nonzero on error. Finding damaged entries is not an error, as long
+ *      as they could all be moved aside
+ */
+int dict_fsck(void);
+
+
+#endif /* DICT_FSCK_H */
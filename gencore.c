@@ -0,0 +1,252 @@
+/* Generates coredata.c, the core vocabulary built into dict-core, from a list
+   of words ordered most common first and a cache directory holding their
+   entries. See core.h */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "key.h"
+#include "log.h"
+
+#define GENCORE_USAGE "Usage: gencore WORDS CORPUS N OUT\n"                 \
+    "Write to OUT the C source of the entries in the cache directory CORPUS\n" \
+    "for the first N words listed in WORDS, one per line, most common first\n"
+
+/** The largest entry read from the corpus */
+#define GENCORE_MAXREPLY (1 << 20)
+
+/** Each entry begins with this header, as cache.c writes it */
+#define GENCORE_HEADER "word: "
+
+/** Fields of a reply that dict never shows, dropped from the entries built in */
+static const char *gencore_unused[] = {
+    "license", "sourceUrls"
+};
+
+
+struct gencore_ent {
+    char     word[KEY_MAXLEN];
+    char    *reply;
+    size_t   len;
+    uint64_t hash;
+};
+
+
+/** @brief Reads the entry for @p word from @p corpus, under its hashed name or,
+ *      failing that, the word itself, and strips its header
+ *  @returns The reply, which the caller must free, or NULL if there is none
+ */
+static char *gencore_read(const char *corpus, const char *word, size_t *len)
+{
+    char path[4096], name[KEY_NAMELEN], *buf, *body;
+    size_t hlen = sizeof GENCORE_HEADER - 1, wlen = strlen(word);
+    FILE *fp;
+
+    key_name(word, name);
+    snprintf(path, sizeof path, "%s/%s", corpus, name);
+    fp = fopen(path, "rb");
+    if (!fp) {
+        snprintf(path, sizeof path, "%s/%s", corpus, word);
+        fp = (strchr(word, '/')) ? NULL : fopen(path, "rb");
+        hlen = 0;
+    }
+    if (!fp || !(buf = malloc(GENCORE_MAXREPLY + 1))) {
+        if (fp) {
+            fclose(fp);
+        }
+        return NULL;
+    }
+    *len = fread(buf, 1, GENCORE_MAXREPLY, fp);
+    fclose(fp);
+    buf[*len] = '\0';
+    body = buf;
+    if (hlen) {
+        if (strncmp(buf, GENCORE_HEADER, hlen) || strncmp(buf + hlen, word, wlen)
+         || buf[hlen + wlen] != '\n' || !(body = strstr(buf, "\n\n"))) {
+            free(buf);
+            return NULL;    /* Some other word sharing its hash */
+        }
+        body += 2;
+    }
+    *len -= body - buf;
+    memmove(buf, body, *len + 1);
+    return buf;
+}
+
+
+/** @brief Parses @p reply, so that nothing malformed is built in, and writes
+ *      it back out without whitespace or the fields dict never shows
+ *  @returns The result, which the caller must free, or NULL if @p reply is not
+ *      an entry
+ */
+static char *gencore_prune(const char *reply, size_t *len)
+{
+    const size_t nunused = sizeof gencore_unused / sizeof *gencore_unused;
+    struct json_object *root, *node;
+    const char *str;
+    char *res = NULL;
+    size_t i, j;
+
+    root = json_tokener_parse(reply);
+    if (!root || !json_object_is_type(root, json_type_array) || !json_object_array_length(root)) {
+        json_object_put(root);
+        return NULL;
+    }
+    for (i = 0; i < json_object_array_length(root); i++) {
+        node = json_object_array_get_idx(root, i);
+        for (j = 0; j < nunused && json_object_is_type(node, json_type_object); j++) {
+            json_object_object_del(node, gencore_unused[j]);
+        }
+    }
+    str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN | JSON_C_TO_STRING_NOSLASHESCAPE);
+    if (str) {
+        *len = strlen(str);
+        res = strdup(str);
+    }
+    json_object_put(root);
+    return res;
+}
+
+
+/** @brief Writes @p len bytes of @p str as a C string literal, split across
+ *      lines. Anything but printable ASCII is written in octal
+ */
+static void gencore_literal(FILE *fp, const char *str, size_t len)
+{
+    const unsigned char *ptr = (const unsigned char *)str;
+    size_t i, col = 0;
+
+    fputs("\n        \"", fp);
+    for (i = 0; i < len; i++) {
+        if (col >= 64) {
+            fputs("\"\n        \"", fp);
+            col = 0;
+        }
+        if (ptr[i] == '"' || ptr[i] == '\\') {
+            col += fprintf(fp, "\\%c", ptr[i]);
+        } else if (ptr[i] < 0x20 || ptr[i] >= 0x7f || ptr[i] == '?') {
+            col += fprintf(fp, "\\%03o", ptr[i]);   /* Octal cannot run on, and ? cannot make a trigraph */
+        } else {
+            fputc(ptr[i], fp);
+            col++;
+        }
+    }
+    fputc('"', fp);
+}
+
+
+static int gencore_write(FILE *fp, const struct gencore_ent *ent, size_t n, const char *words, const char *corpus)
+{
+    uint32_t *table, mask = 1, i;
+    size_t k;
+
+    while (mask < 2 * n) {
+        mask <<= 1;     /* At most half full */
+    }
+    table = calloc(mask, sizeof *table);
+    if (!table) {
+        dict_perror("Cannot generate the core vocabulary");
+        return 1;
+    }
+    mask--;
+    for (k = 0; k < n; k++) {
+        i = ent[k].hash & mask;
+        while (table[i]) {
+            i = (i + 1) & mask;
+        }
+        table[i] = k + 1;
+    }
+    fprintf(fp, "/* Generated by gencore from %s and %s. Do not edit */\n", words, corpus);
+    fputs("#include \"core.h\"\n\n\n", fp);
+    fputs("const struct core_entry core_entries[] = {\n", fp);
+    for (k = 0; k < n; k++) {
+        fprintf(fp, "    {\n        0x%016llxULL,", (unsigned long long)ent[k].hash);
+        gencore_literal(fp, ent[k].word, strlen(ent[k].word));
+        fputc(',', fp);
+        gencore_literal(fp, ent[k].reply, ent[k].len);
+        fprintf(fp, ",\n        %zu\n    },\n", ent[k].len);
+    }
+    if (!n) {
+        fputs("    { 0, \"\", \"\", 0 }\n", fp);
+    }
+    fputs("};\n\n", fp);
+    fputs("const uint32_t core_table[] = {", fp);
+    for (i = 0; i <= mask; i++) {
+        fprintf(fp, "%s%u,", (i % 16) ? " " : "\n    ", table[i]);
+    }
+    fprintf(fp, "\n};\n\nconst uint32_t core_mask = %u;\n", mask);
+    free(table);
+    return ferror(fp);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct gencore_ent *ent = NULL;
+    char key[KEY_MAXLEN], *line = NULL, *raw, tmp[4096];
+    size_t cap = 0, n = 0, want, seen = 0, k;
+    int res = 1;
+    ssize_t len;
+    FILE *fp, *out;
+
+    if (argc != 5 || !(want = strtoul(argv[3], NULL, 10))) {
+        fputs(GENCORE_USAGE, stderr);
+        return 1;
+    }
+    fp = fopen(argv[1], "r");
+    ent = calloc(want, sizeof *ent);
+    if (!fp || !ent) {
+        dict_perror(argv[1]);
+        goto cleanup;
+    }
+    while (seen < want && (len = getline(&line, &cap, fp)) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!*line || key_canon(line, key)) {
+            continue;
+        }
+        seen++;
+        for (k = 0; k < n; k++) {
+            if (!strcmp(ent[k].word, key)) {
+                break;  /* Listed twice, differing only in case */
+            }
+        }
+        if (k < n || !(raw = gencore_read(argv[2], key, &ent[n].len))) {
+            continue;
+        }
+        ent[n].reply = gencore_prune(raw, &ent[n].len);
+        free(raw);
+        if (ent[n].reply) {
+            strcpy(ent[n].word, key);
+            ent[n].hash = key_hash(key);
+            n++;
+        }
+    }
+    snprintf(tmp, sizeof tmp, "%s.tmp", argv[4]);
+    out = fopen(tmp, "w");
+    if (!out) {
+        dict_perror(tmp);
+        goto cleanup;
+    }
+    res = gencore_write(out, ent, n, argv[1], argv[2]);
+    res = fclose(out) || res || rename(tmp, argv[4]);
+    if (res) {
+        dict_perror("Cannot write the core vocabulary");
+        remove(tmp);
+    } else {
+        dict_logf(DICT_INFO, "Built in %zu of the top %zu words", n, seen);
+    }
+cleanup:
+    if (fp) {
+        fclose(fp);
+    }
+    for (k = 0; k < n; k++) {
+        free(ent[k].reply);
+    }
+    free(ent);
+    free(line);
+    return res;
+}
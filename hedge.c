@@ -0,0 +1,390 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hedge.h"
+#include "cache.h"
+#include "log.h"
+#include "trace.h"
+
+/** First-byte latencies remembered per backend, in milliseconds */
+#define HEDGE_SAMPLES 64
+
+/** Until a backend has this many samples its hedge delay is HEDGE_DEFAULT */
+#define HEDGE_MINSAMPLES 8
+
+/** Bounds on the hedge delay, in milliseconds */
+#define HEDGE_DEFAULT 500
+#define HEDGE_MIN     50
+#define HEDGE_MAX     3000
+
+/** Latency samples are kept in this file beside the cache */
+#define HEDGE_STATS "latency"
+
+
+struct hedge_backend {
+    const char    *root;
+    CURL          *hcurl;
+    struct net_buf buf;
+
+    bool     running;
+    bool     timed;     /* This transfer's first byte was already sampled */
+    double   started;
+    CURLcode result;
+    long     status;
+    long     retry_after;
+
+    unsigned sample[HEDGE_SAMPLES];
+    unsigned nsample;
+    unsigned head;      /* Where the next sample is written */
+};
+
+
+static struct {
+    struct hedge_backend be[NET_MAXBACKENDS];
+    int                  count;
+    CURLM               *multi;
+    bool                 dirty;
+    unsigned             deadline;  /* Milliseconds, or 0 for the default */
+} hedge = { 0 };
+
+
+static double hedge_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void hedge_record(struct hedge_backend *be, unsigned ms)
+{
+    be->sample[be->head] = ms;
+    be->head = (be->head + 1) % HEDGE_SAMPLES;
+    if (be->nsample < HEDGE_SAMPLES) {
+        be->nsample++;
+    }
+    hedge.dirty = true;
+}
+
+
+static int hedge_cmp(const void *lhs, const void *rhs)
+{
+    unsigned x = *(const unsigned *)lhs, y = *(const unsigned *)rhs;
+
+    return (x > y) - (x < y);
+}
+
+
+/** @brief Computes how long to wait for @p be's first byte before hedging: the
+ *      95th percentile of its recent first-byte latencies
+ *  @returns The delay in seconds
+ */
+static double hedge_delay(const struct hedge_backend *be)
+{
+    unsigned sorted[HEDGE_SAMPLES], p95;
+
+    if (be->nsample < HEDGE_MINSAMPLES) {
+        return HEDGE_DEFAULT / 1000.0;
+    }
+    memcpy(sorted, be->sample, be->nsample * sizeof *sorted);
+    qsort(sorted, be->nsample, sizeof *sorted, hedge_cmp);
+    p95 = sorted[(95 * be->nsample + 99) / 100 - 1];
+    p95 = (p95 < HEDGE_MIN) ? HEDGE_MIN : (p95 > HEDGE_MAX) ? HEDGE_MAX : p95;
+    return p95 / 1000.0;
+}
+
+
+/** @brief Reads the latency samples saved by earlier processes. Each line is
+ *      an API root, a count, and that many samples, oldest first
+ */
+static void hedge_load_stats(void)
+{
+    struct hedge_backend *be;
+    char path[260], root[256];
+    unsigned n, ms, i;
+    int j;
+    FILE *fp;
+
+    if (cache_auxpath(path, sizeof path, HEDGE_STATS)) {
+        return;
+    }
+    fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    while (fscanf(fp, "%255s %u", root, &n) == 2) {
+        for (be = NULL, j = 0; j < hedge.count; j++) {
+            if (!strcmp(hedge.be[j].root, root)) {
+                be = &hedge.be[j];
+            }
+        }
+        for (i = 0; i < n && fscanf(fp, "%u", &ms) == 1; i++) {
+            if (be) {
+                hedge_record(be, ms);
+            }
+        }
+    }
+    fclose(fp);
+    hedge.dirty = false;
+}
+
+
+static void hedge_save_stats(void)
+{
+    const struct hedge_backend *be;
+    char path[260], tmp[270];
+    unsigned i, first;
+    int j;
+    FILE *fp;
+
+    if (!hedge.dirty || cache_auxpath(path, sizeof path, HEDGE_STATS)) {
+        return;
+    }
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        return;
+    }
+    for (j = 0; j < hedge.count; j++) {
+        be = &hedge.be[j];
+        first = (be->head + HEDGE_SAMPLES - be->nsample) % HEDGE_SAMPLES;
+        fprintf(fp, "%s %u", be->root, be->nsample);
+        for (i = 0; i < be->nsample; i++) {
+            fprintf(fp, " %u", be->sample[(first + i) % HEDGE_SAMPLES]);
+        }
+        fputc('\n', fp);
+    }
+    if (fclose(fp) || rename(tmp, path)) {
+        remove(tmp);
+    }
+    hedge.dirty = false;
+}
+
+
+static int hedge_init(void)
+{
+    const char *const *roots;
+    int i;
+
+    if (hedge.multi) {
+        return 0;
+    }
+    if (curlfn_load()) {
+        return 1;
+    }
+    hedge.multi = curl_multi_init();
+    if (!hedge.multi) {
+        dict_logs(DICT_ERROR, "Could not initialize curl");
+        return 1;
+    }
+    hedge.count = net_backends(&roots);
+    for (i = 0; i < hedge.count; i++) {
+        hedge.be[i].root = roots[i];
+        hedge.be[i].hcurl = curl_easy_init();
+        if (!hedge.be[i].hcurl) {
+            dict_logs(DICT_ERROR, "Could not initialize curl");
+            hedge_cleanup();
+            return 1;
+        }
+        curl_easy_setopt(hedge.be[i].hcurl, CURLOPT_PRIVATE, &hedge.be[i]);
+        net_tune(hedge.be[i].hcurl);
+    }
+    hedge_load_stats();
+    return 0;
+}
+
+
+void hedge_cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < hedge.count; i++) {
+        if (hedge.be[i].hcurl) {
+            curl_multi_remove_handle(hedge.multi, hedge.be[i].hcurl);
+            curl_easy_cleanup(hedge.be[i].hcurl);
+        }
+        net_buf_free(&hedge.be[i].buf);
+    }
+    if (hedge.multi) {
+        curl_multi_cleanup(hedge.multi);
+    }
+    memset(&hedge, 0, sizeof hedge);
+}
+
+
+/** @brief Starts fetching @p word from @p be, to be finished, DNS and connect
+ *      included, within @p left seconds
+ */
+static int hedge_start(struct hedge_backend *be, const char *word, double left)
+{
+    if (net_prepare_at(be->hcurl, be->root, word, &be->buf)) {
+        be->result = CURLE_URL_MALFORMAT;
+        return 1;
+    }
+    curl_easy_setopt(be->hcurl, CURLOPT_TIMEOUT_MS, (long)(left * 1000) + 1);
+    be->timed = false;
+    be->started = hedge_now();
+    be->status = 0;
+    be->retry_after = 0;
+    be->result = curl_multi_add_handle(hedge.multi, be->hcurl) ? CURLE_FAILED_INIT : CURLE_OK;
+    be->running = be->result == CURLE_OK;
+    TRACE(HEDGE_START, NULL, be - hedge.be, 0);
+    return !be->running;
+}
+
+
+/** @brief Samples @p be's first-byte latency, once it has one
+ *  @returns Nonzero if the first byte has arrived
+ */
+static int hedge_sample(struct hedge_backend *be)
+{
+    curl_off_t us = 0;
+
+    if (!be->timed) {
+        curl_easy_getinfo(be->hcurl, CURLINFO_STARTTRANSFER_TIME_T, &us);
+        if (us > 0) {
+            hedge_record(be, (unsigned)((us + 999) / 1000));
+            TRACE(HEDGE_BYTE, NULL, be - hedge.be, (us + 999) / 1000);
+            be->timed = true;
+        }
+    }
+    return be->timed;
+}
+
+
+/** @brief Samples a transfer that timed out or was abandoned before its first
+ *      byte. How long it ran is only a lower bound on its latency, but leaving
+ *      it out would hide exactly the stalls hedging is for
+ */
+static void hedge_censor(struct hedge_backend *be)
+{
+    unsigned ms;
+
+    if (!hedge_sample(be)) {
+        ms = (unsigned)((hedge_now() - be->started) * 1000) + 1;
+        hedge_record(be, ms);
+        TRACE(HEDGE_STALL, NULL, be - hedge.be, ms);
+        be->timed = true;
+    }
+}
+
+
+/** @brief Collects a finished transfer
+ *  @returns Nonzero if its reply can be used
+ */
+static int hedge_finish(struct hedge_backend *be, CURLcode result)
+{
+    curl_off_t after = 0;
+
+    curl_multi_remove_handle(hedge.multi, be->hcurl);
+    be->running = false;
+    be->result = result;
+    if (be == &hedge.be[0]) {
+        net_learn(be->hcurl, result);
+    }
+    if (result == CURLE_OPERATION_TIMEDOUT) {
+        hedge_censor(be);
+    }
+    if (result) {
+        return 0;
+    }
+    hedge_sample(be);
+    curl_easy_getinfo(be->hcurl, CURLINFO_RESPONSE_CODE, &be->status);
+    curl_easy_getinfo(be->hcurl, CURLINFO_RETRY_AFTER, &after);
+    be->retry_after = (long)after;
+    TRACE(HEDGE_DONE, NULL, be - hedge.be, be->status);
+    return be->status < 500 && be->status != 429;
+}
+
+
+int hedge_fetch(const char *word, struct hedge_reply *rep)
+{
+    struct hedge_backend *be, *winner = NULL, *last = NULL;
+    int launched = 0, pending = 0, running, queued, timeout, i;
+    bool first = false, late = false;
+    double now, next = 0, end;
+    CURLMsg *msg;
+
+    memset(rep, 0, sizeof *rep);
+    rep->result = CURLE_FAILED_INIT;
+    if (hedge_init()) {
+        return 1;
+    }
+    end = hedge_now() + ((hedge.deadline) ? hedge.deadline : HEDGE_DEADLINE) / 1000.0;
+    while (!winner) {
+        now = hedge_now();
+        if (now >= end) {
+            late = true;
+            break;
+        } else if (launched < hedge.count && (!pending || (!first && now >= next))) {
+            be = &hedge.be[launched++];
+            if (!hedge_start(be, word, end - now)) {
+                next = now + hedge_delay(be);
+                pending++;
+            } else {
+                last = be;
+            }
+            continue;
+        } else if (!pending) {
+            break;
+        }
+        curl_multi_perform(hedge.multi, &running);
+        for (i = 0; i < launched; i++) {
+            if (hedge.be[i].running && hedge_sample(&hedge.be[i])) {
+                first = true;
+            }
+        }
+        while (!winner && (msg = curl_multi_info_read(hedge.multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE) {
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&be);
+                pending--;
+                if (hedge_finish(be, msg->data.result)) {
+                    winner = be;
+                } else {
+                    last = be;
+                }
+            }
+        }
+        if (!winner) {
+            timeout = 1000;
+            if (!first && launched < hedge.count) {
+                timeout = (next > now) ? (int)((next - now) * 1000) + 1 : 1;
+                timeout = (timeout > 1000) ? 1000 : timeout;
+            }
+            if (timeout > (int)((end - now) * 1000) + 1) {
+                timeout = (int)((end - now) * 1000) + 1;
+            }
+            curl_multi_poll(hedge.multi, NULL, 0, timeout, NULL);
+        }
+    }
+    for (i = 0; i < launched; i++) {
+        if (hedge.be[i].running) {
+            hedge_censor(&hedge.be[i]);
+            curl_multi_remove_handle(hedge.multi, hedge.be[i].hcurl);
+            hedge.be[i].running = false;
+        }
+    }
+    hedge_save_stats();
+    be = (winner) ? winner : last;
+    if (be) {
+        rep->body = &be->buf;
+        rep->backend = be->root;
+        rep->result = be->result;
+        rep->status = be->status;
+        rep->retry_after = be->retry_after;
+    }
+    if (late) {
+        rep->result = CURLE_OPERATION_TIMEDOUT;
+    }
+    return winner == NULL;
+}
+
+
+void hedge_deadline(unsigned ms)
+{
+    hedge.deadline = ms;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#ifndef DICT_HEDGE_H
+#define DICT_HEDGE_H
+
+#include "net.h"
+
+/** Default budget for a whole fetch, hedges included, in milliseconds */
+#define HEDGE_DEADLINE 4000
+
+
+struct hedge_reply {
+    const struct net_buf *body;     /* Valid until the next hedge_fetch */
+    const char           *backend;  /* API root that answered */
+    CURLcode              result;
+    long                  status;
+    long                  retry_after;
+};
+
+
+/** @brief Fetches the entry for @p word from the configured backends. The
+ *      primary is asked first; if it has not sent its first byte within the
+ *      95th percentile of its recent first-byte latencies, the same request is
+ *      sent to the next backend, and so on. The first usable reply wins and
+ *      the others are cancelled
+ *  @param[out] rep
+ *      The winning reply or, if every backend failed, the last failure
+ *  @returns Nonzero if no backend produced a usable reply
+ */
+int hedge_fetch(const char *word, struct hedge_reply *rep);
+
+
+/** @brief Sets how long each hedge_fetch may take in all, in milliseconds,
+ *      from resolving the backends' names to the end of the reply. Transfers
+ *      still running then are abandoned and the fetch fails with
+ *      CURLE_OPERATION_TIMEDOUT. Zero restores HEDGE_DEADLINE
+ */
+void hedge_deadline(unsigned ms);
+
+
+/** @brief Releases the handles kept open between fetches */
+void hedge_cleanup(void);
+
+
+#endif /* DICT_HEDGE_H */
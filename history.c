@@ -0,0 +1,443 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <json-c/json.h>
+
+#include "history.h"
+#include "cache.h"
+#include "hedge.h"
+#include "json.h"
+#include "key.h"
+#include "rate.h"
+#include "warm.h"
+
+/** Every query, one per line: seconds since the epoch, a space, then the key.
+ *  Lines are appended with a single write, so concurrent processes do not
+ *  interleave them
+ */
+#define HISTORY_FILE "history"
+
+/** Held by the running prefetcher. Its contents record when one last ran */
+#define HISTORY_LOCK "prefetch"
+
+/** Once the history grows past this many bytes, the older half is dropped */
+#define HISTORY_MAX (256 * 1024)
+
+/** The most distinct words mined from the history. Must be a power of two */
+#define HISTORY_WORDS 4096
+
+/** Queries older than this are ignored */
+#define HISTORY_SPAN (90 * 86400)
+
+/** A query counts half as much as a new one once it is this old */
+#define HISTORY_HALFLIFE (7 * 86400.0)
+
+/** A query made within this many seconds of another is taken to follow it */
+#define HISTORY_PAIR 300
+
+/** A word must have been asked for this many times to be worth keeping */
+#define HISTORY_REPEAT 2
+
+/** Budget of a single prefetcher run. Requests are not sent once either is
+ *  spent, so at most one reply's worth of bytes goes over
+ */
+#define PREFETCH_REQUESTS 8
+#define PREFETCH_BYTES    (256 * 1024)
+
+/** Minimum seconds between prefetcher runs */
+#define PREFETCH_INTERVAL 600
+
+/** Entries at risk of eviction are fetched again if older than this, and only
+ *  touched otherwise
+ */
+#define PREFETCH_STALE (30 * 86400)
+
+/** How many evictions ahead an entry counts as at risk */
+#define PREFETCH_RISK 20
+
+/** Added to the prefetcher's nice value */
+#define PREFETCH_NICE 10
+
+
+struct history_word {
+    const char *word;       /* Points into the loaded history */
+    double      score;      /* Queries, each weighed by how recent it is */
+    unsigned    count;
+    unsigned    follows;    /* Times this came soon after the latest query */
+    bool        missing;    /* The API has no entry for it */
+};
+
+
+struct history_job {
+    const char *word;
+    double      rank;
+    int         tier;       /* Jobs in higher tiers are sent first */
+};
+
+
+static struct {
+    char last[KEY_MAXLEN];  /* The latest query this process made */
+
+    struct history_word *tab;
+    size_t               count;
+    char                *text;
+} hist = { 0 };
+
+
+void history_record(const char *word)
+{
+    char path[260], line[32 + KEY_MAXLEN];
+    int fd, len;
+
+    snprintf(hist.last, sizeof hist.last, "%s", word);
+    if (cache_auxpath(path, sizeof path, HISTORY_FILE)) {
+        return;
+    }
+    len = snprintf(line, sizeof line, "%lld %s\n", (long long)time(NULL), word);
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd != -1) {
+        if (write(fd, line, len) != len) {
+            /* The history is only advisory */
+        }
+        close(fd);
+    }
+}
+
+
+/** @brief Finds the slot for @p word, claiming an empty one if @p create is set
+ *      and the table has room
+ *  @returns The slot, or NULL
+ */
+static struct history_word *history_find(const char *word, bool create)
+{
+    size_t i, mask = HISTORY_WORDS - 1;
+
+    for (i = key_hash(word) & mask; hist.tab[i].word; i = (i + 1) & mask) {
+        if (!strcmp(hist.tab[i].word, word)) {
+            return &hist.tab[i];
+        }
+    }
+    if (!create || hist.count >= HISTORY_WORDS / 4 * 3) {
+        return NULL;
+    }
+    hist.count++;
+    hist.tab[i].word = word;
+    return &hist.tab[i];
+}
+
+
+/** @brief Reads the history into memory. If it has grown too large, only the
+ *      newer half is kept, both on disk and in memory. Queries recorded while
+ *      this happens may be lost
+ *  @returns The length of the text, or zero if there is none
+ */
+static size_t history_load(void)
+{
+    char path[260], tmp[260];
+    struct stat sbuf;
+    size_t len = 0;
+    char *cut;
+    FILE *fp;
+    bool ok;
+
+    if (cache_auxpath(path, sizeof path, HISTORY_FILE)
+     || cache_auxpath(tmp, sizeof tmp, HISTORY_FILE ".tmp")) {
+        return 0;
+    }
+    fp = fopen(path, "r");
+    if (!fp) {
+        return 0;
+    }
+    if (!fstat(fileno(fp), &sbuf) && sbuf.st_size > 0) {
+        hist.text = malloc(sbuf.st_size + 1);
+        if (hist.text) {
+            len = fread(hist.text, 1, sbuf.st_size, fp);
+            hist.text[len] = '\0';
+        }
+    }
+    fclose(fp);
+    if (len > HISTORY_MAX && (cut = strchr(hist.text + len / 2, '\n'))) {
+        cut++;
+        len -= cut - hist.text;
+        memmove(hist.text, cut, len + 1);
+        fp = fopen(tmp, "w");
+        if (fp) {
+            ok = fwrite(hist.text, 1, len, fp) == len;
+            if (fclose(fp) || !ok || rename(tmp, path)) {
+                remove(tmp);
+            }
+        }
+    }
+    return len;
+}
+
+
+/** @brief Marks the words that the API is known to have no entry for */
+static void history_mark_missing(void)
+{
+    struct history_word *ent;
+    char path[260], *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    FILE *fp;
+
+    if (cache_auxpath(path, sizeof path, WARM_MISSING)) {
+        return;
+    }
+    fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    while ((len = getline(&line, &cap, fp)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        ent = history_find(line, false);
+        if (ent) {
+            ent->missing = true;
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+
+/** @brief Tallies each query in the history: how often and how recently every
+ *      word was asked for, and how often it was asked for right after the
+ *      latest query of this process
+ *  @returns Nonzero if there is nothing to go on
+ */
+static int history_mine(time_t now)
+{
+    const char *prev = NULL, *word;
+    struct history_word *ent;
+    time_t when, prevwhen = 0;
+    char *line, *nl, *end;
+    size_t len;
+
+    len = history_load();
+    hist.tab = calloc(HISTORY_WORDS, sizeof *hist.tab);
+    if (!len || !hist.tab) {
+        return 1;
+    }
+    end = hist.text + len;
+    for (line = hist.text; line < end && (nl = strchr(line, '\n')); line = nl + 1) {
+        *nl = '\0';
+        when = strtoll(line, (char **)&word, 10);
+        if (word == line || *word++ != ' ' || !*word) {
+            continue;
+        } else if (now - when <= HISTORY_SPAN && (ent = history_find(word, true))) {
+            ent->score += HISTORY_HALFLIFE / (HISTORY_HALFLIFE + (now - when));
+            ent->count++;
+            if (prev && !strcmp(prev, hist.last) && strcmp(word, hist.last)
+             && when - prevwhen <= HISTORY_PAIR) {
+                ent->follows++;
+            }
+        }
+        prev = word;
+        prevwhen = when;
+    }
+    history_mark_missing();
+    return 0;
+}
+
+
+static int history_jobcmp(const void *a, const void *b)
+{
+    const struct history_job *x = a, *y = b;
+
+    if (x->tier != y->tier) {
+        return y->tier - x->tier;
+    }
+    return (x->rank < y->rank) - (x->rank > y->rank);
+}
+
+
+/** @brief Decides what @p ent deserves. Words that usually follow the latest
+ *      query, and frequent words that have been evicted, are fetched; the
+ *      latter only while the cache has room for them. Frequent words about to
+ *      be evicted are touched, or fetched again if stale
+ *  @returns true if @p job should be fetched
+ */
+static bool history_plan(const struct history_word *ent,
+                         time_t                     now,
+                         time_t                     horizon,
+                         struct history_job        *job)
+{
+    static char buf[65536];
+    time_t atime, fetched;
+    size_t len;
+
+    if (ent->missing) {
+        return false;
+    }
+    job->word = ent->word;
+    if (ent->follows >= HISTORY_REPEAT && !cache_contains(ent->word)) {
+        job->tier = 2;
+        job->rank = ent->follows;
+        return true;
+    } else if (ent->count < HISTORY_REPEAT) {
+        return false;
+    } else if (!cache_contains(ent->word)) {
+        job->tier = 1;
+        job->rank = ent->score;
+        return true;
+    } else if (!horizon || cache_stat(ent->word, &atime, &fetched) || atime > horizon) {
+        return false;
+    } else if (now - fetched > PREFETCH_STALE) {
+        job->tier = 0;
+        job->rank = ent->score;
+        return true;
+    }
+    len = sizeof buf;
+    cache_lookup(ent->word, buf, &len);
+    return false;
+}
+
+
+/** @brief Fetches @p word into the cache, adding the size of the reply to
+ *      @p bytes
+ *  @returns Nonzero if the run should stop: the limiter has no token to spare,
+ *      the server is pushing back, or the network is unusable
+ */
+static int history_fetch(const char *word, size_t *bytes)
+{
+    struct json_object *json;
+    struct hedge_reply rep;
+    char path[260];
+    FILE *fp;
+
+    if (rate_take() > 0) {
+        return 1;
+    }
+    hedge_fetch(word, &rep);
+    rate_feedback((rep.result) ? 0 : rep.status, rep.retry_after);
+    if (rep.result || rate_throttled(rep.status)) {
+        return 1;
+    }
+    *bytes += rep.body->len;
+    if (rep.status == 404) {
+        if (!cache_auxpath(path, sizeof path, WARM_MISSING) && (fp = fopen(path, "a"))) {
+            fprintf(fp, "%s\n", word);
+            fclose(fp);
+        }
+        return 0;
+    }
+    json = dict_parse_JSON(rep.body->data, rep.body->data + rep.body->len);
+    if (rep.status == 200 && json_object_get_type(json) == json_type_array) {
+        cache_write(word, rep.body->data, &rep.body->val);
+    }
+    json_object_put(json);
+    return 0;
+}
+
+
+/** @brief Plans and carries out a prefetcher run within its budget */
+static void history_run(time_t now)
+{
+    struct history_job *jobs;
+    size_t i, njob = 0, bytes = 0;
+    unsigned sent = 0;
+    time_t horizon;
+
+    jobs = malloc(hist.count * sizeof *jobs);
+    if (!jobs) {
+        return;
+    }
+    horizon = cache_horizon(PREFETCH_RISK);
+    for (i = 0; i < HISTORY_WORDS; i++) {
+        if (hist.tab[i].word && history_plan(&hist.tab[i], now, horizon, &jobs[njob])) {
+            njob++;
+        }
+    }
+    qsort(jobs, njob, sizeof *jobs, history_jobcmp);
+    if (njob && !curlfn_load()) {
+        rate_init();
+        for (i = 0; i < njob && sent < PREFETCH_REQUESTS && bytes < PREFETCH_BYTES; i++) {
+            if (jobs[i].tier == 1 && cache_horizon(1)) {
+                continue;   /* Only bring evicted words back into free room */
+            } else if (history_fetch(jobs[i].word, &bytes)) {
+                break;
+            }
+            sent++;
+        }
+        hedge_cleanup();
+    }
+    free(jobs);
+}
+
+
+/** @brief Takes the prefetcher lock, provided no other process holds it and
+ *      the last run was long enough ago
+ *  @returns Nonzero if this process should not run
+ */
+static int history_lock(time_t now)
+{
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    char path[260], stamp[32];
+    struct stat sbuf;
+    int fd, len;
+
+    if (cache_auxpath(path, sizeof path, HISTORY_LOCK)) {
+        return 1;
+    }
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        return 1;
+    } else if (fcntl(fd, F_SETLK, &fl) == -1 || fstat(fd, &sbuf)
+            || (sbuf.st_size && now - sbuf.st_mtime < PREFETCH_INTERVAL)) {
+        close(fd);
+        return 1;
+    }
+    /* The descriptor stays open, and the lock held, until the process exits */
+    len = snprintf(stamp, sizeof stamp, "%lld\n", (long long)now);
+    return ftruncate(fd, 0) || pwrite(fd, stamp, len, 0) != len;
+}
+
+
+/** @brief Body of the prefetcher process. Never returns */
+static void history_child(void)
+{
+    time_t now = time(NULL);
+    int fd;
+
+    setsid();
+    fd = open("/dev/null", O_RDWR);
+    if (fd != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO) {
+            close(fd);
+        }
+    }
+    if (nice(PREFETCH_NICE) == -1) {
+        /* Run anyway */
+    }
+    if (!history_lock(now) && !history_mine(now)) {
+        history_run(now);
+    }
+    _exit(0);
+}
+
+
+void history_prefetch(void)
+{
+    const char *env;
+
+    env = getenv("DICT_PREFETCH");
+    if (!hist.last[0] || (env && !strcmp(env, "0"))) {
+        return;
+    }
+    fflush(NULL);
+    if (fork() == 0) {
+        history_child();
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#ifndef DICT_HISTORY_H
+#define DICT_HISTORY_H
+
+
+/** @brief Appends @p word to the query history, with the current time
+ *  @param word
+ *      Canonical key of the word, from key_canon
+ */
+void history_record(const char *word);
+
+
+/** @brief If this process recorded a query, starts a detached, low-priority
+ *      process that mines the history and spends a small request and byte
+ *      budget keeping the words it predicts will be asked for again in the
+ *      cache. It returns at once. Set DICT_PREFETCH=0 to disable this
+ */
+void history_prefetch(void);
+
+
+#endif /* DICT_HISTORY_H */
@@ -0,0 +1,317 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hot.h"
+#include "key.h"
+#include "log.h"
+#include "trace.h"
+
+/** Identifies the segment layout. Change it whenever the layout changes, so
+ *  that processes from an older build rebuild the segment instead of reading it
+ */
+#define HOT_MAGIC 0x32544f4854434944ULL
+
+/** Geometry of the table. Most replies are one or two kilobytes */
+#define HOT_SLOTS   512
+#define HOT_DATALEN 8192
+
+/** The number of slots an entry may occupy, starting at its hash */
+#define HOT_WAYS 4
+
+/** Seconds between refreshes of the access time on disk of an entry that is
+ *  only being read from here
+ */
+#define HOT_TOUCH 60
+
+
+/** A slot is guarded by a sequence lock. @c seq is odd while a writer is
+ *  inside, and readers retry nothing: a slot that is odd, or whose @c seq
+ *  changed during the copy, is simply a miss
+ */
+struct hot_slot {
+    uint32_t seq;
+    int32_t  owner;     /* Pid of the writer, to recover from its crash */
+    uint64_t stamp;     /* When this was stored, for replacement */
+    uint64_t sum;       /* FNV-1a of the key and data */
+    int64_t  touched;   /* When the entry on disk was last read or touched */
+    uint32_t len;       /* Zero if the slot is empty */
+    char     key[KEY_MAXLEN];
+    char     data[HOT_DATALEN];
+};
+
+
+struct hot_segment {
+    uint64_t magic;
+    uint32_t slots;
+    uint32_t datalen;
+    uint64_t clock;     /* Source of slot stamps */
+    struct hot_slot slot[HOT_SLOTS];
+};
+
+
+static struct {
+    struct hot_segment *seg;
+    bool                tried;
+} hot = { 0 };
+
+
+static uint64_t hot_sum(const char *key, const char *data, size_t len)
+{
+    uint64_t hash = key_hash(key);
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+
+/** @brief Checks that a segment mapped from a previous run has our layout */
+static bool hot_valid(const struct hot_segment *seg)
+{
+    return __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) == HOT_MAGIC
+        && seg->slots == HOT_SLOTS && seg->datalen == HOT_DATALEN;
+}
+
+
+/** @brief Opens and maps the segment, creating it if need be. A new segment is
+ *      all zeros, which is already a valid empty table, so creation only has
+ *      to publish the header. A segment with some other layout is unlinked and
+ *      replaced; processes still using it keep their mapping until they exit
+ */
+static struct hot_segment *hot_map(const char *name, bool retry)
+{
+    struct hot_segment *seg;
+    uint64_t zero = 0;
+    struct stat sbuf;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        dict_perror("Cannot open shared hot cache");
+        return NULL;
+    }
+    if (fstat(fd, &sbuf) || (sbuf.st_size < (off_t)sizeof *seg && ftruncate(fd, sizeof *seg))) {
+        dict_perror("Cannot size shared hot cache");
+        close(fd);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof *seg, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        dict_perror("Cannot map shared hot cache");
+        return NULL;
+    }
+    if (!__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE)) {
+        /* New, or its creator died before publishing it. Either way every
+        slot is still zero, so anyone may publish it */
+        seg->slots = HOT_SLOTS;
+        seg->datalen = HOT_DATALEN;
+        __atomic_compare_exchange_n(&seg->magic, &zero, HOT_MAGIC, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+    if (!hot_valid(seg)) {
+        munmap(seg, sizeof *seg);
+        if (retry && !shm_unlink(name)) {
+            return hot_map(name, false);
+        }
+        return NULL;
+    }
+    return seg;
+}
+
+
+/** @brief Attaches to this user's segment the first time it is needed, if the
+ *      hot cache is enabled
+ */
+static struct hot_segment *hot_attach(void)
+{
+    char name[64];
+    const char *env;
+
+    if (!hot.tried) {
+        hot.tried = true;
+        env = getenv("DICT_SHM");
+        if (env && *env && strcmp(env, "0")) {
+            snprintf(name, sizeof name, "/dict-hot-%lu", (unsigned long)getuid());
+            hot.seg = hot_map(name, true);
+        }
+    }
+    return hot.seg;
+}
+
+
+static struct hot_slot *hot_slot(struct hot_segment *seg, const char *word, unsigned way)
+{
+    return &seg->slot[(key_hash(word) + way) % HOT_SLOTS];
+}
+
+
+/** @brief Copies @p slot out if it holds @p word and is consistent */
+static bool hot_read(struct hot_slot *slot, const char *word, char *buf, size_t *len)
+{
+    uint32_t seq, n;
+    uint64_t sum;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return false;
+    }
+    n = slot->len;
+    if (!n || n > HOT_DATALEN || n > *len || strncmp(slot->key, word, KEY_MAXLEN)) {
+        return false;
+    }
+    memcpy(buf, slot->data, n);
+    sum = slot->sum;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq || sum != hot_sum(word, buf, n)) {
+        return false;
+    }
+    *len = n;
+    return true;
+}
+
+
+/** @brief Claims the refresh of the entry on disk behind @p slot, if none was
+ *      done in the last HOT_TOUCH seconds. Only one process wins each claim
+ */
+static bool hot_due(struct hot_slot *slot)
+{
+    int64_t now = time(NULL), then;
+
+    then = __atomic_load_n(&slot->touched, __ATOMIC_RELAXED);
+    return now - then >= HOT_TOUCH
+        && __atomic_compare_exchange_n(&slot->touched, &then, now, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+bool hot_get(const char *word, char *buf, size_t *len, bool *stale)
+{
+    struct hot_segment *seg;
+    struct hot_slot *slot;
+    unsigned way;
+
+    seg = hot_attach();
+    if (!seg) {
+        return false;
+    }
+    for (way = 0; way < HOT_WAYS; way++) {
+        TRACE(HOT_PROBE, word, way, 0);
+        slot = hot_slot(seg, word, way);
+        if (hot_read(slot, word, buf, len)) {
+            TRACE(HOT_HIT, word, *len, 0);
+            *stale = hot_due(slot);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** @brief Enters @p slot as its writer. A slot left odd by a writer that no
+ *      longer exists is taken over
+ *  @returns Nonzero if another live process is writing it
+ */
+static int hot_lock(struct hot_slot *slot)
+{
+    uint32_t seq;
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) && slot->owner > 0 && !(kill(slot->owner, 0) && errno == ESRCH)) {
+        return 1;
+    }
+    /* From even to odd, or from a dead writer's odd to the next odd */
+    if (!__atomic_compare_exchange_n(&slot->seq, &seq, seq + ((seq & 1) ? 2 : 1), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    if (seq & 1) {
+        TRACE(HOT_RECLAIM, NULL, slot - hot.seg->slot, slot->owner);
+    }
+    slot->owner = getpid();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+
+static void hot_unlock(struct hot_slot *slot)
+{
+    __atomic_fetch_add(&slot->seq, 1, __ATOMIC_RELEASE);
+}
+
+
+/** @brief Chooses the slot to store @p word in: the one already holding it,
+ *      else an empty one, else the one stored longest ago
+ */
+static struct hot_slot *hot_victim(struct hot_segment *seg, const char *word)
+{
+    struct hot_slot *slot, *victim = NULL;
+    unsigned way;
+
+    for (way = 0; way < HOT_WAYS; way++) {
+        slot = hot_slot(seg, word, way);
+        if (slot->len && !strncmp(slot->key, word, KEY_MAXLEN)) {
+            return slot;
+        } else if (!victim || (victim->len && (!slot->len || slot->stamp < victim->stamp))) {
+            victim = slot;
+        }
+    }
+    return victim;
+}
+
+
+void hot_put(const char *word, const char *reply, size_t len)
+{
+    struct hot_segment *seg;
+    struct hot_slot *slot;
+
+    seg = hot_attach();
+    if (!seg || !len || len > HOT_DATALEN || strlen(word) >= KEY_MAXLEN) {
+        return;
+    }
+    slot = hot_victim(seg, word);
+    if (hot_lock(slot)) {
+        return;
+    }
+    strcpy(slot->key, word);
+    memcpy(slot->data, reply, len);
+    slot->len = len;
+    slot->sum = hot_sum(word, reply, len);
+    __atomic_store_n(&slot->touched, (int64_t)time(NULL), __ATOMIC_RELAXED);
+    slot->stamp = __atomic_add_fetch(&seg->clock, 1, __ATOMIC_RELAXED);
+    hot_unlock(slot);
+    TRACE(HOT_PUT, word, len, 0);
+}
+
+
+void hot_drop(const char *word)
+{
+    struct hot_segment *seg;
+    struct hot_slot *slot;
+    unsigned way;
+
+    seg = hot_attach();
+    if (!seg) {
+        return;
+    }
+    for (way = 0; way < HOT_WAYS; way++) {
+        slot = hot_slot(seg, word, way);
+        if (slot->len && !strncmp(slot->key, word, KEY_MAXLEN) && !hot_lock(slot)) {
+            slot->len = 0;
+            hot_unlock(slot);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef DICT_HOT_H
+#define DICT_HOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** @brief Looks @p word up in the hot cache shared by this user's concurrent
+ *      processes. The hot cache is a POSIX shared memory segment, used only if
+ *      DICT_SHM is set. Readers take no locks and do no file I/O; a slot that
+ *      changes while it is being read, or fails its checksum, is a miss
+ *  @param[out] buf
+ *      Buffer to copy the reply to
+ *  @param[in,out] len
+ *      On input, the size of @p buf. On output, the length of the reply
+ *  @param[out] stale
+ *      On a hit, set if the entry on disk has not had its access time
+ *      refreshed for a while, which the caller should then do. Hits here never
+ *      read it, so would otherwise leave it to be evicted
+ *  @returns true on a hit
+ */
+bool hot_get(const char *word, char *buf, size_t *len, bool *stale);
+
+
+/** @brief Stores @p reply for @p word in the hot cache, replacing the least
+ *      recently stored entry it may go in. Replies too large for a slot, and
+ *      slots another live process is writing, are skipped
+ */
+void hot_put(const char *word, const char *reply, size_t len);
+
+
+/** @brief Removes @p word from the hot cache */
+void hot_drop(const char *word);
+
+
+#endif /* DICT_HOT_H */
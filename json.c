@@ -1,13 +1,15 @@
 #include <assert.h>
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <json-c/json.h>
 
 #include "json.h"
 #include "color.h"
+#include "page.h"
+#include "wrap.h"
 
 #define DICT_WORD        "word"
 #define DICT_PHONETIC    "phonetic"
@@ -20,72 +22,27 @@
 #define DICT_SYNONYMS    "synonyms"
 #define DICT_ANTONYMS    "antonyms"
 
-/** No line shall overrun this maximum length (except the part of speech, whose
- *  length remains inauspiciously unchecked)
- */
-#define JSON_MAXCOLUMNS 80
-
 #define INDENT_PRTOFSPCH    " "
 #define INDENT_ANT_SYN      "      "
 
 
-static int json_maxcolumns(void)
-{
-    return JSON_MAXCOLUMNS;
-}
+static struct {
+    FILE    *out;       /* Where the entry is rendered to */
+    unsigned brief;     /* Definitions shown per part of speech, or 0 for all */
+    bool     page;
+} render = { 0 };
 
 
-/** @brief Trim prefixed whitespace from @p nptr
- *  @returns A pointer to the first non-whitespace char after @p nptr
+/** @brief No line shall overrun this width (except the part of speech, whose
+ *  length remains inauspiciously unchecked). This is the terminal's width
  */
-static const char *json_ltrim(const char *nptr)
-{
-    while (isspace(*nptr)) {
-        nptr++;
-    }
-    return nptr;
-}
-
-
-/** @brief Trim prefixed whitespace from @p nptr, then finds the first
- *      whitespace/nul character thereafter
- *  @returns A pointer to the first character of the next word, or the nul term
- */
-static const char *json_wordboundary(const char *nptr)
-{
-    nptr = json_ltrim(nptr);
-    while (*nptr && !isspace(*nptr)) {
-        nptr++;
-    }
-    return nptr;
-}
-
-
-/** @brief Print words until the next word would overflow @p width
- *  @param nptr
- *      String to be printed
- *  @param width
- *      Maximum number of columns allowed to print before a line break is
- *      required
- *  @returns The first nonwhitespace char not printed
- */
-static const char *json_print_clipped(const char *nptr, int width)
+static int json_maxcolumns(void)
 {
-    const char *end, *next;
-
-    next = json_wordboundary(nptr);
-    do {
-        end = next;
-        next = json_wordboundary(next);
-    } while (*end && next - nptr <= width);
-    fwrite(nptr, 1, end - nptr, stdout);
-    putchar('\n');
-    return json_ltrim(end);
+    return wrap_columns();
 }
 
 
-/** @brief Print itemized definition without exceeding column width determined
- *      at compile time
+/** @brief Print itemized definition without exceeding the terminal width
  *  @param def
  *      Definition string. The first line of this definition will be prefixed
  *      with a single hyphen '-'. Indented six characters
@@ -96,12 +53,8 @@ static void json_print_def(const char *def)
     int clipwidth;
 
     clipwidth = json_maxcolumns() - (sizeof bullet - 1);
-    fputs(bullet, stdout);
-    def = json_print_clipped(def, clipwidth);
-    while (*def) {
-        fputs(indent, stdout);
-        def = json_print_clipped(def, clipwidth);
-    }
+    fputs(bullet, render.out);
+    wrap_print(render.out, def, clipwidth, indent);
 }
 
 
@@ -127,19 +80,19 @@ static void json_commalist_print_word(const char *word,
     int len;
 
     /* The comma must be attached to the word */
-    len = (int)strlen(word) + (int)comma;
+    len = wrap_width(word) + (int)comma;
     if (len > *space) {
-        printf("\n%*s", indent, "");
+        fprintf(render.out, "\n%*s", indent, "");
         *space = json_maxcolumns() - indent;
     }
     *space -= len;
     //assert(*space >= 0);    /* Indent is too large */
-    fputs(word, stdout);
+    fputs(word, render.out);
     if (comma) {
-        putchar(',');
+        fputc(',', render.out);
         if (*space > 0) {
             *space -= 1;
-            putchar(' ');
+            fputc(' ', render.out);
         }
     }
 }
@@ -182,10 +135,11 @@ static int json_print_commalist(struct json_object *arr,
 
     N = json_object_array_length(arr);
     if (N) {
-        color_send(stdout, colr | COLOR_BOLD);
-        printf("%s: %n", head, &indent);
-        color_reset(stdout);
-        color_send(stdout, colr);
+        color_send(render.out, colr | COLOR_BOLD);
+        fprintf(render.out, "%s: ", head);
+        indent = wrap_width(head) + 2;
+        color_reset(render.out);
+        color_send(render.out, colr);
         space = json_maxcolumns() - indent;
         do {
             N--;
@@ -195,12 +149,13 @@ static int json_print_commalist(struct json_object *arr,
                 res++;
             }
         } while (N);
-        color_reset(stdout);
-        putchar('\n');
+        color_reset(render.out);
+        fputc('\n', render.out);
     } else if (always) {
-        color_send(stdout, colr | COLOR_BOLD);
-        puts(head);
-        color_reset(stdout);
+        color_send(render.out, colr | COLOR_BOLD);
+        fputs(head, render.out);
+        fputc('\n', render.out);
+        color_reset(render.out);
     }
     return res;
 }
@@ -228,25 +183,20 @@ static int json_print_antonyms(struct json_object *ant, int indent)
 }
 
 
-/** @brief Print all definitions under this category in itemized format
- *  @returns The number of synonyms and antonyms found under "definitions"
+/** @brief Print one itemized definition with its synonyms and antonyms
+ *  @returns The number of synonyms and antonyms printed
  */
-static int json_print_definitions(struct json_object *defs)
+static int json_print_sense(struct json_object *def)
 {
-    struct json_object *def, *val;
+    struct json_object *val;
     int nsynant = 0;
-    size_t N, i;
 
-    N = json_object_array_length(defs);
-    for (i = 0; i < N; i++) {
-        def = json_object_array_get_idx(defs, i);
-        json_object_object_get_ex(def, DICT_DEFINITION, &val);
-        json_print_def(json_object_get_string(val));
-        json_object_object_get_ex(def, DICT_SYNONYMS, &val);
-        nsynant += json_print_synonyms(val, 6);
-        json_object_object_get_ex(def, DICT_ANTONYMS, &val);
-        nsynant += json_print_antonyms(val, 6);
-    }
+    json_object_object_get_ex(def, DICT_DEFINITION, &val);
+    json_print_def(json_object_get_string(val));
+    json_object_object_get_ex(def, DICT_SYNONYMS, &val);
+    nsynant += json_print_synonyms(val, 6);
+    json_object_object_get_ex(def, DICT_ANTONYMS, &val);
+    nsynant += json_print_antonyms(val, 6);
     return nsynant;
 }
 
@@ -256,30 +206,7 @@ static void json_print_partofspeech(struct json_object *val)
     const char *text;
 
     text = json_object_get_string(val);
-    fprintf(stdout, INDENT_PRTOFSPCH "[" ANSI_BOLD ANSI_YELLOWHI "%s" ANSI_RESET "]\n", text);
-}
-
-
-/** @brief Print all parts of speech */
-static void json_print_meanings(struct json_object *meanings)
-{
-    struct json_object *meaning, *val;
-    size_t N, i;
-
-    N = json_object_array_length(meanings);
-    for (i = 0; i < N; i++) {
-        meaning = json_object_array_get_idx(meanings, i);
-        json_object_object_get_ex(meaning, DICT_CATEGORY, &val);
-        json_print_partofspeech(val);
-        json_object_object_get_ex(meaning, DICT_DEFINITIONS, &val);
-        if (!json_print_definitions(val)) {
-            json_object_object_get_ex(meaning, DICT_SYNONYMS, &val);
-            json_print_synonyms(val, 4);
-            json_object_object_get_ex(meaning, DICT_ANTONYMS, &val);
-            json_print_antonyms(val, 4);
-        }
-        putchar('\n');
-    }
+    fprintf(render.out, INDENT_PRTOFSPCH "[" ANSI_BOLD ANSI_YELLOWHI "%s" ANSI_RESET "]\n", text);
 }
 
 
@@ -329,39 +256,175 @@ static void json_print_word(struct json_object *word)
         name = json_object_get_string(word);
         json_print_commalist(phon, colr, name, json_get_phonetic, true);
     }
-    putchar('\n');
+    fputc('\n', render.out);
+}
+
+
+/** Position within an entry. Entries are rendered a piece at a time, so that
+ *  nothing past what the reader has seen need be rendered at all
+ */
+struct json_cursor {
+    struct json_object *root;
+    struct json_object *meanings;
+    struct json_object *defs;
+
+    size_t word;
+    size_t meaning;
+    size_t def;
+    size_t ndef;        /* Definitions to show, after --brief */
+    int    nsynant;     /* Synonyms and antonyms shown under definitions */
+
+    enum {
+        JSON_WORD,
+        JSON_MEANING,
+        JSON_DEF,
+        JSON_TAIL
+    } stage;
+};
+
+
+/** @brief Renders the next piece of the entry: a word's heading, a part of
+ *      speech, a single definition, or the end of a part of speech
+ *  @returns false once the entry is finished
+ */
+static bool json_step(struct json_cursor *cur)
+{
+    struct json_object *node, *val;
+    size_t N;
+
+    for (;;) {
+        switch (cur->stage) {
+        case JSON_WORD:
+            if (cur->word >= json_object_array_length(cur->root)) {
+                return false;
+            }
+            node = json_object_array_get_idx(cur->root, cur->word);
+            json_print_word(node);
+            json_object_object_get_ex(node, DICT_MEANINGS, &cur->meanings);
+            cur->meaning = 0;
+            cur->stage = JSON_MEANING;
+            return true;
+        case JSON_MEANING:
+            if (cur->meaning >= json_object_array_length(cur->meanings)) {
+                cur->word++;
+                cur->stage = JSON_WORD;
+                break;
+            }
+            node = json_object_array_get_idx(cur->meanings, cur->meaning);
+            json_object_object_get_ex(node, DICT_CATEGORY, &val);
+            json_print_partofspeech(val);
+            json_object_object_get_ex(node, DICT_DEFINITIONS, &cur->defs);
+            N = json_object_array_length(cur->defs);
+            cur->ndef = (render.brief && render.brief < N) ? render.brief : N;
+            cur->def = 0;
+            cur->nsynant = 0;
+            cur->stage = JSON_DEF;
+            return true;
+        case JSON_DEF:
+            if (cur->def >= cur->ndef) {
+                cur->stage = JSON_TAIL;
+                break;
+            }
+            node = json_object_array_get_idx(cur->defs, cur->def++);
+            cur->nsynant += json_print_sense(node);
+            return true;
+        case JSON_TAIL:
+            N = json_object_array_length(cur->defs) - cur->ndef;
+            if (N) {
+                fprintf(render.out, "    (%zu more)\n", N);
+            }
+            if (!cur->nsynant) {
+                node = json_object_array_get_idx(cur->meanings, cur->meaning);
+                json_object_object_get_ex(node, DICT_SYNONYMS, &val);
+                json_print_synonyms(val, 4);
+                json_object_object_get_ex(node, DICT_ANTONYMS, &val);
+                json_print_antonyms(val, 4);
+            }
+            fputc('\n', render.out);
+            cur->meaning++;
+            cur->stage = JSON_MEANING;
+            return true;
+        }
+    }
+}
+
+
+/** @brief Renders each piece into memory and hands it to the pager, stopping
+ *      as soon as the reader quits
+ */
+static void json_page(struct json_cursor *cur)
+{
+    bool more = true;
+    size_t len;
+    char *buf;
+
+    while (more) {
+        render.out = open_memstream(&buf, &len);
+        if (!render.out) {
+            break;
+        }
+        more = json_step(cur);
+        fclose(render.out);
+        if (len && !page_write(buf, len)) {
+            more = false;
+        }
+        free(buf);
+    }
+    page_end();
 }
 
 
 static int json_print_definition(struct json_object *json)
 {
-    struct json_object *word, *val;
-    size_t N, i;
+    struct json_cursor cur = { .root = json };
 
     if (json_object_get_type(json) != json_type_array) {
         return 1;
     }
-    N = json_object_array_length(json);
-    for (i = 0; i < N; i++) {
-        word = json_object_array_get_idx(json, i);
-        json_print_word(word);
-        json_object_object_get_ex(word, DICT_MEANINGS, &val);
-        json_print_meanings(val);
+    if (render.page && page_begin()) {
+        json_page(&cur);
+    } else {
+        render.out = stdout;
+        while (json_step(&cur)) {
+            ;
+        }
     }
     return 0;
 }
 
 
-int dict_print_JSON(const char *jsonstr, const char *jsonend)
+void dict_print_config(unsigned brief, bool page)
+{
+    render.brief = brief;
+    render.page = page;
+}
+
+
+struct json_object *dict_parse_JSON(const char *jsonstr, const char *jsonend)
 {
     struct json_object *json;
     struct json_tokener *tok;
-    int res;
 
     tok = json_tokener_new();
     json = json_tokener_parse_ex(tok, jsonstr, jsonend - jsonstr);
     json_tokener_free(tok);
-    res = json_print_definition(json);
+    return json;
+}
+
+
+int dict_print_parsed(struct json_object *json)
+{
+    return json_print_definition(json);
+}
+
+
+int dict_print_JSON(const char *jsonstr, const char *jsonend)
+{
+    struct json_object *json;
+    int res;
+
+    json = dict_parse_JSON(jsonstr, jsonend);
+    res = dict_print_parsed(json);
     json_object_put(json);
     return res;
 }
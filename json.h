@@ -3,6 +3,10 @@
 #ifndef DICT_JSON_H
 #define DICT_JSON_H
 
+#include <stdbool.h>
+
+struct json_object;
+
 
 /** @brief Reads a JSON between @p begin and @p end and prints relevant semantic
  *      information contained therein to stdout
@@ -11,4 +15,28 @@
 int dict_print_JSON(const char *begin, const char *end);
 
 
+/** @brief Parses the JSON between @p begin and @p end without printing it
+ *  @returns A new reference to the root node, which the caller must release
+ *      with json_object_put, or NULL if the text could not be parsed
+ */
+struct json_object *dict_parse_JSON(const char *begin, const char *end);
+
+
+/** @brief Prints a tree previously returned by dict_parse_JSON to stdout
+ *  @returns Nonzero if no definition is available
+ */
+int dict_print_parsed(struct json_object *json);
+
+
+/** @brief Sets how entries are printed from now on
+ *  @param brief
+ *      The most definitions printed per part of speech, or zero for all of
+ *      them. The rest are counted, not rendered
+ *  @param page
+ *      Show entries a screenful at a time when stdout is a terminal, rendering
+ *      each screenful only once the reader asks for it
+ */
+void dict_print_config(unsigned brief, bool page);
+
+
 #endif /* DICT_JSON_H */
@@ -0,0 +1,403 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "key.h"
+#include "log.h"
+#include "wrap.h"
+
+
+/** Canonical compositions, sorted by base and then mark for bsearch. These are
+ *  the precomposed Latin-1, Latin Extended-A, Greek and Cyrillic letters,
+ *  which covers the entries the API actually serves
+ */
+static const struct key_compose {
+    uint32_t base;
+    uint32_t mark;
+    uint32_t comp;
+} compose[] = {
+    { 0x0041, 0x0300, 0x00c0 },   /* À */
+    { 0x0041, 0x0301, 0x00c1 },   /* Á */
+    { 0x0041, 0x0302, 0x00c2 },   /* Â */
+    { 0x0041, 0x0303, 0x00c3 },   /* Ã */
+    { 0x0041, 0x0304, 0x0100 },   /* Ā */
+    { 0x0041, 0x0306, 0x0102 },   /* Ă */
+    { 0x0041, 0x0308, 0x00c4 },   /* Ä */
+    { 0x0041, 0x030a, 0x00c5 },   /* Å */
+    { 0x0041, 0x0328, 0x0104 },   /* Ą */
+    { 0x0043, 0x0301, 0x0106 },   /* Ć */
+    { 0x0043, 0x0302, 0x0108 },   /* Ĉ */
+    { 0x0043, 0x0307, 0x010a },   /* Ċ */
+    { 0x0043, 0x030c, 0x010c },   /* Č */
+    { 0x0043, 0x0327, 0x00c7 },   /* Ç */
+    { 0x0044, 0x030c, 0x010e },   /* Ď */
+    { 0x0045, 0x0300, 0x00c8 },   /* È */
+    { 0x0045, 0x0301, 0x00c9 },   /* É */
+    { 0x0045, 0x0302, 0x00ca },   /* Ê */
+    { 0x0045, 0x0304, 0x0112 },   /* Ē */
+    { 0x0045, 0x0306, 0x0114 },   /* Ĕ */
+    { 0x0045, 0x0307, 0x0116 },   /* Ė */
+    { 0x0045, 0x0308, 0x00cb },   /* Ë */
+    { 0x0045, 0x030c, 0x011a },   /* Ě */
+    { 0x0045, 0x0328, 0x0118 },   /* Ę */
+    { 0x0047, 0x0302, 0x011c },   /* Ĝ */
+    { 0x0047, 0x0306, 0x011e },   /* Ğ */
+    { 0x0047, 0x0307, 0x0120 },   /* Ġ */
+    { 0x0047, 0x0327, 0x0122 },   /* Ģ */
+    { 0x0048, 0x0302, 0x0124 },   /* Ĥ */
+    { 0x0049, 0x0300, 0x00cc },   /* Ì */
+    { 0x0049, 0x0301, 0x00cd },   /* Í */
+    { 0x0049, 0x0302, 0x00ce },   /* Î */
+    { 0x0049, 0x0303, 0x0128 },   /* Ĩ */
+    { 0x0049, 0x0304, 0x012a },   /* Ī */
+    { 0x0049, 0x0306, 0x012c },   /* Ĭ */
+    { 0x0049, 0x0307, 0x0130 },   /* İ */
+    { 0x0049, 0x0308, 0x00cf },   /* Ï */
+    { 0x0049, 0x0328, 0x012e },   /* Į */
+    { 0x004a, 0x0302, 0x0134 },   /* Ĵ */
+    { 0x004b, 0x0327, 0x0136 },   /* Ķ */
+    { 0x004c, 0x0301, 0x0139 },   /* Ĺ */
+    { 0x004c, 0x030c, 0x013d },   /* Ľ */
+    { 0x004c, 0x0327, 0x013b },   /* Ļ */
+    { 0x004e, 0x0301, 0x0143 },   /* Ń */
+    { 0x004e, 0x0303, 0x00d1 },   /* Ñ */
+    { 0x004e, 0x030c, 0x0147 },   /* Ň */
+    { 0x004e, 0x0327, 0x0145 },   /* Ņ */
+    { 0x004f, 0x0300, 0x00d2 },   /* Ò */
+    { 0x004f, 0x0301, 0x00d3 },   /* Ó */
+    { 0x004f, 0x0302, 0x00d4 },   /* Ô */
+    { 0x004f, 0x0303, 0x00d5 },   /* Õ */
+    { 0x004f, 0x0304, 0x014c },   /* Ō */
+    { 0x004f, 0x0306, 0x014e },   /* Ŏ */
+    { 0x004f, 0x0308, 0x00d6 },   /* Ö */
+    { 0x004f, 0x030b, 0x0150 },   /* Ő */
+    { 0x0052, 0x0301, 0x0154 },   /* Ŕ */
+    { 0x0052, 0x030c, 0x0158 },   /* Ř */
+    { 0x0052, 0x0327, 0x0156 },   /* Ŗ */
+    { 0x0053, 0x0301, 0x015a },   /* Ś */
+    { 0x0053, 0x0302, 0x015c },   /* Ŝ */
+    { 0x0053, 0x030c, 0x0160 },   /* Š */
+    { 0x0053, 0x0327, 0x015e },   /* Ş */
+    { 0x0054, 0x030c, 0x0164 },   /* Ť */
+    { 0x0054, 0x0327, 0x0162 },   /* Ţ */
+    { 0x0055, 0x0300, 0x00d9 },   /* Ù */
+    { 0x0055, 0x0301, 0x00da },   /* Ú */
+    { 0x0055, 0x0302, 0x00db },   /* Û */
+    { 0x0055, 0x0303, 0x0168 },   /* Ũ */
+    { 0x0055, 0x0304, 0x016a },   /* Ū */
+    { 0x0055, 0x0306, 0x016c },   /* Ŭ */
+    { 0x0055, 0x0308, 0x00dc },   /* Ü */
+    { 0x0055, 0x030a, 0x016e },   /* Ů */
+    { 0x0055, 0x030b, 0x0170 },   /* Ű */
+    { 0x0055, 0x0328, 0x0172 },   /* Ų */
+    { 0x0057, 0x0302, 0x0174 },   /* Ŵ */
+    { 0x0059, 0x0301, 0x00dd },   /* Ý */
+    { 0x0059, 0x0302, 0x0176 },   /* Ŷ */
+    { 0x0059, 0x0308, 0x0178 },   /* Ÿ */
+    { 0x005a, 0x0301, 0x0179 },   /* Ź */
+    { 0x005a, 0x0307, 0x017b },   /* Ż */
+    { 0x005a, 0x030c, 0x017d },   /* Ž */
+    { 0x0061, 0x0300, 0x00e0 },   /* à */
+    { 0x0061, 0x0301, 0x00e1 },   /* á */
+    { 0x0061, 0x0302, 0x00e2 },   /* â */
+    { 0x0061, 0x0303, 0x00e3 },   /* ã */
+    { 0x0061, 0x0304, 0x0101 },   /* ā */
+    { 0x0061, 0x0306, 0x0103 },   /* ă */
+    { 0x0061, 0x0308, 0x00e4 },   /* ä */
+    { 0x0061, 0x030a, 0x00e5 },   /* å */
+    { 0x0061, 0x0328, 0x0105 },   /* ą */
+    { 0x0063, 0x0301, 0x0107 },   /* ć */
+    { 0x0063, 0x0302, 0x0109 },   /* ĉ */
+    { 0x0063, 0x0307, 0x010b },   /* ċ */
+    { 0x0063, 0x030c, 0x010d },   /* č */
+    { 0x0063, 0x0327, 0x00e7 },   /* ç */
+    { 0x0064, 0x030c, 0x010f },   /* ď */
+    { 0x0065, 0x0300, 0x00e8 },   /* è */
+    { 0x0065, 0x0301, 0x00e9 },   /* é */
+    { 0x0065, 0x0302, 0x00ea },   /* ê */
+    { 0x0065, 0x0304, 0x0113 },   /* ē */
+    { 0x0065, 0x0306, 0x0115 },   /* ĕ */
+    { 0x0065, 0x0307, 0x0117 },   /* ė */
+    { 0x0065, 0x0308, 0x00eb },   /* ë */
+    { 0x0065, 0x030c, 0x011b },   /* ě */
+    { 0x0065, 0x0328, 0x0119 },   /* ę */
+    { 0x0067, 0x0302, 0x011d },   /* ĝ */
+    { 0x0067, 0x0306, 0x011f },   /* ğ */
+    { 0x0067, 0x0307, 0x0121 },   /* ġ */
+    { 0x0067, 0x0327, 0x0123 },   /* ģ */
+    { 0x0068, 0x0302, 0x0125 },   /* ĥ */
+    { 0x0069, 0x0300, 0x00ec },   /* ì */
+    { 0x0069, 0x0301, 0x00ed },   /* í */
+    { 0x0069, 0x0302, 0x00ee },   /* î */
+    { 0x0069, 0x0303, 0x0129 },   /* ĩ */
+    { 0x0069, 0x0304, 0x012b },   /* ī */
+    { 0x0069, 0x0306, 0x012d },   /* ĭ */
+    { 0x0069, 0x0308, 0x00ef },   /* ï */
+    { 0x0069, 0x0328, 0x012f },   /* į */
+    { 0x006a, 0x0302, 0x0135 },   /* ĵ */
+    { 0x006b, 0x0327, 0x0137 },   /* ķ */
+    { 0x006c, 0x0301, 0x013a },   /* ĺ */
+    { 0x006c, 0x030c, 0x013e },   /* ľ */
+    { 0x006c, 0x0327, 0x013c },   /* ļ */
+    { 0x006e, 0x0301, 0x0144 },   /* ń */
+    { 0x006e, 0x0303, 0x00f1 },   /* ñ */
+    { 0x006e, 0x030c, 0x0148 },   /* ň */
+    { 0x006e, 0x0327, 0x0146 },   /* ņ */
+    { 0x006f, 0x0300, 0x00f2 },   /* ò */
+    { 0x006f, 0x0301, 0x00f3 },   /* ó */
+    { 0x006f, 0x0302, 0x00f4 },   /* ô */
+    { 0x006f, 0x0303, 0x00f5 },   /* õ */
+    { 0x006f, 0x0304, 0x014d },   /* ō */
+    { 0x006f, 0x0306, 0x014f },   /* ŏ */
+    { 0x006f, 0x0308, 0x00f6 },   /* ö */
+    { 0x006f, 0x030b, 0x0151 },   /* ő */
+    { 0x0072, 0x0301, 0x0155 },   /* ŕ */
+    { 0x0072, 0x030c, 0x0159 },   /* ř */
+    { 0x0072, 0x0327, 0x0157 },   /* ŗ */
+    { 0x0073, 0x0301, 0x015b },   /* ś */
+    { 0x0073, 0x0302, 0x015d },   /* ŝ */
+    { 0x0073, 0x030c, 0x0161 },   /* š */
+    { 0x0073, 0x0327, 0x015f },   /* ş */
+    { 0x0074, 0x030c, 0x0165 },   /* ť */
+    { 0x0074, 0x0327, 0x0163 },   /* ţ */
+    { 0x0075, 0x0300, 0x00f9 },   /* ù */
+    { 0x0075, 0x0301, 0x00fa },   /* ú */
+    { 0x0075, 0x0302, 0x00fb },   /* û */
+    { 0x0075, 0x0303, 0x0169 },   /* ũ */
+    { 0x0075, 0x0304, 0x016b },   /* ū */
+    { 0x0075, 0x0306, 0x016d },   /* ŭ */
+    { 0x0075, 0x0308, 0x00fc },   /* ü */
+    { 0x0075, 0x030a, 0x016f },   /* ů */
+    { 0x0075, 0x030b, 0x0171 },   /* ű */
+    { 0x0075, 0x0328, 0x0173 },   /* ų */
+    { 0x0077, 0x0302, 0x0175 },   /* ŵ */
+    { 0x0079, 0x0301, 0x00fd },   /* ý */
+    { 0x0079, 0x0302, 0x0177 },   /* ŷ */
+    { 0x0079, 0x0308, 0x00ff },   /* ÿ */
+    { 0x007a, 0x0301, 0x017a },   /* ź */
+    { 0x007a, 0x0307, 0x017c },   /* ż */
+    { 0x007a, 0x030c, 0x017e },   /* ž */
+    { 0x0391, 0x0301, 0x0386 },   /* Ά */
+    { 0x0395, 0x0301, 0x0388 },   /* Έ */
+    { 0x0397, 0x0301, 0x0389 },   /* Ή */
+    { 0x0399, 0x0301, 0x038a },   /* Ί */
+    { 0x0399, 0x0308, 0x03aa },   /* Ϊ */
+    { 0x039f, 0x0301, 0x038c },   /* Ό */
+    { 0x03a5, 0x0301, 0x038e },   /* Ύ */
+    { 0x03a5, 0x0308, 0x03ab },   /* Ϋ */
+    { 0x03a9, 0x0301, 0x038f },   /* Ώ */
+    { 0x03b1, 0x0301, 0x03ac },   /* ά */
+    { 0x03b5, 0x0301, 0x03ad },   /* έ */
+    { 0x03b7, 0x0301, 0x03ae },   /* ή */
+    { 0x03b9, 0x0301, 0x03af },   /* ί */
+    { 0x03b9, 0x0308, 0x03ca },   /* ϊ */
+    { 0x03bf, 0x0301, 0x03cc },   /* ό */
+    { 0x03c5, 0x0301, 0x03cd },   /* ύ */
+    { 0x03c5, 0x0308, 0x03cb },   /* ϋ */
+    { 0x03c9, 0x0301, 0x03ce },   /* ώ */
+    { 0x03ca, 0x0301, 0x0390 },   /* ΐ */
+    { 0x03cb, 0x0301, 0x03b0 },   /* ΰ */
+    { 0x0406, 0x0308, 0x0407 },   /* Ї */
+    { 0x0413, 0x0301, 0x0403 },   /* Ѓ */
+    { 0x0415, 0x0300, 0x0400 },   /* Ѐ */
+    { 0x0415, 0x0308, 0x0401 },   /* Ё */
+    { 0x0418, 0x0300, 0x040d },   /* Ѝ */
+    { 0x0418, 0x0306, 0x0419 },   /* Й */
+    { 0x041a, 0x0301, 0x040c },   /* Ќ */
+    { 0x0423, 0x0306, 0x040e },   /* Ў */
+    { 0x0433, 0x0301, 0x0453 },   /* ѓ */
+    { 0x0435, 0x0300, 0x0450 },   /* ѐ */
+    { 0x0435, 0x0308, 0x0451 },   /* ё */
+    { 0x0438, 0x0300, 0x045d },   /* ѝ */
+    { 0x0438, 0x0306, 0x0439 },   /* й */
+    { 0x043a, 0x0301, 0x045c },   /* ќ */
+    { 0x0443, 0x0306, 0x045e },   /* ў */
+    { 0x0456, 0x0308, 0x0457 },   /* ї */
+};
+
+
+/** Upper case ranges and the distance to their lower case. Where @c stride is
+ *  two, upper and lower case alternate and only every other codepoint folds
+ */
+static const struct key_fold {
+    uint32_t lo;
+    uint32_t hi;
+    int      delta;
+    int      stride;
+} fold[] = {
+    { 0x00C0, 0x00D6, 32, 1 }, { 0x00D8, 0x00DE, 32, 1 },
+    { 0x0100, 0x012E, 1,  2 }, { 0x0132, 0x0136, 1,  2 },
+    { 0x0139, 0x0147, 1,  2 }, { 0x014A, 0x0176, 1,  2 },
+    { 0x0178, 0x0178, -121, 1 }, { 0x0179, 0x017D, 1, 2 },
+    { 0x0386, 0x0386, 38, 1 }, { 0x0388, 0x038A, 37, 1 },
+    { 0x038C, 0x038C, 64, 1 }, { 0x038E, 0x038F, 63, 1 },
+    { 0x0391, 0x03A1, 32, 1 }, { 0x03A3, 0x03AB, 32, 1 },
+    { 0x0400, 0x040F, 80, 1 }, { 0x0410, 0x042F, 32, 1 },
+    { 0x0460, 0x0480, 1,  2 }, { 0x048A, 0x04BE, 1,  2 },
+    { 0x04C1, 0x04CD, 1,  2 }, { 0x04D0, 0x052E, 1,  2 }
+};
+
+
+static int key_compose_cmp(const void *lhs, const void *rhs)
+{
+    const struct key_compose *x = lhs, *y = rhs;
+
+    if (x->base != y->base) {
+        return (x->base > y->base) - (x->base < y->base);
+    }
+    return (x->mark > y->mark) - (x->mark < y->mark);
+}
+
+
+static uint32_t key_fold(uint32_t cp)
+{
+    const size_t N = sizeof fold / sizeof *fold;
+    size_t i;
+
+    if (cp < 0x80) {
+        return (cp >= 'A' && cp <= 'Z') ? cp + 32 : cp;
+    }
+    for (i = 0; i < N && fold[i].lo <= cp; i++) {
+        if (cp <= fold[i].hi && (cp - fold[i].lo) % fold[i].stride == 0) {
+            return cp + fold[i].delta;
+        }
+    }
+    return cp;
+}
+
+
+static bool key_isspace(uint32_t cp)
+{
+    return cp == ' ' || (cp >= '\t' && cp <= '\r') || cp == 0xA0 || cp == 0x3000;
+}
+
+
+/** @brief Appends @p cp to the key in @p buf as UTF-8, advancing @p pos
+ *  @returns Nonzero if it did not fit
+ */
+static int key_encode(char *buf, size_t *pos, uint32_t cp)
+{
+    unsigned char seq[4];
+    size_t len;
+
+    if (cp < 0x80) {
+        seq[0] = cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        seq[0] = 0xC0 | (cp >> 6);
+        seq[1] = 0x80 | (cp & 0x3F);
+        len = 2;
+    } else if (cp < 0x10000) {
+        seq[0] = 0xE0 | (cp >> 12);
+        seq[1] = 0x80 | ((cp >> 6) & 0x3F);
+        seq[2] = 0x80 | (cp & 0x3F);
+        len = 3;
+    } else {
+        seq[0] = 0xF0 | (cp >> 18);
+        seq[1] = 0x80 | ((cp >> 12) & 0x3F);
+        seq[2] = 0x80 | ((cp >> 6) & 0x3F);
+        seq[3] = 0x80 | (cp & 0x3F);
+        len = 4;
+    }
+    if (*pos + len >= KEY_MAXLEN) {
+        return 1;
+    }
+    memcpy(buf + *pos, seq, len);
+    *pos += len;
+    return 0;
+}
+
+
+int key_canon(const char *word, char buf[KEY_MAXLEN])
+{
+    const unsigned char *ptr = (const unsigned char *)word;
+    uint32_t cps[KEY_MAXLEN], cp;
+    struct key_compose probe, *comp;
+    size_t n = 0, pos = 0, i;
+    bool space = false, full = false;
+
+    while (*ptr && !full) {
+        ptr += wrap_decode(ptr, &cp);
+        if (key_isspace(cp)) {
+            space = n > 0;
+            continue;
+        } else if (cp == 0x2018 || cp == 0x2019) {
+            cp = '\'';
+        }
+        probe.base = (n && !space) ? cps[n - 1] : 0;
+        probe.mark = cp;
+        comp = bsearch(&probe, compose, sizeof compose / sizeof *compose,
+                       sizeof *compose, key_compose_cmp);
+        if (comp) {
+            cps[n - 1] = comp->comp;
+            continue;
+        }
+        full = n + space + 1 >= KEY_MAXLEN;
+        if (full) {
+            continue;
+        } else if (space) {
+            cps[n++] = ' ';
+            space = false;
+        }
+        cps[n++] = cp;
+    }
+    for (i = 0; i < n; i++) {
+        if (key_encode(buf, &pos, key_fold(cps[i]))) {
+            break;
+        }
+    }
+    if (!n) {
+        dict_logs(DICT_ERROR, "Word is empty");
+        return 1;
+    } else if (full || i < n) {
+        dict_logf(DICT_ERROR, "Word is too long: %.32s...", word);
+        return 1;
+    }
+    buf[pos] = '\0';
+    return 0;
+}
+
+
+uint64_t key_hash(const char *key)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+
+void key_name(const char *key, char name[KEY_NAMELEN])
+{
+    snprintf(name, KEY_NAMELEN, "%016llx", (unsigned long long)key_hash(key));
+}
+
+
+int key_escape(const char *key, char *buf, size_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const unsigned char *ptr = (const unsigned char *)key;
+    size_t pos = 0;
+
+    for (; *ptr; ptr++) {
+        if (pos + 4 > len) {
+            return 1;
+        } else if ((*ptr >= 'a' && *ptr <= 'z') || (*ptr >= 'A' && *ptr <= 'Z')
+                || (*ptr >= '0' && *ptr <= '9') || strchr("-._~", *ptr)) {
+            buf[pos++] = *ptr;
+        } else {
+            buf[pos++] = '%';
+            buf[pos++] = hex[*ptr >> 4];
+            buf[pos++] = hex[*ptr & 0xF];
+        }
+    }
+    if (pos >= len) {
+        return 1;
+    }
+    buf[pos] = '\0';
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef DICT_KEY_H
+#define DICT_KEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The longest canonical key, in bytes, including the nul term */
+#define KEY_MAXLEN 128
+
+/** The length of an on-disk entry name, including the nul term */
+#define KEY_NAMELEN 17
+
+
+/** @brief Reduces @p word to the key its entry is stored under, so that
+ *      queries differing only in case, surrounding or repeated whitespace, or
+ *      Unicode composition share one entry. Whitespace is trimmed and runs of
+ *      it collapse to one space, combining marks are composed onto their base
+ *      letter where a precomposed letter exists, and Latin, Greek and Cyrillic
+ *      letters are folded to lower case
+ *  @param[out] buf
+ *      Buffer of at least KEY_MAXLEN bytes to write the key to
+ *  @returns Nonzero if @p word is empty or its key is too long. This is logged
+ */
+int key_canon(const char *word, char buf[KEY_MAXLEN]);
+
+
+/** @brief FNV-1a hash of @p key */
+uint64_t key_hash(const char *key);
+
+
+/** @brief Writes the name of the cache file holding @p key to @p name. This is
+ *      a fixed-length hex string, so that no word can escape the cache
+ *      directory or overflow a path
+ */
+void key_name(const char *key, char name[KEY_NAMELEN]);
+
+
+/** @brief Percent-encodes @p key for use as a URL path segment
+ *  @returns Nonzero if @p len bytes were not enough
+ */
+int key_escape(const char *key, char *buf, size_t len);
+
+
+#endif /* DICT_KEY_H */
@@ -0,0 +1,205 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lemma.h"
+
+
+/** Irregular inflections. This must stay sorted by form, for bsearch */
+static const struct lemma_irregular {
+    const char *form;
+    const char *lemma;
+} irregular[] = {
+    { "alumni", "alumnus" }, { "am", "be" }, { "analyses", "analysis" },
+    { "antennae", "antenna" }, { "appendices", "appendix" }, { "are", "be" },
+    { "ate", "eat" }, { "bacteria", "bacterium" }, { "bases", "basis" },
+    { "been", "be" }, { "began", "begin" }, { "begun", "begin" },
+    { "being", "be" }, { "best", "good" }, { "better", "good" },
+    { "bit", "bite" }, { "bitten", "bite" }, { "blew", "blow" },
+    { "blown", "blow" }, { "bought", "buy" }, { "broke", "break" },
+    { "broken", "break" }, { "brought", "bring" }, { "built", "build" },
+    { "cacti", "cactus" }, { "came", "come" }, { "caught", "catch" },
+    { "children", "child" }, { "chose", "choose" }, { "chosen", "choose" },
+    { "corpora", "corpus" }, { "cost", "cost" }, { "crises", "crisis" },
+    { "criteria", "criterion" }, { "curricula", "curriculum" },
+    { "cut", "cut" }, { "data", "datum" }, { "dealt", "deal" },
+    { "diagnoses", "diagnosis" }, { "dice", "die" }, { "did", "do" },
+    { "does", "do" }, { "done", "do" }, { "drank", "drink" },
+    { "drawn", "draw" }, { "drew", "draw" }, { "driven", "drive" },
+    { "drove", "drive" }, { "drunk", "drink" }, { "dug", "dig" },
+    { "eaten", "eat" }, { "fallen", "fall" }, { "farther", "far" },
+    { "farthest", "far" }, { "fed", "feed" }, { "feet", "foot" },
+    { "fell", "fall" }, { "felt", "feel" }, { "fled", "flee" },
+    { "flew", "fly" }, { "flown", "fly" }, { "forgave", "forgive" },
+    { "forgiven", "forgive" }, { "forgot", "forget" },
+    { "forgotten", "forget" }, { "formulae", "formula" },
+    { "fought", "fight" }, { "found", "find" }, { "froze", "freeze" },
+    { "frozen", "freeze" }, { "fungi", "fungus" }, { "further", "far" },
+    { "furthest", "far" }, { "gave", "give" }, { "geese", "goose" },
+    { "genera", "genus" }, { "given", "give" }, { "goes", "go" },
+    { "gone", "go" }, { "got", "get" }, { "gotten", "get" },
+    { "grew", "grow" }, { "grown", "grow" }, { "had", "have" },
+    { "has", "have" }, { "having", "have" }, { "heard", "hear" },
+    { "held", "hold" }, { "hid", "hide" }, { "hidden", "hide" },
+    { "hung", "hang" }, { "hurt", "hurt" }, { "hypotheses", "hypothesis" },
+    { "indices", "index" }, { "is", "be" }, { "kept", "keep" },
+    { "knelt", "kneel" }, { "knew", "know" }, { "known", "know" },
+    { "laid", "lay" }, { "lain", "lie" }, { "larvae", "larva" },
+    { "lay", "lie" }, { "least", "little" }, { "led", "lead" },
+    { "left", "leave" }, { "lent", "lend" }, { "less", "little" },
+    { "lice", "louse" }, { "lit", "light" }, { "lost", "lose" },
+    { "made", "make" }, { "matrices", "matrix" }, { "meant", "mean" },
+    { "media", "medium" }, { "memoranda", "memorandum" }, { "men", "man" },
+    { "met", "meet" }, { "mice", "mouse" }, { "more", "many" },
+    { "most", "many" }, { "nuclei", "nucleus" }, { "oases", "oasis" },
+    { "oxen", "ox" }, { "paid", "pay" }, { "parentheses", "parenthesis" },
+    { "people", "person" }, { "phenomena", "phenomenon" },
+    { "radii", "radius" }, { "ran", "run" }, { "rang", "ring" },
+    { "ridden", "ride" }, { "risen", "rise" }, { "rode", "ride" },
+    { "rose", "rise" }, { "rung", "ring" }, { "said", "say" },
+    { "sang", "sing" }, { "sank", "sink" }, { "sat", "sit" }, { "saw", "see" },
+    { "seen", "see" }, { "sent", "send" }, { "shaken", "shake" },
+    { "shone", "shine" }, { "shook", "shake" }, { "shot", "shoot" },
+    { "showed", "show" }, { "shown", "show" }, { "shrank", "shrink" },
+    { "shrunk", "shrink" }, { "slept", "sleep" }, { "slid", "slide" },
+    { "sold", "sell" }, { "sought", "seek" }, { "spent", "spend" },
+    { "spoke", "speak" }, { "spoken", "speak" }, { "spun", "spin" },
+    { "stimuli", "stimulus" }, { "stole", "steal" }, { "stolen", "steal" },
+    { "stood", "stand" }, { "strata", "stratum" }, { "struck", "strike" },
+    { "stuck", "stick" }, { "stung", "sting" }, { "sung", "sing" },
+    { "sunk", "sink" }, { "swam", "swim" }, { "swept", "sweep" },
+    { "swore", "swear" }, { "sworn", "swear" }, { "swum", "swim" },
+    { "swung", "swing" }, { "syllabi", "syllabus" }, { "taken", "take" },
+    { "taught", "teach" }, { "teeth", "tooth" }, { "theses", "thesis" },
+    { "thought", "think" }, { "threw", "throw" }, { "thrown", "throw" },
+    { "told", "tell" }, { "took", "take" }, { "tore", "tear" },
+    { "torn", "tear" }, { "understood", "understand" },
+    { "vertices", "vertex" }, { "vitae", "vita" }, { "was", "be" },
+    { "went", "go" }, { "were", "be" }, { "woke", "wake" },
+    { "woken", "wake" }, { "women", "woman" }, { "won", "win" },
+    { "wore", "wear" }, { "worn", "wear" }, { "worse", "bad" },
+    { "worst", "bad" }, { "wound", "wind" }, { "written", "write" },
+    { "wrote", "write" }
+};
+
+
+/** Regular inflections, most reliable first. A rule replaces @c suffix with
+ *  @c repl. If @c undouble is set, a doubled final consonant left behind is
+ *  also tried singly, as in "running" or "stopped"
+ */
+static const struct lemma_rule {
+    const char *suffix;
+    const char *repl;
+    bool        undouble;
+} rules[] = {
+    { "ies",  "y",   false },   /* studies */
+    { "ied",  "y",   false },   /* studied */
+    { "iest", "y",   false },   /* happiest */
+    { "ier",  "y",   false },   /* happier */
+    { "ily",  "y",   false },   /* happily */
+    { "ves",  "f",   false },   /* wolves */
+    { "ves",  "fe",  false },   /* knives */
+    { "men",  "man", false },   /* firemen */
+    { "sses", "ss",  false },   /* classes */
+    { "ches", "ch",  false },   /* churches */
+    { "shes", "sh",  false },   /* wishes */
+    { "xes",  "x",   false },   /* boxes */
+    { "oes",  "o",   false },   /* potatoes */
+    { "ing",  "",    true  },   /* walking, running */
+    { "ing",  "e",   false },   /* making */
+    { "ed",   "",    true  },   /* walked, stopped */
+    { "ed",   "e",   false },   /* baked */
+    { "est",  "",    true  },   /* fastest, biggest */
+    { "est",  "e",   false },   /* latest */
+    { "er",   "",    true  },   /* faster, bigger */
+    { "er",   "e",   false },   /* later */
+    { "es",   "",    false },   /* buses */
+    { "s",    "",    false },   /* cats */
+    { "ly",   "",    false },   /* quickly */
+    { "ness", "",    false }    /* kindness */
+};
+
+
+static int lemma_cmp(const void *key, const void *elem)
+{
+    return strcmp(key, ((const struct lemma_irregular *)elem)->form);
+}
+
+
+/** @brief Appends @p stem[0..len) + @p repl to @p forms, unless it is empty,
+ *      too long, @p word itself, or already present
+ */
+static int lemma_add(char        forms[LEMMA_MAXFORMS][LEMMA_MAXLEN],
+                     int         n,
+                     const char *word,
+                     const char *stem,
+                     size_t      len,
+                     const char *repl)
+{
+    char buf[LEMMA_MAXLEN];
+    int i;
+
+    if (n >= LEMMA_MAXFORMS || !len || len + strlen(repl) >= sizeof buf) {
+        return n;
+    }
+    memcpy(buf, stem, len);
+    strcpy(buf + len, repl);
+    if (!strcmp(buf, word)) {
+        return n;
+    }
+    for (i = 0; i < n; i++) {
+        if (!strcmp(forms[i], buf)) {
+            return n;
+        }
+    }
+    strcpy(forms[n], buf);
+    return n + 1;
+}
+
+
+static bool lemma_isvowel(char c)
+{
+    return c && strchr("aeiouy", c);
+}
+
+
+/** @brief Checks whether a word may take the bare "s" rule. "ss", "us" and
+ *      "is" endings are rarely plurals: "class", "bus", "this"
+ */
+static bool lemma_plural_s(const char *word, size_t len)
+{
+    return len > 3 && !strchr("siu", word[len - 2]);
+}
+
+
+int lemma_forms(const char *word, char forms[LEMMA_MAXFORMS][LEMMA_MAXLEN])
+{
+    const size_t N = sizeof rules / sizeof *rules;
+    const struct lemma_irregular *irr;
+    const struct lemma_rule *rule;
+    size_t len, slen, stem, i;
+    int n = 0;
+
+    irr = bsearch(word, irregular, sizeof irregular / sizeof *irregular,
+                  sizeof *irregular, lemma_cmp);
+    if (irr) {
+        n = lemma_add(forms, n, word, irr->lemma, strlen(irr->lemma), "");
+    }
+    len = strlen(word);
+    for (i = 0; i < N; i++) {
+        rule = &rules[i];
+        slen = strlen(rule->suffix);
+        if (len < slen + 2 || strcmp(word + len - slen, rule->suffix)) {
+            continue;
+        } else if (!strcmp(rule->suffix, "s") && !lemma_plural_s(word, len)) {
+            continue;
+        }
+        stem = len - slen;
+        if (rule->undouble && stem >= 3 && word[stem - 1] == word[stem - 2]
+         && !lemma_isvowel(word[stem - 1]) && !strchr("lsz", word[stem - 1])) {
+            n = lemma_add(forms, n, word, word, stem - 1, rule->repl);
+        }
+        n = lemma_add(forms, n, word, word, stem, rule->repl);
+    }
+    return n;
+}
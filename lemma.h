@@ -0,0 +1,27 @@
+#pragma once
+
+#ifndef DICT_LEMMA_H
+#define DICT_LEMMA_H
+
+/** The most candidate base forms generated for one word */
+#define LEMMA_MAXFORMS 12
+
+/** The longest base form generated, including the nul term */
+#define LEMMA_MAXLEN 64
+
+
+/** @brief Guesses the base forms @p word may be inflected from, such as
+ *      "study" for "studied" or "goose" for "geese". Irregular forms come from
+ *      a table compiled into the binary and the rest from English suffix rules,
+ *      so some candidates will not be words at all; probe them, don't trust
+ *      them
+ *  @param word
+ *      Inflected word
+ *  @param[out] forms
+ *      Candidates, most plausible first. @p word itself is never included
+ *  @returns The number of candidates written to @p forms
+ */
+int lemma_forms(const char *word, char forms[LEMMA_MAXFORMS][LEMMA_MAXLEN]);
+
+
+#endif /* DICT_LEMMA_H */
@@ -0,0 +1,130 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "lru.h"
+#include "trace.h"
+
+/** The number of parsed entries kept in memory. Each tree is a few tens of kB
+ *  once json-c has allocated a node for every value, so keep this modest
+ */
+#define LRU_MAX 32
+
+
+static struct {
+    struct lru_ent {
+        char               *word;
+        struct json_object *json;
+        unsigned long       stamp;
+    } ent[LRU_MAX];
+
+    unsigned long clock;
+    bool          enabled;
+} lru = { 0 };
+
+
+void lru_enable(void)
+{
+    lru.enabled = true;
+}
+
+
+static struct lru_ent *lru_find(const char *word)
+{
+    unsigned i;
+
+    for (i = 0; i < LRU_MAX; i++) {
+        if (lru.ent[i].word && !strcmp(lru.ent[i].word, word)) {
+            return &lru.ent[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void lru_release(struct lru_ent *ent)
+{
+    free(ent->word);
+    json_object_put(ent->json);
+    memset(ent, 0, sizeof *ent);
+}
+
+
+struct json_object *lru_get(const char *word)
+{
+    struct lru_ent *ent;
+
+    if (!lru.enabled) {
+        return NULL;
+    }
+    ent = lru_find(word);
+    if (ent) {
+        TRACE(LRU_HIT, word, 0, 0);
+        ent->stamp = ++lru.clock;
+        return ent->json;
+    }
+    TRACE(LRU_MISS, word, 0, 0);
+    return NULL;
+}
+
+
+void lru_put(const char *word, struct json_object *json)
+{
+    struct lru_ent *ent, *victim;
+    unsigned i;
+
+    if (!lru.enabled || !json) {
+        return;
+    }
+    json = json_object_get(json);   /* @p json may be the entry we replace */
+    victim = lru_find(word);
+    for (i = 0; !victim && i < LRU_MAX; i++) {
+        if (!lru.ent[i].word) {
+            victim = &lru.ent[i];
+        }
+    }
+    if (!victim) {
+        victim = &lru.ent[0];
+        for (i = 1; i < LRU_MAX; i++) {
+            ent = &lru.ent[i];
+            if (ent->stamp < victim->stamp) {
+                victim = ent;
+            }
+        }
+    }
+    if (victim->word) {
+        lru_release(victim);
+    }
+    victim->word = strdup(word);
+    if (victim->word) {
+        victim->json = json;
+        victim->stamp = ++lru.clock;
+    } else {
+        json_object_put(json);
+    }
+}
+
+
+void lru_remove(const char *word)
+{
+    struct lru_ent *ent;
+
+    ent = lru_find(word);
+    if (ent) {
+        lru_release(ent);
+    }
+}
+
+
+void lru_clear(void)
+{
+    unsigned i;
+
+    for (i = 0; i < LRU_MAX; i++) {
+        if (lru.ent[i].word) {
+            lru_release(&lru.ent[i]);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#ifndef DICT_LRU_H
+#define DICT_LRU_H
+
+struct json_object;
+
+
+/** @brief Enables the in-memory LRU of parsed entries. Until this is called,
+ *      lru_put discards everything and lru_get always misses, since a process
+ *      making a single query has no use for it
+ */
+void lru_enable(void);
+
+
+/** @brief Fetches the parsed entry for @p word
+ *  @returns A borrowed reference to the tree, or NULL on a miss. The reference
+ *      remains valid until the next call to lru_put or lru_remove
+ */
+struct json_object *lru_get(const char *word);
+
+
+/** @brief Stores @p json under @p word, evicting the least recently used entry
+ *      if the LRU is full. The LRU takes its own reference to @p json
+ */
+void lru_put(const char *word, struct json_object *json);
+
+
+/** @brief Drops @p word from the LRU, if present */
+void lru_remove(const char *word);
+
+
+/** @brief Releases every entry */
+void lru_clear(void);
+
+
+#endif /* DICT_LRU_H */
@@ -0,0 +1,562 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "meta.h"
+#include "cache.h"
+#include "key.h"
+#include "log.h"
+
+/** The index, beside the cache directory */
+#define META_FILE "index"
+
+/** Identifies the file layout. It is cleared while the table is rewritten, so
+ *  that an interrupted rewrite is rebuilt rather than trusted
+ */
+#define META_MAGIC 0x315844494d544944ULL
+
+/** The fewest slots a table has. Must be a power of two */
+#define META_MINCAP 1024
+
+/** The most hits held in memory before they are flushed regardless */
+#define META_PENDING 256
+
+#define META_FREE 0
+#define META_TOMB 1
+
+
+struct meta_file {
+    uint64_t        magic;
+    uint32_t        reclen;
+    uint32_t        cap;    /* Slots, always a power of two */
+    uint32_t        count;  /* Live records */
+    uint32_t        used;   /* Live records and tombstones */
+    uint32_t        gen;    /* Changes whenever a word is added or dropped */
+    char            pad[36];
+    struct meta_rec rec[];
+};
+
+
+/** An open, locked and mapped index */
+struct meta_map {
+    int               fd;
+    struct meta_file *file;
+    size_t            len;
+};
+
+
+/** The index being filled by a meta_fill_fn */
+static struct meta_map *building = NULL;
+
+/** A copy of the index being replaced by meta_reindex, to carry hit counts over
+ *  from, or NULL
+ */
+static struct meta_file *prior = NULL;
+
+
+/** Hits recorded by meta_hit and not yet flushed to the index */
+static struct {
+    struct meta_pending {
+        uint64_t hash;
+        time_t   atime;
+    } *hit;
+
+    size_t n;
+    size_t cap;
+} pending = { 0 };
+
+
+/** @brief Moves a key_hash out of the way of the two reserved values */
+static uint64_t meta_hash(uint64_t hash)
+{
+    return (hash <= META_TOMB) ? hash + 2 : hash;
+}
+
+
+static size_t meta_size(uint32_t cap)
+{
+    return sizeof (struct meta_file) + (size_t)cap * sizeof (struct meta_rec);
+}
+
+
+static bool meta_valid(const struct meta_file *file, size_t len)
+{
+    return len >= sizeof *file && file->magic == META_MAGIC
+        && file->reclen == sizeof (struct meta_rec)
+        && file->cap >= META_MINCAP && !(file->cap & (file->cap - 1))
+        && meta_size(file->cap) <= len
+        && file->count <= file->used && file->used < file->cap;
+}
+
+
+static void meta_unmap(struct meta_map *m)
+{
+    if (m->file) {
+        munmap(m->file, m->len);
+    }
+    close(m->fd);
+}
+
+
+/** @brief Maps the whole of the file open on @p m */
+static int meta_remap(struct meta_map *m, int prot)
+{
+    struct stat sbuf;
+
+    if (m->file) {
+        munmap(m->file, m->len);
+        m->file = NULL;
+    }
+    if (fstat(m->fd, &sbuf) || (size_t)sbuf.st_size < sizeof *m->file) {
+        return 1;
+    }
+    m->len = sbuf.st_size;
+    m->file = mmap(NULL, m->len, prot, MAP_SHARED, m->fd, 0);
+    if (m->file == MAP_FAILED) {
+        m->file = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Opens, locks and maps the index
+ *  @param lock
+ *      F_RDLCK to read it, or F_WRLCK to change it
+ *  @returns Nonzero if there is no usable index
+ */
+static int meta_map(struct meta_map *m, short lock)
+{
+    struct flock fl = { .l_type = lock, .l_whence = SEEK_SET };
+    char path[260];
+
+    m->file = NULL;
+    if (cache_auxpath(path, sizeof path, META_FILE)) {
+        return 1;
+    }
+    m->fd = open(path, (lock == F_WRLCK) ? O_RDWR : O_RDONLY);
+    if (m->fd == -1) {
+        return 1;
+    }
+    if (fcntl(m->fd, F_SETLKW, &fl) == -1
+     || meta_remap(m, (lock == F_WRLCK) ? PROT_READ | PROT_WRITE : PROT_READ)
+     || !meta_valid(m->file, m->len)) {
+        meta_unmap(m);
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Finds the slot for @p hash
+ *  @returns The slot holding it, else the slot it would be put in
+ */
+static struct meta_rec *meta_probe(struct meta_file *file, uint64_t hash)
+{
+    struct meta_rec *tomb = NULL, *rec;
+    uint32_t i, mask = file->cap - 1;
+
+    for (i = hash & mask; ; i = (i + 1) & mask) {
+        rec = &file->rec[i];
+        if (rec->hash == hash) {
+            return rec;
+        } else if (rec->hash == META_FREE) {
+            return (tomb) ? tomb : rec;
+        } else if (rec->hash == META_TOMB && !tomb) {
+            tomb = rec;
+        }
+    }
+}
+
+
+/** @brief Rewrites the table in place with twice as many slots as it has live
+ *      records, dropping tombstones. It is marked invalid throughout
+ *  @returns Nonzero on error, after which the index must be rebuilt
+ */
+static int meta_grow(struct meta_map *m)
+{
+    struct meta_rec *live, *rec;
+    uint32_t cap, i, n = 0;
+
+    live = malloc((m->file->count + 1) * sizeof *live);
+    if (!live) {
+        return 1;
+    }
+    for (i = 0; i < m->file->cap; i++) {
+        if (m->file->rec[i].hash > META_TOMB) {
+            live[n++] = m->file->rec[i];
+        }
+    }
+    for (cap = META_MINCAP; cap < 2 * (n + 1); cap *= 2) {
+        ;
+    }
+    m->file->magic = 0;
+    if (ftruncate(m->fd, sizeof *m->file) || ftruncate(m->fd, meta_size(cap))
+     || meta_remap(m, PROT_READ | PROT_WRITE)) {
+        /* The mapping may now run past the end of the file */
+        if (m->file) {
+            munmap(m->file, m->len);
+            m->file = NULL;
+        }
+        free(live);
+        return 1;
+    }
+    m->file->reclen = sizeof *rec;
+    m->file->cap = cap;
+    m->file->count = m->file->used = n;
+    for (i = 0; i < n; i++) {
+        rec = meta_probe(m->file, live[i].hash);
+        *rec = live[i];
+    }
+    free(live);
+    m->file->magic = META_MAGIC;
+    return 0;
+}
+
+
+/** @brief Finds the record for @p word, adding an empty one if need be
+ *  @returns The record, or NULL on error
+ */
+static struct meta_rec *meta_insert(struct meta_map *m, const char *word)
+{
+    uint64_t hash = meta_hash(key_hash(word));
+    struct meta_rec *rec;
+
+    rec = meta_probe(m->file, hash);
+    if (rec->hash == hash) {
+        return rec;
+    } else if (rec->hash == META_FREE && (m->file->used + 1) * 4 > m->file->cap * 3) {
+        if (meta_grow(m)) {
+            return NULL;
+        }
+        rec = meta_probe(m->file, hash);
+    }
+    if (rec->hash == META_FREE) {
+        m->file->used++;
+    }
+    m->file->count++;
+    m->file->gen++;
+    memset(rec, 0, sizeof *rec);
+    rec->hash = hash;
+    snprintf(rec->word, sizeof rec->word, "%s", word);
+    return rec;
+}
+
+
+static void meta_set(struct meta_rec *rec, time_t atime, time_t fetched, size_t size)
+{
+    rec->atime = atime;
+    rec->fetched = fetched;
+    rec->size = (size > UINT32_MAX) ? UINT32_MAX : (uint32_t)size;
+}
+
+
+void meta_add(const char *word, time_t atime, time_t fetched, size_t size)
+{
+    struct meta_rec *rec;
+    struct meta_rec *old;
+
+    if (building && building->file && (rec = meta_insert(building, word))) {
+        meta_set(rec, atime, fetched, size);
+        if (prior && (old = meta_probe(prior, rec->hash))->hash == rec->hash) {
+            rec->hits = old->hits;
+        }
+    }
+}
+
+
+void meta_hit(const char *word)
+{
+    struct meta_pending *grown;
+    size_t want;
+
+    if (pending.n == pending.cap) {
+        want = (pending.cap) ? 2 * pending.cap : 16;
+        grown = realloc(pending.hit, want * sizeof *grown);
+        if (!grown) {
+            return;     /* Hit counts are only ever advisory */
+        }
+        pending.hit = grown;
+        pending.cap = want;
+    }
+    pending.hit[pending.n].hash = meta_hash(key_hash(word));
+    pending.hit[pending.n].atime = time(NULL);
+    if (++pending.n >= META_PENDING) {
+        meta_flush();
+    }
+}
+
+
+void meta_flush(void)
+{
+    const struct meta_pending *hit;
+    struct meta_rec *rec;
+    struct meta_map m;
+    size_t i;
+
+    if (pending.n && !meta_map(&m, F_WRLCK)) {
+        for (i = 0; i < pending.n; i++) {
+            hit = &pending.hit[i];
+            rec = meta_probe(m.file, hit->hash);
+            if (rec->hash == hit->hash) {
+                rec->atime = (hit->atime > rec->atime) ? hit->atime : rec->atime;
+                rec->hits++;
+            }
+        }
+        meta_unmap(&m);
+    }
+    free(pending.hit);
+    memset(&pending, 0, sizeof pending);
+}
+
+
+void meta_put(const char *word, time_t atime, time_t fetched, size_t size)
+{
+    struct meta_rec *rec;
+    struct meta_map m;
+
+    if (meta_map(&m, F_WRLCK)) {
+        return;
+    }
+    rec = meta_insert(&m, word);
+    if (rec) {
+        meta_set(rec, atime, fetched, size);
+    }
+    meta_unmap(&m);
+}
+
+
+void meta_drop(uint64_t hash)
+{
+    struct meta_rec *rec;
+    struct meta_map m;
+
+    hash = meta_hash(hash);
+    if (meta_map(&m, F_WRLCK)) {
+        return;
+    }
+    rec = meta_probe(m.file, hash);
+    if (rec->hash == hash) {
+        memset(rec, 0, sizeof *rec);
+        rec->hash = META_TOMB;
+        m.file->count--;
+        m.file->gen++;
+    }
+    meta_unmap(&m);
+}
+
+
+uint32_t meta_generation(void)
+{
+    struct meta_file head;
+    ssize_t got = -1;
+    char path[260];
+    int fd;
+
+    if (!cache_auxpath(path, sizeof path, META_FILE) && (fd = open(path, O_RDONLY)) != -1) {
+        got = pread(fd, &head, sizeof head, 0);
+        close(fd);
+    }
+    return (got == (ssize_t)sizeof head && head.magic == META_MAGIC) ? head.gen : 0;
+}
+
+
+/** @brief Builds the index from scratch with @p fill, unless another process
+ *      built it while this one waited for the lock. If @p force is set it is
+ *      built regardless, keeping the hit counts of the one it replaces
+ *  @returns Nonzero on error
+ */
+static int meta_rebuild(meta_fill_fn *fill, bool force)
+{
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    struct meta_map m = { .file = NULL };
+    char path[260];
+
+    if (cache_auxpath(path, sizeof path, META_FILE)) {
+        return 1;
+    }
+    m.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (m.fd == -1) {
+        dict_perror("Cannot open cache index");
+        return 1;
+    } else if (fcntl(m.fd, F_SETLKW, &fl) == -1) {
+        dict_perror("Cannot lock cache index");
+        close(m.fd);
+        return 1;
+    }
+    if (!meta_remap(&m, PROT_READ | PROT_WRITE) && meta_valid(m.file, m.len)) {
+        if (!force) {
+            meta_unmap(&m);
+            return 0;
+        } else if ((prior = malloc(m.len))) {
+            memcpy(prior, m.file, m.len);
+        }
+    }
+    if (ftruncate(m.fd, 0) || ftruncate(m.fd, meta_size(META_MINCAP))
+     || meta_remap(&m, PROT_READ | PROT_WRITE)) {
+        dict_perror("Cannot build cache index");
+        meta_unmap(&m);
+        free(prior);
+        prior = NULL;
+        return 1;
+    }
+    m.file->reclen = sizeof (struct meta_rec);
+    m.file->cap = META_MINCAP;
+    m.file->gen = (uint32_t)time(NULL);     /* Unlike that of any index before */
+    building = &m;
+    fill();
+    building = NULL;
+    free(prior);
+    prior = NULL;
+    if (m.file) {
+        m.file->magic = META_MAGIC;
+    }
+    meta_unmap(&m);
+    return 0;
+}
+
+
+static int meta_cmpname(const struct meta_rec *x, const struct meta_rec *y)
+{
+    return strcmp(x->word, y->word);
+}
+
+
+#define META_CMPDESC(field)                                             \
+static int meta_cmp##field(const void *a, const void *b)               \
+{                                                                       \
+    const struct meta_rec *x = *(const struct meta_rec *const *)a;      \
+    const struct meta_rec *y = *(const struct meta_rec *const *)b;      \
+                                                                        \
+    if (x->field != y->field) {                                         \
+        return (x->field < y->field) - (x->field > y->field);           \
+    }                                                                   \
+    return meta_cmpname(x, y);                                          \
+}
+
+META_CMPDESC(atime)
+META_CMPDESC(fetched)
+META_CMPDESC(size)
+META_CMPDESC(hits)
+
+#undef META_CMPDESC
+
+
+static int meta_cmpword(const void *a, const void *b)
+{
+    return meta_cmpname(*(const struct meta_rec *const *)a,
+                        *(const struct meta_rec *const *)b);
+}
+
+
+static const struct {
+    const char    *name;
+    enum meta_sort sort;
+    int          (*cmp)(const void *, const void *);
+} sorts[] = {
+    { "name",    META_SORT_NAME,    meta_cmpword    },
+    { "access",  META_SORT_ACCESS,  meta_cmpatime   },
+    { "fetched", META_SORT_FETCHED, meta_cmpfetched },
+    { "size",    META_SORT_SIZE,    meta_cmpsize    },
+    { "hits",    META_SORT_HITS,    meta_cmphits    }
+};
+
+
+int meta_sort_key(const char *name, enum meta_sort *sort)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof sorts / sizeof *sorts; i++) {
+        if (!strcmp(name, sorts[i].name)) {
+            *sort = sorts[i].sort;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+int meta_reindex(meta_fill_fn *fill)
+{
+    meta_flush();
+    return meta_rebuild(fill, true);
+}
+
+
+int meta_each(meta_fill_fn *fill, meta_each_fn *fn, void *ctx)
+{
+    const struct meta_rec *rec;
+    struct meta_map m;
+    size_t i;
+
+    meta_flush();
+    if (meta_map(&m, F_RDLCK) && (meta_rebuild(fill, false) || meta_map(&m, F_RDLCK))) {
+        return 1;
+    }
+    for (i = 0; i < m.file->cap; i++) {
+        rec = &m.file->rec[i];
+        if (rec->hash > META_TOMB) {
+            fn(rec->word, ctx);
+        }
+    }
+    meta_unmap(&m);
+    return 0;
+}
+
+
+long meta_query(const struct meta_query *q,
+                meta_fill_fn            *fill,
+                struct meta_rec        **rows,
+                size_t                  *total,
+                size_t                  *bytes)
+{
+    const struct meta_rec **match, *rec;
+    size_t i, n = 0, first, count;
+    struct meta_map m;
+
+    *rows = NULL;
+    *total = *bytes = 0;
+    meta_flush();
+    if (meta_map(&m, F_RDLCK) && (meta_rebuild(fill, false) || meta_map(&m, F_RDLCK))) {
+        return -1;
+    }
+    match = malloc((m.file->count + 1) * sizeof *match);
+    if (!match) {
+        meta_unmap(&m);
+        return -1;
+    }
+    for (i = 0; i < m.file->cap; i++) {
+        rec = &m.file->rec[i];
+        if (rec->hash <= META_TOMB) {
+            continue;
+        }
+        ++*total;
+        *bytes += rec->size;
+        if ((!q->glob || !fnmatch(q->glob, rec->word, 0)) && n < m.file->count) {
+            match[n++] = rec;
+        }
+    }
+    qsort(match, n, sizeof *match, sorts[q->sort].cmp);
+    first = (q->offset < n) ? q->offset : n;
+    count = n - first;
+    if (q->limit && q->limit < count) {
+        count = q->limit;
+    }
+    *rows = malloc((count + 1) * sizeof **rows);
+    if (*rows) {
+        for (i = 0; i < count; i++) {
+            (*rows)[i] = *match[first + i];
+        }
+    }
+    free(match);
+    meta_unmap(&m);
+    return (*rows) ? (long)count : -1;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef DICT_META_H
+#define DICT_META_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "key.h"
+
+
+/** What the index knows about one entry of the user's cache. These are kept
+ *  in a single file of fixed-size records, so that listing the cache reads
+ *  that file from start to end instead of opening every entry
+ */
+struct meta_rec {
+    uint64_t hash;      /* key_hash of the word. 0 is free, 1 is deleted */
+    int64_t  atime;
+    int64_t  fetched;
+    uint32_t size;      /* Of the entry file, in bytes */
+    uint32_t hits;
+    char     word[KEY_MAXLEN];
+};
+
+
+enum meta_sort {
+    META_SORT_NAME,
+    META_SORT_ACCESS,   /* Most recently read first */
+    META_SORT_FETCHED,  /* Most recently fetched first */
+    META_SORT_SIZE,     /* Largest first */
+    META_SORT_HITS      /* Most read first */
+};
+
+
+struct meta_query {
+    const char    *glob;    /* Only words matching this pattern, or NULL */
+    enum meta_sort sort;
+    size_t         offset;  /* Rows to skip, after sorting */
+    size_t         limit;   /* The most rows returned, or 0 for all */
+};
+
+
+/** Called to fill an index that is missing or damaged, by calling meta_add for
+ *  every entry in the cache
+ */
+typedef void meta_fill_fn(void);
+
+
+/** Called by meta_each for every indexed word */
+typedef void meta_each_fn(const char *word, void *ctx);
+
+
+/** @brief Adds an entry to the index being filled. Only valid within a
+ *      meta_fill_fn
+ */
+void meta_add(const char *word, time_t atime, time_t fetched, size_t size);
+
+
+/** @brief Records that @p word was just read from the cache. This only notes
+ *      the hit in memory, so that reads never wait on the index; meta_flush
+ *      applies it
+ */
+void meta_hit(const char *word);
+
+
+/** @brief Applies the hits recorded since the last flush to the index, under
+ *      one lock. Hits on words not in the index, or with no index yet, are
+ *      dropped
+ */
+void meta_flush(void);
+
+
+/** @brief Records that @p word was written to the cache. Its hit count is
+ *      kept if it was already indexed
+ */
+void meta_put(const char *word, time_t atime, time_t fetched, size_t size);
+
+
+/** @brief Forgets the entry whose key hashes to @p hash */
+void meta_drop(uint64_t hash);
+
+
+/** @brief Reads the generation of the index, which changes whenever a word is
+ *      added to it or dropped from it, without locking it
+ *  @returns The generation, or zero if there is no index
+ */
+uint32_t meta_generation(void);
+
+
+/** @brief Selects rows from the index, building it first with @p fill if it is
+ *      missing or damaged
+ *  @param[out] rows
+ *      The selected rows, in order, which the caller must free
+ *  @param[out] total
+ *      The number of entries in the index, matching or not
+ *  @param[out] bytes
+ *      Their total size
+ *  @returns The number of rows, or -1 on error
+ */
+long meta_query(const struct meta_query *q,
+                meta_fill_fn            *fill,
+                struct meta_rec        **rows,
+                size_t                  *total,
+                size_t                  *bytes);
+
+
+/** @brief Rebuilds the index from scratch with @p fill, even if it is intact.
+ *      Words still present keep their hit counts, which nothing else records
+ *  @returns Nonzero on error
+ */
+int meta_reindex(meta_fill_fn *fill);
+
+
+/** @brief Passes every indexed word to @p fn, in no particular order, building
+ *      the index first with @p fill if it is missing or damaged. The index is
+ *      read-locked throughout, so @p fn must not change it
+ *  @returns Nonzero on error
+ */
+int meta_each(meta_fill_fn *fill, meta_each_fn *fn, void *ctx);
+
+
+/** @brief Looks up the sort order called @p name: name, access, fetched, size
+ *      or hits
+ *  @returns Nonzero if there is none by that name
+ */
+int meta_sort_key(const char *name, enum meta_sort *sort);
+
+
+#endif /* DICT_META_H */
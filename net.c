@@ -0,0 +1,398 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <strings.h>
+
+#include "net.h"
+#include "cache.h"
+#include "key.h"
+#include "log.h"
+#include "trace.h"
+
+/** The API root. Override this at runtime with DICT_ENDPOINT, or list several
+ *  roots in DICT_BACKENDS, primary first
+ */
+#ifndef NET_ENDPOINT
+#   define NET_ENDPOINT "https://api.dictionaryapi.dev/api/v2/entries/en/"
+#endif
+
+/** The initial capacity of a reply buffer. Most replies fit in this */
+#define NET_BUFSIZE 16384
+
+/** State libcurl can carry between processes, kept beside the cache */
+#define NET_ALTSVC  "altsvc"
+#define NET_HSTS    "hsts"
+#define NET_RESOLVE "resolve"
+
+/** Seconds a remembered address is used before it is resolved again. The API
+ *  does not tell us its DNS TTL, so this is deliberately short
+ */
+#define NET_RESOLVE_TTL 600
+
+
+static struct {
+    char       *list;       /* Storage for the roots below */
+    const char *root[NET_MAXBACKENDS];
+    int         count;
+} backends = { 0 };
+
+
+static struct {
+    char host[256];
+    long port;
+    bool parsed;
+
+    struct curl_slist *pinned;  /* The remembered address, if still fresh */
+    bool               loaded;
+    bool               learned;
+} net = { 0 };
+
+
+int net_backends(const char *const **roots)
+{
+    static const char *delim = " \t\n,";
+    const char *env;
+    char *save, *tok;
+
+    if (!backends.count) {
+        env = getenv("DICT_BACKENDS");
+        backends.list = (env) ? strdup(env) : NULL;
+        for (tok = (backends.list) ? strtok_r(backends.list, delim, &save) : NULL;
+             tok && backends.count < NET_MAXBACKENDS;
+             tok = strtok_r(NULL, delim, &save)) {
+            backends.root[backends.count++] = tok;
+        }
+    }
+    if (!backends.count) {
+        env = getenv("DICT_ENDPOINT");
+        backends.root[backends.count++] = (env && *env) ? env : NET_ENDPOINT;
+    }
+    *roots = backends.root;
+    return backends.count;
+}
+
+
+/** @brief Retrieves the primary backend */
+static const char *net_endpoint(void)
+{
+    const char *const *roots;
+
+    net_backends(&roots);
+    return roots[0];
+}
+
+
+/** @brief Splits the endpoint into the host and port that CURLOPT_RESOLVE
+ *      entries are keyed on
+ *  @returns Nonzero if the endpoint could not be parsed
+ */
+static int net_parse_endpoint(void)
+{
+    char *host = NULL, *port = NULL;
+    CURLU *url;
+    int res = 1;
+
+    if (net.parsed) {
+        return net.host[0] == '\0';
+    }
+    net.parsed = true;
+    url = curl_url();
+    if (url && !curl_url_set(url, CURLUPART_URL, net_endpoint(), 0)
+     && !curl_url_get(url, CURLUPART_HOST, &host, 0)
+     && !curl_url_get(url, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT)
+     && strlen(host) < sizeof net.host) {
+        strcpy(net.host, host);
+        net.port = strtol(port, NULL, 10);
+        res = 0;
+    }
+    curl_free(host);
+    curl_free(port);
+    curl_url_cleanup(url);
+    return res;
+}
+
+
+/** @brief Reads the remembered address for the endpoint, if it has not expired
+ *      and no proxy would make it meaningless
+ */
+static void net_load_resolve(void)
+{
+    char path[260], host[256], addr[64], entry[384];
+    long long expiry;
+    long port;
+    FILE *fp;
+
+    net.loaded = true;
+    if (getenv("all_proxy") || getenv("https_proxy") || getenv("http_proxy")
+     || net_parse_endpoint() || cache_auxpath(path, sizeof path, NET_RESOLVE)) {
+        net.learned = true;     /* Nothing worth remembering either */
+        return;
+    }
+    fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    if (fscanf(fp, "%255s %ld %63s %lld", host, &port, addr, &expiry) == 4
+     && !strcmp(host, net.host) && port == net.port && expiry > time(NULL)) {
+        snprintf(entry, sizeof entry, "%s:%ld:%s", host, port, addr);
+        net.pinned = curl_slist_append(NULL, entry);
+        net.learned = net.pinned != NULL;
+    }
+    fclose(fp);
+}
+
+
+/** @brief Saves the address @p hcurl connected to, so that the next process
+ *      can skip DNS resolution
+ */
+static void net_save_resolve(CURL *hcurl)
+{
+    char path[260], tmp[270];
+    char *addr = NULL;
+    FILE *fp;
+
+    net.learned = true;
+    if (curl_easy_getinfo(hcurl, CURLINFO_PRIMARY_IP, &addr) || !addr || !*addr
+     || cache_auxpath(path, sizeof path, NET_RESOLVE)) {
+        return;
+    }
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+    fp = fopen(tmp, "w");
+    if (fp) {
+        fprintf(fp, "%s %ld %s %lld\n", net.host, net.port, addr,
+                (long long)time(NULL) + NET_RESOLVE_TTL);
+        if (fclose(fp) || rename(tmp, path)) {
+            remove(tmp);
+        }
+    }
+}
+
+
+void net_tune(CURL *hcurl)
+{
+    char path[260];
+    bool tls;
+
+    /* Both caches only ever apply to HTTPS, and rewriting them is not free */
+    tls = !strncmp(net_endpoint(), "https:", 6);
+    if (tls && !cache_auxpath(path, sizeof path, NET_ALTSVC)) {
+        curl_easy_setopt(hcurl, CURLOPT_ALTSVC_CTRL, (long)(CURLALTSVC_H1 | CURLALTSVC_H2 | CURLALTSVC_H3));
+        curl_easy_setopt(hcurl, CURLOPT_ALTSVC, path);
+    }
+    if (tls && !cache_auxpath(path, sizeof path, NET_HSTS)) {
+        curl_easy_setopt(hcurl, CURLOPT_HSTS_CTRL, (long)CURLHSTS_ENABLE);
+        curl_easy_setopt(hcurl, CURLOPT_HSTS, path);
+    }
+    if (!net.loaded) {
+        net_load_resolve();
+    }
+    if (net.pinned) {
+        curl_easy_setopt(hcurl, CURLOPT_RESOLVE, net.pinned);
+    }
+    /* Each of these is ignored where libcurl or the OS lacks support */
+    curl_easy_setopt(hcurl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(hcurl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(hcurl, CURLOPT_TCP_FASTOPEN, 1L);
+}
+
+
+void net_learn(CURL *hcurl, CURLcode result)
+{
+    char path[260];
+
+    if (result == CURLE_COULDNT_CONNECT && net.pinned) {
+        /* The remembered address went stale before its time */
+        if (!cache_auxpath(path, sizeof path, NET_RESOLVE)) {
+            remove(path);
+        }
+    } else if (!result && !net.learned && net.host[0]) {
+        net_save_resolve(hcurl);
+    }
+}
+
+
+void net_buf_reset(struct net_buf *buf)
+{
+    memset(&buf->val, 0, sizeof buf->val);
+    buf->len = 0;
+    if (buf->data) {
+        buf->data[0] = '\0';
+    }
+}
+
+
+void net_buf_free(struct net_buf *buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof *buf);
+}
+
+
+/** @brief Ensures @p buf can hold @p len more bytes and the nul terminator */
+static int net_buf_reserve(struct net_buf *buf, size_t len)
+{
+    size_t cap;
+    char *data;
+
+    if (buf->len + len < buf->cap) {
+        return 0;
+    }
+    cap = (buf->cap) ? buf->cap : NET_BUFSIZE;
+    while (cap <= buf->len + len) {
+        cap *= 2;
+    }
+    data = realloc(buf->data, cap);
+    if (!data) {
+        return 1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+
+static size_t net_write_cb(char *ptr, size_t size, size_t nmemb, void *usrdata)
+{
+    struct net_buf *buf = usrdata;
+
+    (void)size;
+
+    TRACE(CURL_WRITE, NULL, nmemb, 0);
+    if (net_buf_reserve(buf, nmemb)) {
+        return 0;   /* Aborts the transfer with CURLE_WRITE_ERROR */
+    }
+    memcpy(buf->data + buf->len, ptr, nmemb);
+    buf->len += nmemb;
+    buf->data[buf->len] = '\0';
+    return nmemb;
+}
+
+
+/** @brief Copies the value of the header in @p ptr, @p len bytes long, to
+ *      @p dst, dropping the name's @p skip bytes and surrounding whitespace
+ */
+static void net_header_value(const char *ptr, size_t len, size_t skip, char dst[CACHE_VALIDLEN])
+{
+    ptr += skip;
+    len -= skip;
+    while (len && (*ptr == ' ' || *ptr == '\t')) {
+        ptr++;
+        len--;
+    }
+    while (len && (ptr[len - 1] == ' ' || ptr[len - 1] == '\t'
+                || ptr[len - 1] == '\r' || ptr[len - 1] == '\n')) {
+        len--;
+    }
+    if (len < CACHE_VALIDLEN && !memchr(ptr, '\n', len)) {
+        memcpy(dst, ptr, len);
+        dst[len] = '\0';
+    }
+}
+
+
+/** @brief Keeps the validators among the reply's headers. Each response, such
+ *      as one before a redirect, starts over
+ */
+static size_t net_header_cb(char *ptr, size_t size, size_t nmemb, void *usrdata)
+{
+    struct net_buf *buf = usrdata;
+
+    (void)size;
+
+    if (nmemb > 5 && !strncmp(ptr, "HTTP/", 5)) {
+        memset(&buf->val, 0, sizeof buf->val);
+    } else if (nmemb > 5 && !strncasecmp(ptr, "etag:", 5)) {
+        net_header_value(ptr, nmemb, 5, buf->val.etag);
+    } else if (nmemb > 14 && !strncasecmp(ptr, "last-modified:", 14)) {
+        net_header_value(ptr, nmemb, 14, buf->val.modified);
+    }
+    return nmemb;
+}
+
+
+int net_prepare(CURL *hcurl, const char *word, struct net_buf *buf)
+{
+    return net_prepare_at(hcurl, net_endpoint(), word, buf);
+}
+
+
+int net_prepare_at(CURL           *hcurl,
+                   const char     *root,
+                   const char     *word,
+                   struct net_buf *buf)
+{
+    char url[256 + 3 * KEY_MAXLEN], path[3 * KEY_MAXLEN];
+    int res;
+
+    res = key_escape(word, path, sizeof path);
+    if (!res) {
+        res = snprintf(url, sizeof url, "%s%s", root, path);
+    }
+    if (res < 0 || (unsigned)res >= sizeof url) {
+        dict_logf(DICT_ERROR, "Word too long for request URL: %s", word);
+        return 1;
+    }
+    return net_prepare_url(hcurl, url, buf);
+}
+
+
+int net_prepare_url(CURL *hcurl, const char *url, struct net_buf *buf)
+{
+    net_buf_reset(buf);
+    if (net_buf_reserve(buf, 0)) {
+        dict_perror("Cannot allocate reply buffer");
+        return 1;
+    }
+    buf->data[0] = '\0';
+    curl_easy_setopt(hcurl, CURLOPT_URL, url);
+    curl_easy_setopt(hcurl, CURLOPT_WRITEFUNCTION, net_write_cb);
+    curl_easy_setopt(hcurl, CURLOPT_WRITEDATA, buf);
+    curl_easy_setopt(hcurl, CURLOPT_HEADERFUNCTION, net_header_cb);
+    curl_easy_setopt(hcurl, CURLOPT_HEADERDATA, buf);
+    return 0;
+}
+
+
+/** @brief Appends the header @p name: @p value to @p *hdrs, unless @p value is
+ *      empty
+ */
+static int net_append(struct curl_slist **hdrs, const char *name, const char *value)
+{
+    char line[CACHE_VALIDLEN + 32];
+    struct curl_slist *next;
+
+    if (!value[0]) {
+        return 0;
+    }
+    snprintf(line, sizeof line, "%s: %s", name, value);
+    next = curl_slist_append(*hdrs, line);
+    if (!next) {
+        return 1;
+    }
+    *hdrs = next;
+    return 0;
+}
+
+
+int net_condition(CURL                          *hcurl,
+                  const struct cache_validators *val,
+                  struct curl_slist            **hdrs)
+{
+    int res = 0;
+
+    curl_slist_free_all(*hdrs);
+    *hdrs = NULL;
+    if (val) {
+        res = net_append(hdrs, "If-None-Match", val->etag)
+           || net_append(hdrs, "If-Modified-Since", val->modified);
+    }
+    if (res) {
+        curl_slist_free_all(*hdrs);
+        *hdrs = NULL;
+    }
+    curl_easy_setopt(hcurl, CURLOPT_HTTPHEADER, *hdrs);
+    return res;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#ifndef DICT_NET_H
+#define DICT_NET_H
+
+#include <stddef.h>
+
+#include "cache.h"
+#include "curlfn.h"
+
+/** The most backends that may be listed in DICT_BACKENDS */
+#define NET_MAXBACKENDS 4
+
+
+/** Growable buffer that a transfer writes its reply into. The contents are
+ *  always nul-terminated
+ */
+struct net_buf {
+    char  *data;
+    size_t len;
+    size_t cap;
+
+    struct cache_validators val;    /* From the reply's headers */
+};
+
+
+/** @brief Discards the contents of @p buf, keeping its storage */
+void net_buf_reset(struct net_buf *buf);
+
+
+/** @brief Releases the storage held by @p buf */
+void net_buf_free(struct net_buf *buf);
+
+
+/** @brief Applies the options every handle should use: HTTP/2, compressed
+ *      replies, TCP fast open, and the Alt-Svc, HSTS and DNS results persisted
+ *      by earlier processes. Call this once, when the handle is created
+ */
+void net_tune(CURL *hcurl);
+
+
+/** @brief Records what a completed transfer on @p hcurl learned about the
+ *      endpoint, such as its address, for later processes
+ */
+void net_learn(CURL *hcurl, CURLcode result);
+
+
+/** @brief Retrieves the configured API roots, primary first. These come from
+ *      the list in DICT_BACKENDS, else DICT_ENDPOINT, else the public API
+ *  @returns The number of roots written to @p roots, which is at least one
+ */
+int net_backends(const char *const **roots);
+
+
+/** @brief Points @p hcurl at the entry for @p word on the primary backend and
+ *      directs its reply into @p buf, which is reset first. @p word is
+ *      percent-encoded into the URL
+ *  @returns Nonzero if the request could not be set up
+ */
+int net_prepare(CURL *hcurl, const char *word, struct net_buf *buf);
+
+
+/** @brief Like net_prepare, but for the backend whose API root is @p root */
+int net_prepare_at(CURL           *hcurl,
+                   const char     *root,
+                   const char     *word,
+                   struct net_buf *buf);
+
+
+/** @brief Points @p hcurl at @p url, which must already be escaped, and
+ *      directs its reply into @p buf, which is reset first. The reply's
+ *      validators are kept in @p buf too
+ *  @returns Nonzero if the request could not be set up
+ */
+int net_prepare_url(CURL *hcurl, const char *url, struct net_buf *buf);
+
+
+/** @brief Makes the next request on @p hcurl conditional, so that the server
+ *      answers 304 with no body if the reply @p val came with is unchanged.
+ *      NULL, or empty validators, make it unconditional again
+ *  @param[in,out] hdrs
+ *      The header list the condition is built in, which is freed first. It
+ *      must outlive the transfer, and be freed with curl_slist_free_all
+ *  @returns Nonzero on error, leaving the request unconditional
+ */
+int net_condition(CURL                          *hcurl,
+                  const struct cache_validators *val,
+                  struct curl_slist            **hdrs);
+
+
+#endif /* DICT_NET_H */
@@ -1,4 +1,6 @@
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "opt.h"
@@ -29,42 +31,159 @@ static int arg_type(const char *arg)
 
 static int dict_opt_word(const char *word, struct options *opt)
 {
-    if (opt->word) {
+    if (opt->nwords == OPT_MAXWORDS) {
+        dict_logf(DICT_WARN, "Too many words; ignoring %s", word);
         return 1;
-    } else {
-        opt->word = word;
-        return 0;
     }
+    opt->words[opt->nwords++] = word;
+    opt->word = opt->words[0];
+    return 0;
+}
+
+
+/** Long-only options are given codes outside the range of the short ones */
+enum {
+    OPT_WARM = 0x100,
+    OPT_EXPORT,
+    OPT_IMPORT,
+    OPT_TRACE,
+    OPT_BRIEF,
+    OPT_SAY,
+    OPT_DEADLINE,
+    OPT_SORT,
+    OPT_LIMIT,
+    OPT_OFFSET,
+    OPT_REVALIDATE,
+    OPT_TIMING,
+    OPT_FREEZE,
+    OPT_FSCK
+};
+
+
+static const struct longopt {
+    const char *name;
+    int         code;
+    bool        arg;    /* Consumes the following argument */
+} longs[] = {
+    { "brief",         OPT_BRIEF,      true  },
+    { "deadline",      OPT_DEADLINE,   true  },
+    { "export",        OPT_EXPORT,     true  },
+    { "force",         'f',            false },
+    { "freeze",        OPT_FREEZE,     true  },
+    { "fsck",          OPT_FSCK,       false },
+    { "help",          'h',            false },
+    { "import-bundle", OPT_IMPORT,     true  },
+    { "interactive",   'i',            false },
+    { "limit",         OPT_LIMIT,      true  },
+    { "list",          'l',            false },
+    { "offset",        OPT_OFFSET,     true  },
+    { "page",          'p',            false },
+    { "remove",        'r',            false },
+    { "revalidate",    OPT_REVALIDATE, true  },
+    { "say",           OPT_SAY,        false },
+    { "skip",          's',            false },
+    { "sort",          OPT_SORT,       true  },
+    { "timing",        OPT_TIMING,     false },
+    { "trace",         OPT_TRACE,      false },
+    { "warm",          OPT_WARM,       true  }
+};
+
+
+/** @brief Applies the option identified by @p code, with its argument @p arg
+ *      if it takes one
+ *  @returns Nonzero if @p code is not a known option
+ */
+static int dict_opt_set(int code, const char *arg, struct options *opt)
+{
+    switch (code) {
+    case 'f':
+        opt->force = true;
+        break;
+    case 'h':
+        opt->help = true;
+        break;
+    case 'i':
+        opt->interactive = true;
+        break;
+    case 'l':
+        opt->list_history = true;
+        break;
+    case 'p':
+        opt->page = true;
+        break;
+    case 'r':
+        opt->remove = true;
+        break;
+    case 's':
+        opt->skip = true;
+        break;
+    case OPT_WARM:
+        opt->warm = arg;
+        break;
+    case OPT_EXPORT:
+        opt->export = arg;
+        break;
+    case OPT_IMPORT:
+        opt->import = arg;
+        break;
+    case OPT_FREEZE:
+        opt->freeze = arg;
+        break;
+    case OPT_FSCK:
+        opt->fsck = true;
+        break;
+    case OPT_TRACE:
+        opt->trace = true;
+        break;
+    case OPT_TIMING:
+        opt->timing = true;
+        break;
+    case OPT_SAY:
+        opt->say = true;
+        break;
+    case OPT_BRIEF:
+        opt->brief = (unsigned)strtoul(arg, NULL, 10);
+        if (!opt->brief) {
+            dict_logf(DICT_WARN, "--brief needs a positive count, not %s", arg);
+        }
+        break;
+    case OPT_DEADLINE:
+        opt->deadline = (unsigned)strtoul(arg, NULL, 10);
+        if (!opt->deadline) {
+            dict_logf(DICT_WARN, "--deadline needs a positive count of milliseconds, not %s", arg);
+        }
+        break;
+    case OPT_SORT:
+        if (meta_sort_key(arg, &opt->list.sort)) {
+            dict_logf(DICT_WARN, "Cannot sort by %s: use name, access, fetched, size or hits", arg);
+        }
+        break;
+    case OPT_LIMIT:
+        opt->list.limit = strtoul(arg, NULL, 10);
+        if (!opt->list.limit) {
+            dict_logf(DICT_WARN, "--limit needs a positive count, not %s", arg);
+        }
+        break;
+    case OPT_OFFSET:
+        opt->list.offset = strtoul(arg, NULL, 10);
+        break;
+    case OPT_REVALIDATE:
+        opt->revalidate = true;
+        opt->stale = (unsigned)strtoul(arg, NULL, 10);
+        break;
+    default:
+        return 1;
+    }
+    return 0;
 }
 
 
 static int dict_opt_short(const char *optstr, struct options *opt)
 {
-    static const char *shorts = "fhlrs";
-    const char *i;
     int res = 0;
-    char c;
 
     for (; *optstr; optstr++) {
-        i = strchr(shorts, *optstr);
-        c = (i) ? *i : '\0';
-        switch (c) {
-        case 'f':
-            opt->force = true;
-            break;
-        case 'h':
-            opt->help = true;
-            break;
-        case 'l':
-            opt->list_history = true;
-            break;
-        case 'r':
-            opt->remove = true;
-            break;
-        case 's':
-            opt->skip = true;
-            break;
-        default:
+        if (dict_opt_set(*optstr, NULL, opt)) {
             dict_logf(DICT_WARN, "Unrecognized short option %c", *optstr);
             res = 1;
         }
@@ -73,32 +192,42 @@ static int dict_opt_short(const char *optstr, struct options *opt)
 }
 
 
-static int dict_opt_long(const char *longopt, struct options *opt)
+/** @brief Parses the long option @p longopt, which may be given as --name=ARG
+ *      or --name ARG. @p next is the following command line argument, or NULL
+ *  @returns The number of command line arguments consumed after @p longopt
+ */
+static int dict_opt_long(const char *longopt, const char *next, struct options *opt)
 {
-    static const char *longs[] = {
-        "force",
-        "help",
-        "list",
-        "remove",
-        "skip"
-    };
-    int res = 0;
+    const size_t N = sizeof longs / sizeof *longs;
+    const char *eq, *arg = NULL;
+    size_t i, len;
+    int used = 0;
 
-    if (!strcmp(longopt, longs[0])) {
-        opt->force = true;
-    } else if (!strcmp(longopt, longs[1])) {
-        opt->help = true;
-    } else if (!strcmp(longopt, longs[2])) {
-        opt->list_history = true;
-    } else if (!strcmp(longopt, longs[3])) {
-        opt->remove = true;
-    } else if (!strcmp(longopt, longs[4])) {
-        opt->skip = true;
-    } else {
+    eq = strchr(longopt, '=');
+    len = (eq) ? (size_t)(eq - longopt) : strlen(longopt);
+    for (i = 0; i < N; i++) {
+        if (strlen(longs[i].name) == len && !strncmp(longopt, longs[i].name, len)) {
+            break;
+        }
+    }
+    if (i == N) {
         dict_logf(DICT_WARN, "Unrecognized long option %s", longopt);
-        res = 1;
+    } else if (!longs[i].arg) {
+        dict_opt_set(longs[i].code, NULL, opt);
+    } else {
+        if (eq) {
+            arg = eq + 1;
+        } else if (next) {
+            arg = next;
+            used = 1;
+        }
+        if (arg) {
+            dict_opt_set(longs[i].code, arg, opt);
+        } else {
+            dict_logf(DICT_WARN, "Option --%s requires an argument", longs[i].name);
+        }
     }
-    return res;
+    return used;
 }
 
 
@@ -115,7 +244,7 @@ void dict_opt_parse(int argc, char *argv[], struct options *opt)
             dict_opt_short(argv[idx] + 1, opt);
             break;
         case OPT_LONG:
-            dict_opt_long(argv[idx] + 2, opt);
+            idx += dict_opt_long(argv[idx] + 2, argv[idx + 1], opt);
             break;
         }
     }
@@ -127,9 +256,41 @@ const char *dict_opt_string(void)
     static const char *opts =
     "  -f, --force      always make a web request, do not use the cache\n"
     "  -h, --help       show this help message\n"
-    "  -l, --list       list the entries currently in the cache\n"
+    "  -i, --interactive\n"
+    "                   prompt for words until EOF, keeping state between them\n"
+    "  -l, --list       list the words in the cache, or those matching the glob\n"
+    "                   WORD\n"
+    "  -p, --page       show long entries a screenful at a time\n"
     "  -r, --remove     remove WORD from the cache\n"
-    "  -s, --skip       do not save this definition to the disk cache\n";
+    "  -s, --skip       do not save this definition to the disk cache\n"
+    "      --brief N    show only the first N definitions of each part of speech\n"
+    "      --say        play the pronunciation of WORD after its entry\n"
+    "      --sort KEY   order -l by name, access, fetched, size or hits\n"
+    "      --limit N    list at most N words\n"
+    "      --offset N   skip the first N words of the list\n"
+    "      --deadline MS\n"
+    "                   give up on the network after MS milliseconds (default\n"
+    "                   4000) and show what the cache holds instead\n"
+    "      --warm FILE  fetch every uncached word listed in FILE into the cache\n"
+    "      --revalidate DAYS\n"
+    "                   ask the API whether each entry fetched DAYS or more days\n"
+    "                   ago has changed, or every entry if DAYS is 0, update\n"
+    "                   the ones that have, and remove those it no longer has\n"
+    "      --export BUNDLE\n"
+    "                   write the whole cache to the single file BUNDLE\n"
+    "      --import-bundle BUNDLE\n"
+    "                   merge BUNDLE into the cache, keeping the newer of each\n"
+    "                   entry\n"
+    "      --fsck       check every entry in the cache, move damaged ones aside,\n"
+    "                   and rebuild the index\n"
+    "      --freeze IMAGE\n"
+    "                   compile the cache into the read-only image IMAGE. The\n"
+    "                   image at /var/cache/dict.img, or at DICT_FROZEN if set,\n"
+    "                   is searched before any cache\n"
+    "      --trace      print the cache, network and rate limiter events recorded\n"
+    "                   by this query to stderr\n"
+    "      --timing     print the time and memory each phase of this query took\n"
+    "                   to stderr\n";
 
     return opts;
 }
@@ -5,16 +5,38 @@
 
 #include <stdbool.h>
 
+#include "meta.h"
+
+/** The most words one command may look up */
+#define OPT_MAXWORDS 64
+
 
 struct options {
-    const char *word;
+    const char *word;   /* The word being acted on, the first until then */
+    const char *words[OPT_MAXWORDS];
+    unsigned    nwords;
+    const char *warm;   /* Word list to pre-fetch into the cache */
+    const char *export; /* Bundle to write the cache to */
+    const char *import; /* Bundle to merge into the cache */
+    const char *freeze; /* Image to compile the cache into */
+    unsigned    brief;  /* Definitions shown per part of speech, or 0 for all */
+    unsigned    deadline; /* Network budget in ms, or 0 for the default */
+    unsigned    stale;  /* Age in days at which --revalidate checks an entry */
+    struct meta_query list; /* How -l selects and orders words */
 
     /** These are listed in order of precedence */
-    bool list_history;  /* Walk the cache dir and print each word */
+    bool interactive;   /* Prompt for words until EOF */
+    bool list_history;  /* List the words in the cache */
     bool remove;        /* Delete WORD from the cache */
     bool force;         /* Always call the REST API, do not use the cache */
     bool skip;          /* Do not cache this definition */
+    bool page;          /* Show the entry a screenful at a time */
+    bool say;           /* Play the pronunciation after the entry */
     bool help;          /* Show usage */
+    bool trace;         /* Dump the trace ring when done */
+    bool timing;        /* Report time and memory per phase when done */
+    bool revalidate;    /* Ask the API which cached entries have changed */
+    bool fsck;          /* Check the cache and rebuild its index */
 };
 
 
@@ -0,0 +1,115 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "page.h"
+
+#define PAGE_PROMPT "\e[7m--More-- (space, enter, q)\e[0m"
+
+
+static struct {
+    int  tty;       /* Where keys are read from */
+    int  rows;
+    int  shown;     /* Lines shown since the reader last pressed a key */
+    bool quit;
+} page = { .tty = -1 };
+
+
+/** @brief Waits for a single key, without echo or line buffering. The terminal
+ *      is only altered for the duration of the read, so that a signal cannot
+ *      leave it that way
+ */
+static int page_key(void)
+{
+    struct termios saved, raw;
+    unsigned char key;
+    ssize_t res;
+
+    if (tcgetattr(page.tty, &saved)) {
+        return 'q';
+    }
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(page.tty, TCSANOW, &raw);
+    res = read(page.tty, &key, 1);
+    tcsetattr(page.tty, TCSANOW, &saved);
+    return (res == 1) ? key : 'q';
+}
+
+
+/** @brief Shows the prompt and acts on the reader's answer */
+static void page_prompt(void)
+{
+    fputs(PAGE_PROMPT, stdout);
+    fflush(stdout);
+    switch (page_key()) {
+    case 'q':
+    case 'Q':
+    case 4:     /* ^D */
+        page.quit = true;
+        break;
+    case '\n':
+    case '\r':
+    case 'j':
+        page.shown--;
+        break;
+    default:
+        page.shown = 0;
+        break;
+    }
+    fputs("\r\e[K", stdout);
+}
+
+
+bool page_begin(void)
+{
+    struct winsize ws;
+
+    if (!isatty(STDOUT_FILENO) || ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) || ws.ws_row < 2) {
+        return false;
+    }
+    page.tty = open("/dev/tty", O_RDONLY | O_CLOEXEC);
+    if (page.tty == -1) {
+        return false;
+    }
+    page.rows = ws.ws_row;
+    page.shown = 0;
+    page.quit = false;
+    return true;
+}
+
+
+bool page_write(const char *text, size_t len)
+{
+    const char *end = text + len, *eol;
+
+    while (text < end && !page.quit) {
+        if (page.shown >= page.rows - 1) {
+            page_prompt();
+            continue;
+        }
+        eol = memchr(text, '\n', end - text);
+        eol = (eol) ? eol + 1 : end;
+        fwrite(text, 1, eol - text, stdout);
+        page.shown += eol[-1] == '\n';
+        text = eol;
+    }
+    return !page.quit;
+}
+
+
+void page_end(void)
+{
+    if (page.tty != -1) {
+        close(page.tty);
+        page.tty = -1;
+    }
+    fflush(stdout);
+}
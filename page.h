@@ -0,0 +1,30 @@
+#pragma once
+
+#ifndef DICT_PAGE_H
+#define DICT_PAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/** @brief Starts showing output a screenful at a time. This only works when
+ *      stdout and the controlling terminal are both available
+ *  @returns false if output should just be written to stdout
+ */
+bool page_begin(void);
+
+
+/** @brief Writes @p text to stdout. Whenever the screen fills, this waits for
+ *      the reader: space shows another screenful, enter another line, and q
+ *      quits
+ *  @returns false once the reader has quit, after which nothing more should be
+ *      produced
+ */
+bool page_write(const char *text, size_t len);
+
+
+/** @brief Stops paging */
+void page_end(void);
+
+
+#endif /* DICT_PAGE_H */
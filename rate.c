@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "rate.h"
+#include "cache.h"
+#include "log.h"
+#include "trace.h"
+
+/** The bucket is kept in this file beside the cache, so that every process
+ *  draws from the same budget
+ */
+#define RATE_FILE "rate"
+
+/** Sustained request rate limits, in requests per second */
+#define RATE_INITIAL 4.0
+#define RATE_MIN     0.5
+#define RATE_MAX     40.0
+
+/** Rate gained for each successful request */
+#define RATE_STEP 0.05
+
+/** Depth of the bucket, i.e. the largest burst allowed after a quiet spell */
+#define RATE_BURST 8.0
+
+/** Hold-off after throttling when the server gives no Retry-After. This doubles
+ *  with each consecutive refusal
+ */
+#define RATE_BACKOFF     1.0
+#define RATE_BACKOFF_MAX 120.0
+
+/** Limit on requests in flight from a single process */
+#define RATE_WINDOW_MAX 32.0
+
+
+struct rate_state {
+    double tokens;
+    double rate;
+    double stamp;   /* Time of the last refill */
+    double until;   /* No requests may be sent before this time */
+    double backoff;
+};
+
+
+static struct {
+    int               fd;       /* -1 if the state is not shared */
+    bool              locked;   /* Whether the shared state is held */
+    struct rate_state local;
+    double            window;
+} rl = { .fd = -1, .window = 2.0 };
+
+
+static double rate_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double rate_clamp(double x, double lo, double hi)
+{
+    return (x < lo) ? lo : (x > hi) ? hi : x;
+}
+
+
+int rate_init(void)
+{
+    char path[260];
+
+    if (rl.fd != -1) {
+        return 0;
+    }
+    if (cache_init() || cache_auxpath(path, sizeof path, RATE_FILE)) {
+        return 1;
+    }
+    rl.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (rl.fd == -1) {
+        dict_perror("Cannot open shared rate limit");
+        return 1;
+    }
+    return 0;
+}
+
+
+/** @brief Locks and reads the shared state into @p st, resetting it if it is
+ *      missing or nonsensical, then refills the bucket. If it cannot be locked,
+ *      this process's own state is used instead, and the shared state is left
+ *      alone
+ */
+static double rate_lock(struct rate_state *st)
+{
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    int res = -1;
+    double now;
+
+    if (rl.fd != -1) {
+        do {
+            res = fcntl(rl.fd, F_SETLKW, &fl);
+        } while (res == -1 && errno == EINTR);
+        if (res == -1) {
+            dict_perror("Cannot lock shared rate limit");
+        }
+    }
+    rl.locked = res != -1;
+    if (!rl.locked) {
+        *st = rl.local;
+    } else if (pread(rl.fd, st, sizeof *st, 0) != sizeof *st) {
+        memset(st, 0, sizeof *st);
+    }
+    now = rate_now();
+    /* These comparisons are also false for NaN */
+    if (!(st->rate >= RATE_MIN && st->rate <= RATE_MAX)
+     || !(st->stamp <= now) || !(st->backoff >= RATE_BACKOFF)) {
+        st->tokens = RATE_BURST;
+        st->rate = RATE_INITIAL;
+        st->stamp = now;
+        st->until = 0;
+        st->backoff = RATE_BACKOFF;
+    }
+    st->until = rate_clamp(st->until, 0, now + RATE_BACKOFF_MAX);
+    st->tokens = rate_clamp(st->tokens + (now - st->stamp) * st->rate, 0, RATE_BURST);
+    st->stamp = now;
+    return now;
+}
+
+
+static void rate_unlock(const struct rate_state *st)
+{
+    struct flock fl = { .l_type = F_UNLCK, .l_whence = SEEK_SET };
+
+    if (!rl.locked) {
+        rl.local = *st;
+    } else {
+        if (pwrite(rl.fd, st, sizeof *st, 0) != sizeof *st) {
+            dict_perror("Cannot update shared rate limit");
+        }
+        fcntl(rl.fd, F_SETLK, &fl);
+    }
+}
+
+
+double rate_take(void)
+{
+    struct rate_state st;
+    double now, wait = 0;
+
+    now = rate_lock(&st);
+    if (now < st.until) {
+        wait = st.until - now;
+    } else if (st.tokens >= 1) {
+        st.tokens -= 1;
+    } else {
+        wait = (1 - st.tokens) / st.rate;
+    }
+    rate_unlock(&st);
+    if (wait > 0) {
+        TRACE(RATE_WAIT, NULL, wait * 1000, 0);
+    }
+    return wait;
+}
+
+
+double rate_holdoff(void)
+{
+    struct rate_state st;
+    double now;
+
+    now = rate_lock(&st);
+    rate_unlock(&st);
+    return (now < st.until) ? st.until - now : 0;
+}
+
+
+void rate_feedback(long status, long retry_after)
+{
+    struct rate_state st;
+    double now, wait;
+
+    TRACE(RATE_REPLY, NULL, status, retry_after);
+    now = rate_lock(&st);
+    if (rate_throttled(status)) {
+        wait = (retry_after > 0) ? (double)retry_after : st.backoff;
+        st.rate = rate_clamp(st.rate / 2, RATE_MIN, RATE_MAX);
+        st.backoff = rate_clamp(st.backoff * 2, RATE_BACKOFF, RATE_BACKOFF_MAX);
+        st.until = rate_clamp(now + wait, st.until, now + RATE_BACKOFF_MAX);
+        st.tokens = 0;
+        rl.window = rate_clamp(rl.window / 2, 1, RATE_WINDOW_MAX);
+    } else if (status >= 200 && status < 500) {
+        st.rate = rate_clamp(st.rate + RATE_STEP, RATE_MIN, RATE_MAX);
+        st.backoff = RATE_BACKOFF;
+        rl.window = rate_clamp(rl.window + 1 / rl.window, 1, RATE_WINDOW_MAX);
+    }
+    rate_unlock(&st);
+}
+
+
+int rate_window(void)
+{
+    return (int)rl.window;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef DICT_RATE_H
+#define DICT_RATE_H
+
+
+/** @brief Opens the request budget shared by every dict process on this
+ *      machine. Without it, each process only limits itself
+ *  @returns Nonzero on error. The limiter still works, per process
+ */
+int rate_init(void);
+
+
+/** @brief Takes a token from the shared bucket if one is available
+ *  @returns Zero if a request may be sent now, otherwise the number of seconds
+ *      to wait before asking again
+ */
+double rate_take(void);
+
+
+/** @brief Retrieves how long every process must still hold off because the
+ *      server throttled one of them. Unlike rate_take this does not consume a
+ *      token, so that interactive lookups are not queued behind bulk traffic
+ *  @returns Seconds remaining, or zero
+ */
+double rate_holdoff(void);
+
+
+/** @brief Reports the outcome of a request to the limiter. Successes raise the
+ *      sustained rate additively; HTTP 429 and 503 halve it and hold off every
+ *      process for @p retry_after seconds, or for an exponentially growing
+ *      backoff if the server did not say
+ *  @param status
+ *      HTTP status code of the reply, or zero if the transfer failed
+ *  @param retry_after
+ *      Value of the Retry-After header in seconds, or zero if absent
+ */
+void rate_feedback(long status, long retry_after);
+
+
+/** @brief Retrieves the number of requests this process should keep in flight.
+ *      This grows by one per round trip while requests succeed and halves when
+ *      the server pushes back
+ */
+int rate_window(void);
+
+
+/** @brief Checks whether @p status means the server is shedding load */
+static inline int rate_throttled(long status)
+{
+    return status == 429 || status == 503;
+}
+
+
+#endif /* DICT_RATE_H */
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "repl.h"
+#include "log.h"
+
+/** The most words a single line may be split into. Anything after this is
+ *  ignored, which is harmless since only one WORD is ever used
+ */
+#define REPL_MAXARGS 16
+
+#define REPL_PROMPT "dict> "
+
+
+/** @brief Splits @p line into whitespace-delimited words in place. Like the
+ *      real argv, the result is NULL-terminated
+ *  @returns The number of words written to @p argv, not counting argv[0]
+ */
+static int repl_split(char *line, char *argv[], int maxargs)
+{
+    static const char *delim = " \t\r\n";
+    char *save, *tok;
+    int argc = 0;
+
+    argv[argc++] = "dict";
+    for (tok = strtok_r(line, delim, &save);
+         tok && argc < maxargs - 1;
+         tok = strtok_r(NULL, delim, &save)) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+    return argc - 1;
+}
+
+
+int dict_repl(repl_cmd_t *cmd)
+{
+    char *argv[REPL_MAXARGS], *line;
+    struct options opt;
+    int argc;
+
+    puts("Enter a word to look it up, -h for options, or Ctrl-D to quit");
+    while ((line = readline(REPL_PROMPT))) {
+        if (line[strspn(line, " \t")]) {
+            add_history(line);
+        }
+        argc = repl_split(line, argv, REPL_MAXARGS);
+        if (argc) {
+            memset(&opt, 0, sizeof opt);
+            dict_opt_parse(argc + 1, argv, &opt);
+            if (opt.interactive) {
+                dict_logs(DICT_WARN, "Already in interactive mode");
+            } else {
+                cmd(&opt);
+            }
+        }
+        free(line);
+    }
+    putchar('\n');
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#ifndef DICT_REPL_H
+#define DICT_REPL_H
+
+#include "opt.h"
+
+
+/** @brief Callback that carries out a single query parsed from the prompt */
+typedef int repl_cmd_t(struct options *opt);
+
+
+/** @brief Reads lines from a line-editing prompt until EOF. Each line is split
+ *      into words and parsed exactly like a command line, so "-f WORD",
+ *      "-r WORD" and "-l" behave as they do from the shell, then passed to
+ *      @p cmd
+ *  @returns Nonzero on error
+ */
+int dict_repl(repl_cmd_t *cmd);
+
+
+#endif /* DICT_REPL_H */
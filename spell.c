@@ -0,0 +1,630 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spell.h"
+#include "cache.h"
+#include "log.h"
+#include "meta.h"
+#include "wrap.h"
+
+/** The compiled word list, kept beside the cache, and the lock held while it
+ *  is compiled
+ */
+#define SPELL_FILE "spell"
+#define SPELL_LOCK "spell.lock"
+
+#define SPELL_MAGIC 0x324c4c4550534944
+
+/** The fewest seconds between compiles made only because the cache changed */
+#define SPELL_REFRESH 60
+
+/** Niceness of the process compiling the word list */
+#define SPELL_NICE 10
+
+/** Used when DICT_WORDS is not set */
+#define SPELL_WORDS "/usr/share/dict/words"
+
+/** Lines of the word list this long or longer are skipped. Short enough that no
+ *  key made from one can overflow
+ */
+#define SPELL_LINELEN (KEY_MAXLEN / 4)
+
+
+/** Header of the compiled word list. It is followed by the offset of each word
+ *  into the text, then the pairs sorted by hash, then the text itself: every
+ *  word as a key and nul-terminated, those of the list sorted, then the words
+ *  in the user's cache that the list lacks
+ */
+struct spell_head {
+    uint64_t magic;
+    int64_t  mtime;     /* Of the word list compiled, or zero if there is none */
+    int64_t  size;
+    uint32_t words;
+    uint32_t pairs;
+    uint32_t textlen;
+    uint32_t listed;    /* Words from the list, which come first */
+    uint32_t gen;       /* meta_generation of the cache's index when compiled */
+    uint32_t pad;
+};
+
+
+/** Records that the word numbered @p word, or it with one letter deleted,
+ *  hashes to @p hash. Two words one edit apart share at least one such hash
+ */
+struct spell_pair {
+    uint32_t hash;
+    uint32_t word;
+};
+
+
+/** The word list as it is compiled */
+struct spell_build {
+    char             **word;
+    size_t             nword;
+    size_t             capword;
+    size_t             listed;
+    struct spell_pair *pair;
+    size_t             npair;
+    size_t             cappair;
+    uint32_t           cur;     /* The word whose pairs are being made */
+    int                failed;
+};
+
+
+/** The corrections found so far for one word */
+struct spell_ctx {
+    uint32_t            cps[KEY_MAXLEN];
+    size_t              n;
+    struct spell_guess *guess;
+    int                 count;
+};
+
+
+typedef void spell_hash_fn(uint32_t hash, void *ctx);
+
+
+static struct {
+    int                      tried;
+    void                    *map;
+    size_t                   len;
+    const uint32_t          *off;
+    const struct spell_pair *pair;
+    const char              *text;
+    uint32_t                 words;
+    uint32_t                 pairs;
+    uint32_t                 textlen;
+    uint32_t                 listed;
+    uint32_t                 gen;
+    int64_t                  mtime;     /* Zero if there is no word list */
+} spell = { 0 };
+
+
+static uint32_t spell_hash(const char *str)
+{
+    uint64_t hash = key_hash(str);
+
+    return (uint32_t)(hash ^ hash >> 32);
+}
+
+
+/** @brief Passes the hash of @p word, and that of every string made by
+ *      deleting one of its letters, to @p fn
+ */
+static void spell_deletes(const char *word, spell_hash_fn *fn, void *ctx)
+{
+    char buf[KEY_MAXLEN];
+    size_t len = strlen(word), pos, next;
+    uint32_t cp;
+
+    fn(spell_hash(word), ctx);
+    for (pos = 0; pos < len; pos = next) {
+        next = pos + wrap_decode((const unsigned char *)word + pos, &cp);
+        memcpy(buf, word, pos);
+        memcpy(buf + pos, word + next, len - next + 1);
+        fn(spell_hash(buf), ctx);
+    }
+}
+
+
+/** @brief Makes room for one more of @p size bytes at the end of @p *arr
+ *  @returns Nonzero on failure, leaving @p *arr as it was
+ */
+static int spell_grow(void *arr, size_t n, size_t *cap, size_t size)
+{
+    void **ptr = arr, *grown;
+    size_t want;
+
+    if (n < *cap) {
+        return 0;
+    }
+    want = (*cap) ? *cap * 2 : 4096;
+    grown = realloc(*ptr, want * size);
+    if (!grown) {
+        return 1;
+    }
+    *ptr = grown;
+    *cap = want;
+    return 0;
+}
+
+
+static void spell_add_pair(uint32_t hash, void *ctx)
+{
+    struct spell_build *b = ctx;
+
+    if (b->failed || (b->failed = spell_grow(&b->pair, b->npair, &b->cappair, sizeof *b->pair))) {
+        return;
+    }
+    b->pair[b->npair].hash = hash;
+    b->pair[b->npair].word = b->cur;
+    b->npair++;
+}
+
+
+static int spell_cmpword(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+static int spell_cmppair(const void *a, const void *b)
+{
+    const struct spell_pair *x = a, *y = b;
+
+    if (x->hash != y->hash) {
+        return (x->hash < y->hash) ? -1 : 1;
+    }
+    return (x->word > y->word) - (x->word < y->word);
+}
+
+
+/** @brief Reads the keys of every word in @p list into @p b, sorted and
+ *      without duplicates
+ */
+static int spell_read(const char *list, struct spell_build *b)
+{
+    char key[KEY_MAXLEN], *line = NULL;
+    size_t cap = 0, i, n;
+    ssize_t len;
+    FILE *fp;
+
+    fp = fopen(list, "r");
+    if (!fp) {
+        dict_perror(list);
+        return 1;
+    }
+    while (!b->failed && (len = getline(&line, &cap, fp)) > 0) {
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (!len || len >= SPELL_LINELEN || isspace((unsigned char)*line)
+         || key_canon(line, key)) {
+            continue;
+        }
+        b->failed = spell_grow(&b->word, b->nword, &b->capword, sizeof *b->word)
+                 || !(b->word[b->nword] = strdup(key));
+        b->nword += !b->failed;
+    }
+    free(line);
+    fclose(fp);
+    qsort(b->word, b->nword, sizeof *b->word, spell_cmpword);
+    for (i = n = 0; i < b->nword; i++) {
+        if (n && !strcmp(b->word[n - 1], b->word[i])) {
+            free(b->word[i]);
+        } else {
+            b->word[n++] = b->word[i];
+        }
+    }
+    b->nword = n;
+    return b->failed;
+}
+
+
+/** @brief Adds @p word, from the user's cache, to @p ctx unless it is listed */
+static void spell_add_cached(const char *word, void *ctx)
+{
+    struct spell_build *b = ctx;
+
+    if (b->failed || bsearch(&word, b->word, b->listed, sizeof *b->word, spell_cmpword)) {
+        return;
+    }
+    b->failed = spell_grow(&b->word, b->nword, &b->capword, sizeof *b->word)
+             || !(b->word[b->nword] = strdup(word));
+    b->nword += !b->failed;
+}
+
+
+/** @brief Pairs every word in @p b with its hashes, then sorts the pairs for
+ *      searching
+ *  @param[out] off
+ *      The offset of each word in the text
+ *  @returns The length of the text, or 0 on error
+ */
+static uint32_t spell_pair_up(struct spell_build *b, uint32_t *off)
+{
+    uint32_t textlen = 0;
+    size_t i, n;
+
+    for (i = 0; i < b->nword && !b->failed; i++) {
+        off[i] = textlen;
+        textlen += strlen(b->word[i]) + 1;
+        b->cur = i;
+        spell_deletes(b->word[i], spell_add_pair, b);
+    }
+    if (b->failed) {
+        return 0;
+    }
+    qsort(b->pair, b->npair, sizeof *b->pair, spell_cmppair);
+    for (i = n = 0; i < b->npair; i++) {
+        if (!n || spell_cmppair(&b->pair[n - 1], &b->pair[i])) {
+            b->pair[n++] = b->pair[i];
+        }
+    }
+    b->npair = n;
+    return textlen;
+}
+
+
+/** @brief Compiles the word list @p list, whose status is @p sbuf, and the
+ *      words in the user's cache to @p path. Without a list, @p list is NULL
+ *      and @p sbuf zero. It is written aside and renamed into place, so that
+ *      other processes see either the old one or the new
+ */
+static int spell_build(const char *list, const struct stat *sbuf, const char *path)
+{
+    struct spell_head head = { 0 };
+    struct spell_build b = { 0 };
+    uint32_t *off = NULL;
+    char tmp[260];
+    int res = 1;
+    size_t i;
+    FILE *fp;
+
+    if (snprintf(tmp, sizeof tmp, "%s.%ld", path, (long)getpid()) >= (int)sizeof tmp
+     || (list && spell_read(list, &b))) {
+        goto cleanup;
+    }
+    /* Taken first, so that words cached meanwhile make this out of date */
+    head.gen = meta_generation();
+    b.listed = b.nword;
+    cache_words(spell_add_cached, &b);
+    if (b.failed || b.nword > UINT32_MAX || !(off = malloc((b.nword + 1) * sizeof *off))) {
+        goto cleanup;
+    }
+    head.magic = SPELL_MAGIC;
+    head.mtime = sbuf->st_mtime;
+    head.size = sbuf->st_size;
+    head.words = b.nword;
+    head.listed = b.listed;
+    head.textlen = spell_pair_up(&b, off);
+    head.pairs = b.npair;
+    if (!head.textlen || b.npair > UINT32_MAX || !(fp = fopen(tmp, "w"))) {
+        goto cleanup;
+    }
+    res = fwrite(&head, sizeof head, 1, fp) != 1
+       || fwrite(off, sizeof *off, b.nword, fp) != b.nword
+       || fwrite(b.pair, sizeof *b.pair, b.npair, fp) != b.npair;
+    for (i = 0; i < b.nword && !res; i++) {
+        res = fputs(b.word[i], fp) == EOF || fputc('\0', fp) == EOF;
+    }
+    if (fclose(fp) || res || rename(tmp, path)) {
+        remove(tmp);
+        res = 1;
+    }
+cleanup:
+    for (i = 0; i < b.nword; i++) {
+        free(b.word[i]);
+    }
+    free(b.word);
+    free(b.pair);
+    free(off);
+    return res;
+}
+
+
+static int spell_valid(const struct spell_head *head, size_t len, const struct stat *src)
+{
+    const char *text;
+
+    if (len < sizeof *head || head->magic != SPELL_MAGIC
+     || head->mtime != src->st_mtime || head->size != src->st_size
+     || head->listed > head->words
+     || len != sizeof *head + (uint64_t)head->words * sizeof (uint32_t)
+             + (uint64_t)head->pairs * sizeof (struct spell_pair) + head->textlen) {
+        return 0;
+    }
+    text = (const char *)head + len - head->textlen;
+    return !head->textlen || !text[head->textlen - 1];
+}
+
+
+/** @brief Maps the compiled word list at @p path, if it was compiled from the
+ *      list whose status is @p src
+ */
+static int spell_map(const char *path, const struct stat *src)
+{
+    const struct spell_head *head;
+    struct stat sbuf;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    } else if (fstat(fd, &sbuf) || (size_t)sbuf.st_size < sizeof *head) {
+        close(fd);
+        return 1;
+    }
+    spell.len = sbuf.st_size;
+    spell.map = mmap(NULL, spell.len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (spell.map == MAP_FAILED) {
+        spell.map = NULL;
+        return 1;
+    }
+    head = spell.map;
+    if (!spell_valid(head, spell.len, src)) {
+        munmap(spell.map, spell.len);
+        spell.map = NULL;
+        return 1;
+    }
+    spell.words = head->words;
+    spell.pairs = head->pairs;
+    spell.textlen = head->textlen;
+    spell.listed = head->listed;
+    spell.mtime = head->mtime;
+    spell.gen = head->gen;
+    spell.off = (const uint32_t *)(head + 1);
+    spell.pair = (const struct spell_pair *)(spell.off + spell.words);
+    spell.text = (const char *)(spell.pair + spell.pairs);
+    return 0;
+}
+
+
+/** @brief Compiles the word list in a detached, low-priority process, so that
+ *      no lookup waits on it. Only one process compiles it at a time
+ */
+static void spell_compile(const char *list, const struct stat *sbuf, const char *path)
+{
+    struct flock fl = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+    char lock[260];
+    int fd;
+
+    fflush(NULL);
+    if (fork()) {
+        return;
+    }
+    setsid();
+    fd = open("/dev/null", O_RDWR);
+    if (fd != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO) {
+            close(fd);
+        }
+    }
+    if (nice(SPELL_NICE) == -1) {
+        /* Run anyway */
+    }
+    if (!cache_auxpath(lock, sizeof lock, SPELL_LOCK)
+     && (fd = open(lock, O_RDWR | O_CREAT, 0600)) != -1 && fcntl(fd, F_SETLK, &fl) != -1) {
+        spell_build(list, sbuf, path);
+    }
+    _exit(0);
+}
+
+
+/** @brief Maps the compiled word list. If it is missing or was compiled from
+ *      another version of the list, it is compiled again in the background,
+ *      and words go unjudged until it is ready. If only the cache has changed
+ *      since, it is used as it is, and compiled again at most every
+ *      SPELL_REFRESH seconds. This is only tried once per process
+ *  @returns Nonzero if there is no compiled word list yet
+ */
+static int spell_open(void)
+{
+    const char *list = getenv("DICT_WORDS");
+    struct stat sbuf, own;
+    char path[260];
+
+    if (spell.tried) {
+        return !spell.map;
+    }
+    spell.tried = 1;
+    if (!list) {
+        list = SPELL_WORDS;
+    }
+    if (!*list || stat(list, &sbuf)) {
+        list = NULL;
+        memset(&sbuf, 0, sizeof sbuf);
+    }
+    if (cache_auxpath(path, sizeof path, SPELL_FILE)) {
+        return 1;
+    } else if (spell_map(path, &sbuf)) {
+        spell_compile(list, &sbuf, path);
+        return 1;
+    } else if (spell.gen != meta_generation() && !stat(path, &own)
+            && time(NULL) - own.st_mtime >= SPELL_REFRESH) {
+        spell_compile(list, &sbuf, path);
+    }
+    return 0;
+}
+
+
+static const char *spell_word(uint32_t i)
+{
+    return (i < spell.words && spell.off[i] < spell.textlen)
+         ? spell.text + spell.off[i] : "";
+}
+
+
+/** @brief Finds @p word in the word list by bisection */
+static int spell_listed(const char *word)
+{
+    size_t lo = 0, hi = spell.listed, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        cmp = strcmp(word, spell_word(mid));
+        if (!cmp) {
+            return 1;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return 0;
+}
+
+
+static size_t spell_decode(const char *str, uint32_t cps[KEY_MAXLEN])
+{
+    const unsigned char *ptr = (const unsigned char *)str;
+    size_t n = 0;
+
+    while (*ptr && n < KEY_MAXLEN) {
+        ptr += wrap_decode(ptr, &cps[n++]);
+    }
+    return n;
+}
+
+
+static int spell_min(int a, int b)
+{
+    return (a < b) ? a : b;
+}
+
+
+/** @brief Counts the insertions, deletions, substitutions and swaps of adjacent
+ *      letters that turn @p a into @p b, editing no substring twice
+ *  @returns The distance, or SPELL_MAXDIST + 1 if it is further than that
+ */
+static int spell_distance(const uint32_t *a, size_t n, const uint32_t *b, size_t m)
+{
+    int rows[3][KEY_MAXLEN + 1], *cur, *prev, *prev2, best, d;
+    size_t i, j;
+
+    if (((n > m) ? n - m : m - n) > SPELL_MAXDIST) {
+        return SPELL_MAXDIST + 1;
+    }
+    for (j = 0; j <= m; j++) {
+        rows[0][j] = j;
+    }
+    for (i = 1; i <= n; i++) {
+        cur = rows[i % 3];
+        prev = rows[(i + 2) % 3];
+        prev2 = rows[(i + 1) % 3];
+        cur[0] = best = i;
+        for (j = 1; j <= m; j++) {
+            d = spell_min(prev[j], cur[j - 1]) + 1;
+            d = spell_min(d, prev[j - 1] + (a[i - 1] != b[j - 1]));
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]) {
+                d = spell_min(d, prev2[j - 2] + 1);
+            }
+            cur[j] = d;
+            best = spell_min(best, d);
+        }
+        if (best > SPELL_MAXDIST) {
+            return SPELL_MAXDIST + 1;
+        }
+    }
+    return spell_min(rows[n % 3][m], SPELL_MAXDIST + 1);
+}
+
+
+static int spell_cmpguess(const void *a, const void *b)
+{
+    const struct spell_guess *x = a, *y = b;
+
+    if (x->dist != y->dist) {
+        return x->dist - y->dist;
+    } else if (x->cached != y->cached) {
+        return y->cached - x->cached;
+    }
+    return strcmp(x->word, y->word);
+}
+
+
+/** @brief Keeps @p word among the corrections in @p ctx, if it is close enough
+ *      and closer than the furthest kept
+ */
+static void spell_consider(struct spell_ctx *ctx, const char *word)
+{
+    struct spell_guess cand;
+    uint32_t cps[KEY_MAXLEN];
+    int i;
+
+    cand.dist = spell_distance(ctx->cps, ctx->n, cps, spell_decode(word, cps));
+    if (!cand.dist || cand.dist > SPELL_MAXDIST) {
+        return;
+    }
+    for (i = 0; i < ctx->count; i++) {
+        if (!strcmp(ctx->guess[i].word, word)) {
+            return;
+        }
+    }
+    snprintf(cand.word, sizeof cand.word, "%s", word);
+    cand.cached = cache_contains(word);
+    if (ctx->count < SPELL_GUESSES) {
+        ctx->guess[ctx->count++] = cand;
+    } else if (spell_cmpguess(&cand, &ctx->guess[SPELL_GUESSES - 1]) < 0) {
+        ctx->guess[SPELL_GUESSES - 1] = cand;
+    } else {
+        return;
+    }
+    qsort(ctx->guess, ctx->count, sizeof *ctx->guess, spell_cmpguess);
+}
+
+
+/** @brief Considers every listed word paired with @p hash */
+static void spell_candidates(uint32_t hash, void *ctx)
+{
+    size_t lo = 0, hi = spell.pairs, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (spell.pair[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < spell.pairs && spell.pair[lo].hash == hash; lo++) {
+        spell_consider(ctx, spell_word(spell.pair[lo].word));
+    }
+}
+
+
+enum spell_verdict spell_check(const char         *word,
+                               struct spell_guess  guess[SPELL_GUESSES],
+                               int                *count)
+{
+    enum spell_verdict verdict = SPELL_UNJUDGED;
+    struct spell_ctx ctx = { 0 };
+
+    *count = 0;
+    if (spell_open()) {
+        return verdict;
+    } else if (spell.mtime) {
+        if (spell_listed(word)) {
+            return SPELL_KNOWN;
+        }
+        verdict = SPELL_UNKNOWN;
+    }
+    ctx.n = spell_decode(word, ctx.cps);
+    ctx.guess = guess;
+    spell_deletes(word, spell_candidates, &ctx);
+    *count = ctx.count;
+    return verdict;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef DICT_SPELL_H
+#define DICT_SPELL_H
+
+#include <stdbool.h>
+
+#include "key.h"
+
+/** The most corrections offered for one word */
+#define SPELL_GUESSES 5
+
+/** The furthest a correction may be from the word, in edits */
+#define SPELL_MAXDIST 2
+
+
+enum spell_verdict {
+    SPELL_UNJUDGED,     /* There is no word list to judge by */
+    SPELL_KNOWN,        /* The word is in the word list */
+    SPELL_UNKNOWN       /* It is not. Corrections, if any, were found */
+};
+
+
+struct spell_guess {
+    char word[KEY_MAXLEN];
+    int  dist;          /* Edits away from the word asked for */
+    bool cached;        /* An entry for it is cached */
+};
+
+
+/** @brief Checks the key @p word against the word list and the words in the
+ *      user's cache, without going near the network. The word list is
+ *      DICT_WORDS, else /usr/share/dict/words; an empty DICT_WORDS turns it
+ *      off. It is compiled with the cached words into a deletion index kept
+ *      beside the cache, in the background on first use and whenever the list
+ *      changes, and at most every minute while the cache changes. Corrections
+ *      are found by looking up the word with up to one letter deleted, so
+ *      every word one edit away is found, as are most two away. Until the
+ *      index is first compiled, words go unjudged and nothing is suggested
+ *  @param[out] guess
+ *      Corrections, closest first, those cached before those not
+ *  @param[out] count
+ *      The number of corrections written to @p guess
+ */
+enum spell_verdict spell_check(const char         *word,
+                               struct spell_guess  guess[SPELL_GUESSES],
+                               int                *count);
+
+
+#endif /* DICT_SPELL_H */
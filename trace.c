@@ -0,0 +1,170 @@
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "trace.h"
+
+
+struct trace_ring trace_ring = { 0 };
+
+
+static const struct {
+    const char *name;
+    const char *fmt;
+} trace_info[] = {
+#define TRACE_INFO(name, lvl, fmt) { #name, fmt },
+    TRACE_EVENTS(TRACE_INFO)
+#undef TRACE_INFO
+};
+
+
+/** A line being formatted. This is done by hand, since nothing in stdio is
+ *  safe to call from the crash handler
+ */
+struct trace_line {
+    char  *buf;
+    size_t len;
+    size_t used;
+    bool   full;
+};
+
+
+static void trace_putc(struct trace_line *l, char c)
+{
+    if (l->used + 1 < l->len) {
+        l->buf[l->used++] = c;
+    } else {
+        l->full = true;
+    }
+}
+
+
+/** @brief Appends at most @p max chars of @p str, then spaces up to @p width */
+static void trace_puts(struct trace_line *l, const char *str, size_t max, size_t width)
+{
+    size_t i;
+
+    for (i = 0; str[i] && i < max; i++) {
+        trace_putc(l, str[i]);
+    }
+    for (; i < width; i++) {
+        trace_putc(l, ' ');
+    }
+}
+
+
+/** @brief Appends @p val in decimal, right-aligned to @p width with @p pad */
+static void trace_putu(struct trace_line *l, unsigned long long val, size_t width, char pad)
+{
+    char digits[24];
+    size_t n = 0;
+
+    do {
+        digits[n++] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+    for (; width > n; width--) {
+        trace_putc(l, pad);
+    }
+    while (n) {
+        trace_putc(l, digits[--n]);
+    }
+}
+
+
+/** @brief Formats one event into @p buf. The formats in TRACE_EVENTS only use
+ *      %s for the tag, %.0s to skip it, and %llu for the integers, in order
+ *  @returns The length of the line, or -1 if it did not fit
+ */
+static int trace_format(char *buf, size_t len, const struct trace_event *ev, uint64_t t0)
+{
+    const char *fmt = (ev->id < TRACE_COUNT) ? trace_info[ev->id].fmt : "?";
+    const char *name = (ev->id < TRACE_COUNT) ? trace_info[ev->id].name : "?";
+    const unsigned long long arg[] = { ev->a, ev->b };
+    struct trace_line l = { .buf = buf, .len = len };
+    uint64_t us = (ev->ns - t0 + 500) / 1000;
+    unsigned narg = 0;
+
+    trace_putu(&l, us / 1000, 6, ' ');
+    trace_putc(&l, '.');
+    trace_putu(&l, us % 1000, 3, '0');
+    trace_puts(&l, " ms  ", 5, 0);
+    trace_puts(&l, name, (size_t)-1, 11);
+    trace_puts(&l, "  ", 2, 0);
+    while (*fmt) {
+        if (!strncmp(fmt, "%s", 2)) {
+            trace_puts(&l, ev->tag, sizeof ev->tag, 0);
+            fmt += 2;
+        } else if (!strncmp(fmt, "%.0s", 4)) {
+            fmt += 4;
+        } else if (!strncmp(fmt, "%llu", 4)) {
+            trace_putu(&l, (narg < 2) ? arg[narg] : 0, 0, ' ');
+            narg++;
+            fmt += 4;
+        } else {
+            trace_putc(&l, *fmt++);
+        }
+    }
+    trace_putc(&l, '\n');
+    return (l.full) ? -1 : (int)l.used;
+}
+
+
+static void trace_write(int fd)
+{
+    uint64_t first, i;
+    char line[160];
+    int len;
+
+    first = (trace_ring.head > TRACE_RING) ? trace_ring.head - TRACE_RING : 0;
+    if (first == trace_ring.head) {
+        return;
+    }
+    for (i = first; i < trace_ring.head; i++) {
+        len = trace_format(line, sizeof line, &trace_ring.ev[i % TRACE_RING],
+                           trace_ring.ev[first % TRACE_RING].ns);
+        if (len > 0 && write(fd, line, len) < 0) {
+            return;
+        }
+    }
+}
+
+
+void trace_dump(void)
+{
+    fflush(stderr);
+    trace_write(STDERR_FILENO);
+}
+
+
+static void trace_crash(int sig)
+{
+    static const char head[] = "dict: crashed; recent trace events follow\n";
+
+    if (write(STDERR_FILENO, head, sizeof head - 1) > 0) {
+        trace_write(STDERR_FILENO);
+    }
+    raise(sig);     /* SA_RESETHAND has restored the default action */
+}
+
+
+void trace_init(void)
+{
+    static const int sigs[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction sa;
+    size_t i;
+
+    if (!TRACE_LEVEL) {
+        return;
+    }
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = trace_crash;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < sizeof sigs / sizeof *sigs; i++) {
+        sigaction(sigs[i], &sa, NULL);
+    }
+}
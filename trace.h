@@ -0,0 +1,127 @@
+#pragma once
+
+#ifndef DICT_TRACE_H
+#define DICT_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/** Trace points above this level are compiled out entirely. Level 1 covers
+ *  events that happen a handful of times per query; level 2 adds per-probe and
+ *  per-callback events. Build with -DTRACE_LEVEL=0 to remove tracing
+ */
+#ifndef TRACE_LEVEL
+#   define TRACE_LEVEL 1
+#endif
+
+/** The number of events kept. Older events are overwritten */
+#define TRACE_RING 4096
+
+
+/** Every trace point: its name, level, and the format its tag and two
+ *  arguments are printed with when the ring is dumped. Formats consume the tag
+ *  (%s, or %.0s to skip it), then the first and second arguments (%llu), in
+ *  that order, and may stop early. The dump runs in the crash handler, so it
+ *  formats these by hand and understands nothing else
+ */
+#define TRACE_EVENTS(X)                                                     \
+    X(HOT_HIT,     1, "hot cache hit \"%s\", %llu bytes")                   \
+    X(HOT_PUT,     1, "hot cache store \"%s\", %llu bytes")                 \
+    X(HOT_RECLAIM, 1, "hot cache slot %.0s%llu taken from dead pid %llu")   \
+    X(HOT_PROBE,   2, "hot cache probe \"%s\", way %llu")                   \
+    X(CORE_HIT,    1, "core vocabulary hit \"%s\", %llu bytes")            \
+    X(FREEZE_HIT,  1, "frozen image hit \"%s\", %llu bytes")               \
+    X(DISK_HIT,    1, "disk hit \"%s\", %llu bytes, tier %llu")             \
+    X(DISK_MISS,   1, "disk miss \"%s\"")                                   \
+    X(DISK_WRITE,  1, "disk write \"%s\", %llu bytes")                      \
+    X(DISK_EVICT,  1, "evicted %s, accessed at %llu")                       \
+    X(DISK_REMOVE, 1, "removed \"%s\"")                                     \
+    X(LRU_HIT,     2, "lru hit \"%s\"")                                     \
+    X(LRU_MISS,    2, "lru miss \"%s\"")                                    \
+    X(LEMMA,       1, "trying base form \"%s\"")                            \
+    X(FETCH,       1, "fetching \"%s\"")                                    \
+    X(HEDGE_START, 1, "request to backend %.0s%llu")                        \
+    X(HEDGE_BYTE,  1, "first byte from backend %.0s%llu after %llu ms")     \
+    X(HEDGE_STALL, 1, "no byte from backend %.0s%llu in %llu ms, given up") \
+    X(HEDGE_DONE,  1, "backend %.0s%llu finished, HTTP %llu")               \
+    X(CURL_WRITE,  2, "curl write callback, %.0s%llu bytes")                \
+    X(RATE_WAIT,   1, "rate limit%.0s wait %llu ms")                        \
+    X(RATE_REPLY,  1, "rate feedback%.0s HTTP %llu, Retry-After %llu")
+
+
+enum trace_id {
+#define TRACE_ENUM(name, lvl, fmt) TRACE_##name,
+    TRACE_EVENTS(TRACE_ENUM)
+#undef TRACE_ENUM
+    TRACE_COUNT
+};
+
+enum trace_lvl {
+#define TRACE_ENUM(name, lvl, fmt) TRACE_LVL_##name = lvl,
+    TRACE_EVENTS(TRACE_ENUM)
+#undef TRACE_ENUM
+};
+
+
+/** One event. The tag holds the start of a word, which is plenty to tell
+ *  events apart without storing it whole
+ */
+struct trace_event {
+    uint64_t ns;
+    uint64_t a;
+    uint64_t b;
+    uint16_t id;
+    char     tag[22];
+};
+
+struct trace_ring {
+    struct trace_event ev[TRACE_RING];
+    uint64_t           head;    /* Total events ever recorded */
+};
+
+extern struct trace_ring trace_ring;
+
+
+/** @brief Records an event. Use TRACE instead, which compiles disabled levels
+ *      away
+ */
+static inline void trace_emit(enum trace_id id, const char *tag, uint64_t a, uint64_t b)
+{
+    struct trace_event *ev = &trace_ring.ev[trace_ring.head++ % TRACE_RING];
+    struct timespec ts;
+    size_t i = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ev->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    ev->id = id;
+    ev->a = a;
+    ev->b = b;
+    for (; tag && tag[i] && i < sizeof ev->tag - 1; i++) {
+        ev->tag[i] = tag[i];
+    }
+    ev->tag[i] = '\0';
+}
+
+
+/** @brief Records the event @p name with the word @p tag, which may be NULL,
+ *      and two integers. Nothing is formatted until the ring is dumped
+ */
+#define TRACE(name, tag, a, b) do {                                         \
+    if (TRACE_LVL_##name <= TRACE_LEVEL) {                                  \
+        trace_emit(TRACE_##name, (tag), (uint64_t)(a), (uint64_t)(b));      \
+    }                                                                       \
+} while (0)
+
+
+/** @brief Installs handlers that dump the ring to stderr if the process
+ *      crashes
+ */
+void trace_init(void);
+
+
+/** @brief Formats every event still in the ring to stderr, oldest first */
+void trace_dump(void);
+
+
+#endif /* DICT_TRACE_H */
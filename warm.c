@@ -0,0 +1,578 @@
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include <json-c/json.h>
+
+#include "warm.h"
+#include "cache.h"
+#include "key.h"
+#include "json.h"
+#include "log.h"
+#include "net.h"
+#include "rate.h"
+
+/** The most transfers ever kept in flight at once. They all share the multi
+ *  handle's connection pool, so this also bounds the number of connections
+ *  opened to the API. The limiter decides how many of these are used
+ */
+#define WARM_JOBS 16
+
+/** Minimum seconds between redraws of the progress line */
+#define WARM_REDRAW 0.25
+
+
+struct warm_job {
+    CURL              *hcurl;
+    struct net_buf     buf;
+    const char        *word;
+    struct curl_slist *hdrs;    /* Its condition, when revalidating */
+};
+
+
+static struct {
+    char  **word;       /* Words still to be fetched */
+    size_t  count;
+    size_t  cap;
+
+    char  **missing;    /* Sorted contents of the journal */
+    size_t  nmissing;
+    size_t  missingcap;
+    FILE   *journal;
+
+    bool    revalidate; /* The words are cached, and only fetched if changed */
+    size_t  cached;     /* Words in the list that were already cached */
+
+    size_t  done;
+    size_t  fetched;
+    size_t  same;       /* Revalidated and unchanged */
+    size_t  absent;     /* Removed from the cache when revalidating */
+    size_t  failed;
+
+    double  start;
+    double  drawn;
+} warm = { 0 };
+
+
+static volatile sig_atomic_t warm_stop = 0;
+
+
+static void warm_sigint(int sig)
+{
+    (void)sig;
+    warm_stop = 1;
+}
+
+
+static double warm_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/** @brief Strips leading and trailing whitespace from @p line in place */
+static char *warm_trim(char *line)
+{
+    char *end;
+
+    line += strspn(line, " \t\r\n");
+    end = line + strlen(line);
+    while (end > line && strchr(" \t\r\n", end[-1])) {
+        *--end = '\0';
+    }
+    return line;
+}
+
+
+static int warm_push(char ***arr, size_t *count, size_t *cap, const char *word)
+{
+    char **grown;
+
+    if (*count == *cap) {
+        *cap = (*cap) ? 2 * *cap : 256;
+        grown = realloc(*arr, *cap * sizeof **arr);
+        if (!grown) {
+            return 1;
+        }
+        *arr = grown;
+    }
+    (*arr)[*count] = strdup(word);
+    return (*arr)[(*count)++] == NULL;
+}
+
+
+static int warm_cmp(const void *lhs, const void *rhs)
+{
+    return strcmp(*(char *const *)lhs, *(char *const *)rhs);
+}
+
+
+static bool warm_is_missing(const char *word)
+{
+    if (!warm.nmissing) {
+        return false;
+    }
+    return bsearch(&word, warm.missing, warm.nmissing, sizeof *warm.missing, warm_cmp) != NULL;
+}
+
+
+/** @brief Reads every line of @p fp, calling @p fn on each trimmed, nonempty,
+ *      uncommented one
+ */
+static int warm_readlines(FILE *fp, int (*fn)(const char *))
+{
+    size_t len = 0;
+    char *line = NULL, *word;
+    int res = 0;
+
+    while (!res && getline(&line, &len, fp) != -1) {
+        word = warm_trim(line);
+        if (*word && *word != '#') {
+            res = fn(word);
+        }
+    }
+    free(line);
+    return res;
+}
+
+
+static int warm_add_missing(const char *word)
+{
+    return warm_push(&warm.missing, &warm.nmissing, &warm.missingcap, word);
+}
+
+
+static int warm_add_word(const char *word)
+{
+    char key[KEY_MAXLEN];
+
+    if (key_canon(word, key)) {
+        return 0;   /* Skip it, the rest of the list may be fine */
+    } else if (cache_contains(key)) {
+        warm.cached++;
+        return 0;
+    } else if (warm_is_missing(key)) {
+        return 0;
+    }
+    return warm_push(&warm.word, &warm.count, &warm.cap, key);
+}
+
+
+/** @brief Loads the journal of absent words and opens it for appending */
+static void warm_open_journal(void)
+{
+    char path[260];
+    FILE *fp;
+
+    if (cache_auxpath(path, sizeof path, WARM_MISSING)) {
+        return;
+    }
+    fp = fopen(path, "r");
+    if (fp) {
+        warm_readlines(fp, warm_add_missing);
+        fclose(fp);
+        qsort(warm.missing, warm.nmissing, sizeof *warm.missing, warm_cmp);
+    }
+    warm.journal = fopen(path, "a");
+}
+
+
+/** A word to fetch and where it is in the list, to sort by */
+struct warm_pos {
+    char  *word;
+    size_t pos;
+};
+
+
+static int warm_poscmp(const void *lhs, const void *rhs)
+{
+    const struct warm_pos *x = lhs, *y = rhs;
+    int res = strcmp(x->word, y->word);
+
+    return (res) ? res : (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+
+/** @brief Drops repeated words, keeping the first of each where it was in the
+ *      list, so that the list keeps its order
+ *  @returns Nonzero on error
+ */
+static int warm_dedup(void)
+{
+    struct warm_pos *sorted;
+    size_t i, n = 0;
+
+    sorted = malloc((warm.count + 1) * sizeof *sorted);
+    if (!sorted) {
+        return 1;
+    }
+    for (i = 0; i < warm.count; i++) {
+        sorted[i].word = warm.word[i];
+        sorted[i].pos = i;
+    }
+    qsort(sorted, warm.count, sizeof *sorted, warm_poscmp);
+    for (i = 1; i < warm.count; i++) {
+        if (!strcmp(sorted[i - 1].word, sorted[i].word)) {
+            free(warm.word[sorted[i].pos]);
+            warm.word[sorted[i].pos] = NULL;
+        }
+    }
+    free(sorted);
+    for (i = 0; i < warm.count; i++) {
+        if (warm.word[i]) {
+            warm.word[n++] = warm.word[i];
+        }
+    }
+    warm.count = n;
+    return 0;
+}
+
+
+/** @brief Drops the words that do not fit in the cache beside those of the
+ *      list already cached, as warming them would only evict the words warmed
+ *      before them
+ *  @returns The number of words left to warm
+ */
+static size_t warm_cap(void)
+{
+    size_t max = cache_max(), room, i;
+
+    room = (warm.cached < max) ? max - warm.cached : 0;
+    if (warm.count <= room) {
+        return warm.count;
+    }
+    dict_logf(DICT_WARN, "The cache holds at most %zu entries, but the list has %zu words, "
+              "so only %zu more will be warmed; set DICT_CACHE_MAX to warm them all",
+              max, warm.cached + warm.count, room);
+    for (i = room; i < warm.count; i++) {
+        free(warm.word[i]);
+    }
+    warm.count = room;
+    return room;
+}
+
+
+/** @brief Counts the words warmed that are still in the user's cache */
+static size_t warm_kept(void)
+{
+    time_t atime, fetched;
+    size_t i, res = 0;
+
+    for (i = 0; i < warm.count; i++) {
+        res += !cache_stat(warm.word[i], &atime, &fetched);
+    }
+    return res;
+}
+
+
+static void warm_progress(bool force)
+{
+    double now, elapsed, rate, eta;
+
+    now = warm_now();
+    if (!force && now - warm.drawn < WARM_REDRAW) {
+        return;
+    }
+    warm.drawn = now;
+    elapsed = now - warm.start;
+    rate = (elapsed > 0) ? warm.done / elapsed : 0;
+    eta = (rate > 0) ? (warm.count - warm.done) / rate : 0;
+    fprintf(stderr, "\r\e[K%s: %zu/%zu words, %.1f words/s, ETA %02u:%02u",
+            (warm.revalidate) ? "revalidate" : "warm", warm.done, warm.count, rate,
+            (unsigned)eta / 60, (unsigned)eta % 60);
+    fflush(stderr);
+}
+
+
+/** @brief Handles a completed transfer, writing it through to the cache
+ *  @returns Nonzero if the server throttled the request and it should be
+ *      retried later
+ */
+static int warm_finish(struct warm_job *job, CURLcode result)
+{
+    struct json_object *json;
+    curl_off_t after = 0;
+    long status = 0;
+
+    net_learn(job->hcurl, result);
+    if (result) {
+        rate_feedback(0, 0);
+        warm.done++;
+        warm.failed++;
+        return 0;
+    }
+    curl_easy_getinfo(job->hcurl, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(job->hcurl, CURLINFO_RETRY_AFTER, &after);
+    rate_feedback(status, (long)after);
+    if (rate_throttled(status)) {
+        return 1;
+    }
+    warm.done++;
+    if (warm.revalidate && status == 304) {
+        if (cache_refresh(job->word, NULL, NULL)) {
+            warm.failed++;
+        } else {
+            warm.same++;
+        }
+        return 0;
+    } else if (status == 404 && warm.revalidate && cache_remove(job->word) < 0) {
+        warm.failed++;  /* Still cached, and stale */
+        return 0;
+    } else if (status == 404) {
+        warm.absent++;
+        if (warm.journal) {
+            fprintf(warm.journal, "%s\n", job->word);
+            fflush(warm.journal);
+        }
+        return 0;
+    }
+    json = dict_parse_JSON(job->buf.data, job->buf.data + job->buf.len);
+    if (status != 200 || json_object_get_type(json) != json_type_array) {
+        warm.failed++;
+    } else if ((warm.revalidate) ? cache_refresh(job->word, job->buf.data, &job->buf.val)
+                                 : cache_write(job->word, job->buf.data, &job->buf.val)) {
+        warm.failed++;
+    } else {
+        warm.fetched++;
+    }
+    json_object_put(json);
+    return 0;
+}
+
+
+/** @brief Makes the request for @p job conditional on its entry having changed.
+ *      Entries stored without validators are compared by when they were
+ *      fetched
+ */
+static int warm_condition(struct warm_job *job)
+{
+    struct cache_validators val;
+    time_t atime, fetched;
+
+    if (cache_get_validators(job->word, &val)) {
+        return 1;
+    } else if (!val.etag[0] && !val.modified[0] && !cache_stat(job->word, &atime, &fetched)) {
+        strftime(val.modified, sizeof val.modified, "%a, %d %b %Y %H:%M:%S GMT", gmtime(&fetched));
+    }
+    return net_condition(job->hcurl, &val, &job->hdrs);
+}
+
+
+static int warm_start(CURLM *multi, struct warm_job *job, const char *word)
+{
+    job->word = word;
+    if (net_prepare(job->hcurl, word, &job->buf)
+     || (warm.revalidate && warm_condition(job))) {
+        warm.done++;
+        warm.failed++;
+        return 1;
+    }
+    curl_multi_add_handle(multi, job->hcurl);
+    return 0;
+}
+
+
+/** @brief Runs every transfer through a pool of WARM_JOBS reusable handles,
+ *      starting them no faster than the shared limiter allows
+ */
+static int warm_run(CURLM *multi, struct warm_job *jobs)
+{
+    struct warm_job *idle[WARM_JOBS], *job;
+    const char *retry[WARM_JOBS], *word;
+    size_t next = 0;
+    int nidle = 0, nretry = 0, running = 0, queued, timeout, i;
+    double wait;
+    CURLMsg *msg;
+
+    for (i = 0; i < WARM_JOBS; i++) {
+        idle[nidle++] = &jobs[i];
+    }
+    do {
+        wait = 0;
+        while (!warm_stop && nidle && WARM_JOBS - nidle < rate_window()
+            && (nretry || next < warm.count)) {
+            wait = rate_take();
+            if (wait > 0) {
+                break;
+            }
+            word = (nretry) ? retry[--nretry] : warm.word[next++];
+            job = idle[--nidle];
+            if (warm_start(multi, job, word)) {
+                idle[nidle++] = job;
+            }
+        }
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE) {
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+                curl_multi_remove_handle(multi, msg->easy_handle);
+                if (warm_finish(job, msg->data.result)) {
+                    retry[nretry++] = job->word;
+                }
+                idle[nidle++] = job;
+            }
+        }
+        warm_progress(false);
+        if (warm_stop) {
+            break;
+        }
+        timeout = (wait > 0 && wait < 1) ? (int)(wait * 1000) + 1 : 1000;
+        curl_multi_poll(multi, NULL, 0, timeout, NULL);
+    } while (running || nretry || next < warm.count);
+    return warm_stop != 0;
+}
+
+
+static int warm_fetch(void)
+{
+    struct warm_job jobs[WARM_JOBS] = { 0 };
+    CURLM *multi;
+    int i, res = 1;
+
+    if (curlfn_load()) {
+        return 1;
+    }
+    multi = curl_multi_init();
+    if (!multi) {
+        dict_logs(DICT_ERROR, "Could not initialize curl");
+        return 1;
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)WARM_JOBS);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    for (i = 0; i < WARM_JOBS; i++) {
+        jobs[i].hcurl = curl_easy_init();
+        if (!jobs[i].hcurl) {
+            dict_logs(DICT_ERROR, "Could not initialize curl");
+            goto cleanup;
+        }
+        curl_easy_setopt(jobs[i].hcurl, CURLOPT_PRIVATE, &jobs[i]);
+        net_tune(jobs[i].hcurl);
+    }
+    warm.start = warm_now();
+    res = warm_run(multi, jobs);
+    warm_progress(true);
+    fputc('\n', stderr);
+cleanup:
+    for (i = 0; i < WARM_JOBS; i++) {
+        if (jobs[i].hcurl) {
+            curl_multi_remove_handle(multi, jobs[i].hcurl);
+            curl_easy_cleanup(jobs[i].hcurl);
+        }
+        curl_slist_free_all(jobs[i].hdrs);
+        net_buf_free(&jobs[i].buf);
+    }
+    curl_multi_cleanup(multi);
+    return res;
+}
+
+
+static void warm_free(void)
+{
+    size_t i;
+
+    for (i = 0; i < warm.count; i++) {
+        free(warm.word[i]);
+    }
+    for (i = 0; i < warm.nmissing; i++) {
+        free(warm.missing[i]);
+    }
+    free(warm.word);
+    free(warm.missing);
+    if (warm.journal) {
+        fclose(warm.journal);
+    }
+    memset(&warm, 0, sizeof warm);
+}
+
+
+int dict_warm(const char *path)
+{
+    void (*prev)(int);
+    int res = 1;
+    FILE *fp;
+
+    if (cache_init() || cache_index_load()) {
+        dict_logs(DICT_ERROR, "Cannot warm cache: Cache unavailable");
+        return 1;
+    }
+    fp = fopen(path, "r");
+    if (!fp) {
+        dict_perror("Cannot open word list");
+        return 1;
+    }
+    rate_init();
+    warm_open_journal();
+    res = warm_readlines(fp, warm_add_word) || warm_dedup();
+    fclose(fp);
+    if (res) {
+        dict_perror("Cannot read word list");
+    } else if (!warm.count) {
+        dict_logs(DICT_INFO, "Every word in the list is already cached");
+    } else if (warm_cap()) {
+        prev = signal(SIGINT, warm_sigint);
+        res = warm_fetch();
+        signal(SIGINT, prev);
+        dict_logf(DICT_INFO, "Cached %zu new words; %zu have no entry, %zu failed",
+                  warm_kept(), warm.absent, warm.failed);
+        if (warm_stop) {
+            dict_logs(DICT_WARN, "Interrupted; run again to resume");
+        }
+    }
+    warm_free();
+    return res;
+}
+
+
+int dict_revalidate(unsigned days)
+{
+    const struct meta_query q = { .sort = META_SORT_FETCHED };
+    time_t cutoff = time(NULL) - (time_t)days * 86400;
+    struct meta_rec *rows;
+    void (*prev)(int);
+    long n, i;
+    int res = 0;
+
+    if (cache_init() || cache_index_load()) {
+        dict_logs(DICT_ERROR, "Cannot revalidate cache: Cache unavailable");
+        return 1;
+    }
+    n = cache_query(&q, &rows);
+    if (n < 0) {
+        dict_logs(DICT_ERROR, "Cannot revalidate cache: Cannot read its index");
+        return 1;
+    }
+    /* Newest first */
+    for (i = 0; i < n && !res; i++) {
+        if (rows[i].fetched <= cutoff) {
+            res = warm_push(&warm.word, &warm.count, &warm.cap, rows[i].word);
+        }
+    }
+    free(rows);
+    warm.revalidate = true;
+    rate_init();
+    if (res) {
+        dict_perror("Cannot revalidate cache");
+    } else if (warm.count) {
+        prev = signal(SIGINT, warm_sigint);
+        res = warm_fetch();
+        signal(SIGINT, prev);
+        dict_logf(DICT_INFO, "Revalidated %zu words: %zu unchanged, %zu updated, "
+                  "%zu no longer have an entry and were removed, %zu failed",
+                  warm.done, warm.same, warm.fetched, warm.absent, warm.failed);
+        if (warm_stop) {
+            dict_logs(DICT_WARN, "Interrupted; words not yet revalidated are still stale");
+        }
+    } else {
+        dict_logs(DICT_INFO, "Nothing in the cache is old enough to revalidate");
+    }
+    warm_free();
+    return res;
+}
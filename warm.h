@@ -0,0 +1,30 @@
+#pragma once
+
+#ifndef DICT_WARM_H
+#define DICT_WARM_H
+
+/** Journal of words the API had no entry for, so a resumed run skips them */
+#define WARM_MISSING "warm.missing"
+
+
+/** @brief Fetches every word listed in the file at @p path into the cache. One
+ *      word is read per line; blank lines and lines beginning with '#' are
+ *      ignored. Words already cached, or previously found to have no entry,
+ *      are skipped, so an interrupted run resumes where it left off
+ *  @returns Nonzero on error
+ */
+int dict_warm(const char *path);
+
+
+/** @brief Asks the API whether each entry in the user's cache fetched at least
+ *      @p days days ago has changed, or every entry if @p days is zero. The
+ *      requests are conditional, using the validators stored with each entry,
+ *      and share the same connection pool and rate limiter as dict_warm. An
+ *      unchanged entry only has its fetch time updated; a changed one is
+ *      replaced. Neither counts as reading it
+ *  @returns Nonzero on error
+ */
+int dict_revalidate(unsigned days);
+
+
+#endif /* DICT_WARM_H */
@@ -0,0 +1,284 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "wrap.h"
+
+/** Fallback width when there is no terminal to ask */
+#define WRAP_COLUMNS 80
+
+/** Terminals narrower than this are treated as this wide */
+#define WRAP_MINCOLUMNS 20
+
+
+/** Sorted, inclusive codepoint ranges */
+struct wrap_range {
+    uint32_t lo;
+    uint32_t hi;
+};
+
+
+/** Combining marks, joiners and other characters that attach to the previous
+ *  grapheme and occupy no column of their own
+ */
+static const struct wrap_range zero_width[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD },
+    { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 },
+    { 0x05C7, 0x05C7 }, { 0x0610, 0x061A }, { 0x064B, 0x065F },
+    { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+    { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0900, 0x0902 },
+    { 0x093A, 0x093A }, { 0x093C, 0x093C }, { 0x0941, 0x0948 },
+    { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0E31, 0x0E31 },
+    { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF },
+    { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x202A, 0x202E },
+    { 0x2060, 0x2064 }, { 0x20D0, 0x20FF }, { 0x302A, 0x302D },
+    { 0x3099, 0x309A }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F },
+    { 0xFEFF, 0xFEFF }, { 0x1F3FB, 0x1F3FF }, { 0xE0000, 0xE007F },
+    { 0xE0100, 0xE01EF }
+};
+
+
+/** East Asian Wide and Fullwidth characters, which occupy two columns */
+static const struct wrap_range double_width[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A },
+    { 0x23E9, 0x23EC }, { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 },
+    { 0x25FD, 0x25FE }, { 0x2614, 0x2615 }, { 0x2648, 0x2653 },
+    { 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+    { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 },
+    { 0x26CE, 0x26CE }, { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA },
+    { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 }, { 0x26FA, 0x26FA },
+    { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+    { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E },
+    { 0x2753, 0x2755 }, { 0x2757, 0x2757 }, { 0x2795, 0x2797 },
+    { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF }, { 0x2B1B, 0x2B1C },
+    { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x303E },
+    { 0x3041, 0x3247 }, { 0x3250, 0x4DBF }, { 0x4E00, 0xA4C6 },
+    { 0xA960, 0xA97C }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+    { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6B }, { 0xFF01, 0xFF60 },
+    { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 }, { 0x17000, 0x18CD5 },
+    { 0x1B000, 0x1B2FB }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF },
+    { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F251 },
+    { 0x1F300, 0x1F320 }, { 0x1F32D, 0x1F335 }, { 0x1F337, 0x1F37C },
+    { 0x1F37E, 0x1F393 }, { 0x1F3A0, 0x1F3CA }, { 0x1F3CF, 0x1F3D3 },
+    { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 }, { 0x1F3F8, 0x1F43E },
+    { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC }, { 0x1F4FF, 0x1F53D },
+    { 0x1F54B, 0x1F54E }, { 0x1F550, 0x1F567 }, { 0x1F57A, 0x1F57A },
+    { 0x1F595, 0x1F596 }, { 0x1F5A4, 0x1F5A4 }, { 0x1F5FB, 0x1F64F },
+    { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC }, { 0x1F6D0, 0x1F6D2 },
+    { 0x1F6D5, 0x1F6D7 }, { 0x1F6EB, 0x1F6EC }, { 0x1F6F4, 0x1F6FC },
+    { 0x1F7E0, 0x1F7EB }, { 0x1F90C, 0x1F93A }, { 0x1F93C, 0x1F945 },
+    { 0x1F947, 0x1F9FF }, { 0x1FA70, 0x1FAFF }, { 0x20000, 0x2FFFD },
+    { 0x30000, 0x3FFFD }
+};
+
+
+static bool wrap_in(uint32_t cp, const struct wrap_range *tab, size_t N)
+{
+    size_t lo = 0, hi = N, mid;
+
+    if (cp < tab[0].lo || cp > tab[N - 1].hi) {
+        return false;
+    }
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cp > tab[mid].hi) {
+            lo = mid + 1;
+        } else if (cp < tab[mid].lo) {
+            hi = mid;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+size_t wrap_decode(const unsigned char *str, uint32_t *cp)
+{
+    size_t len, i;
+
+    if (str[0] < 0x80) {
+        *cp = str[0];
+        return 1;
+    } else if ((str[0] & 0xE0) == 0xC0) {
+        *cp = str[0] & 0x1F;
+        len = 2;
+    } else if ((str[0] & 0xF0) == 0xE0) {
+        *cp = str[0] & 0x0F;
+        len = 3;
+    } else if ((str[0] & 0xF8) == 0xF0) {
+        *cp = str[0] & 0x07;
+        len = 4;
+    } else {
+        *cp = 0xFFFD;
+        return 1;
+    }
+    for (i = 1; i < len; i++) {
+        if ((str[i] & 0xC0) != 0x80) {
+            *cp = 0xFFFD;
+            return 1;
+        }
+        *cp = (*cp << 6) | (str[i] & 0x3F);
+    }
+    return len;
+}
+
+
+/** @brief Computes the columns taken by the codepoint @p cp */
+static int wrap_cpwidth(uint32_t cp)
+{
+    if (cp < 0x20 || (cp >= 0x7F && cp < 0xA0)) {
+        return 0;
+    } else if (cp < 0x300) {
+        return 1;
+    } else if (wrap_in(cp, zero_width, sizeof zero_width / sizeof *zero_width)) {
+        return 0;
+    } else if (wrap_in(cp, double_width, sizeof double_width / sizeof *double_width)) {
+        return 2;
+    }
+    return 1;
+}
+
+
+static bool wrap_isspace(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+
+/** Broadcasts a byte across a machine word */
+#define WRAP_BYTES(b) (UINT64_C(0x0101010101010101) * (b))
+
+
+/** @brief Checks, eight bytes at once, that the word at @p ptr holds only
+ *      printable ASCII, i.e. no whitespace, controls, DEL, nul, or UTF-8. This
+ *      may report false negatives, which merely send the caller to the slow
+ *      path. All eight bytes must lie within the string
+ */
+static bool wrap_swar_plain(const unsigned char *ptr)
+{
+    uint64_t x;
+
+    memcpy(&x, ptr, sizeof x);
+    /* Below '!' borrows into, and DEL carries into, the high bit of its byte */
+    return !(((x - WRAP_BYTES(0x21)) | x | (x + WRAP_BYTES(0x01))) & WRAP_BYTES(0x80));
+}
+
+
+/** @brief Scans the non-whitespace run starting at @p str, measuring its width
+ *  @param end
+ *      The nul term of @p str
+ *  @returns A pointer to the first whitespace or nul char after the run
+ */
+static const char *wrap_scan_word(const char *str, const char *end, int *width)
+{
+    const unsigned char *ptr = (const unsigned char *)str;
+    const unsigned char *stop = (const unsigned char *)end;
+    uint32_t cp;
+    int w = 0, cw;
+    bool joined = false;
+
+    while (*ptr && !wrap_isspace(*ptr)) {
+        /* Never load past the nul; the last few bytes go the slow way */
+        while (stop - ptr >= (ptrdiff_t)sizeof(uint64_t) && wrap_swar_plain(ptr)) {
+            ptr += sizeof(uint64_t);
+            w += sizeof(uint64_t);
+            joined = false;
+        }
+        if (!*ptr || wrap_isspace(*ptr)) {
+            break;
+        }
+        ptr += wrap_decode(ptr, &cp);
+        cw = wrap_cpwidth(cp);
+        if (!joined) {
+            w += cw;
+        }
+        joined = cp == 0x200D;  /* A zero width joiner fuses the next glyph */
+    }
+    *width = w;
+    return (const char *)ptr;
+}
+
+
+/** @brief Scans the whitespace run starting at @p str
+ *  @returns A pointer to the next word, or the nul term
+ */
+static const char *wrap_scan_space(const char *str, int *width)
+{
+    const char *start = str;
+
+    while (wrap_isspace(*str)) {
+        str++;
+    }
+    *width = (int)(str - start);
+    return str;
+}
+
+
+int wrap_width(const char *str)
+{
+    const char *end = str + strlen(str);
+    int width = 0, w;
+
+    while (*str) {
+        str = wrap_scan_word(str, end, &w);
+        width += w;
+        str = wrap_scan_space(str, &w);
+        width += w;
+    }
+    return width;
+}
+
+
+int wrap_columns(void)
+{
+    static int columns = 0;
+    struct winsize ws;
+    const char *env;
+
+    if (columns) {
+        return columns;
+    }
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col) {
+        columns = ws.ws_col;
+    } else {
+        env = getenv("COLUMNS");
+        columns = (env) ? atoi(env) : 0;
+        columns = (columns > 0) ? columns : WRAP_COLUMNS;
+    }
+    columns = (columns < WRAP_MINCOLUMNS) ? WRAP_MINCOLUMNS : columns;
+    return columns;
+}
+
+
+void wrap_print(FILE *fp, const char *text, int width, const char *indent)
+{
+    const char *line, *end, *next, *term;
+    int col, gap, w;
+
+    text = wrap_scan_space((text) ? text : "", &gap);
+    term = text + strlen(text);
+    line = end = text;
+    col = gap = 0;
+    while (*text) {
+        next = wrap_scan_word(text, term, &w);
+        if (col && col + gap + w > width) {
+            fwrite(line, 1, end - line, fp);
+            fputc('\n', fp);
+            fputs(indent, fp);
+            line = text;
+            col = w;
+        } else {
+            col += gap + w;
+        }
+        end = next;
+        text = wrap_scan_space(next, &gap);
+    }
+    fwrite(line, 1, end - line, fp);
+    fputc('\n', fp);
+}
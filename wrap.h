@@ -0,0 +1,39 @@
+#pragma once
+
+#ifndef DICT_WRAP_H
+#define DICT_WRAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/** @brief Retrieves the width of the terminal on stdout. If stdout is not a
+ *      terminal, $COLUMNS is used, and failing that the classic 80
+ */
+int wrap_columns(void);
+
+
+/** @brief Decodes one UTF-8 sequence from @p str into @p cp. Malformed input
+ *      decodes one byte at a time as U+FFFD, so this always makes progress
+ *  @returns The number of bytes consumed
+ */
+size_t wrap_decode(const unsigned char *str, uint32_t *cp);
+
+
+/** @brief Computes the number of terminal columns the UTF-8 string @p str
+ *      occupies. Combining marks and other zero-width characters take no
+ *      space, and East Asian wide and fullwidth characters take two
+ */
+int wrap_width(const char *str);
+
+
+/** @brief Prints @p text, breaking lines at whitespace so that none of them is
+ *      wider than @p width columns. Each line after the first is prefixed with
+ *      @p indent, which is not counted in @p width. This always line breaks,
+ *      and makes a single pass over @p text
+ */
+void wrap_print(FILE *fp, const char *text, int width, const char *indent);
+
+
+#endif /* DICT_WRAP_H */